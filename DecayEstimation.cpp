@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <TMath.h>
+
+#include "main.h"
+
+/**
+ * Solves the square linear system A * X = B in place by Gaussian elimination with partial pivoting
+ * @param A Row-major N x N matrix, destroyed
+ * @param B Right-hand side of size N, replaced by the solution
+ * @return False if the system is singular
+ */
+Bool_t SolveLinearSystem(std::vector<Double_t> &A, std::vector<Double_t> &B)
+{
+    const auto N = static_cast<Int_t>(B.size());
+
+    for (Int_t Column = 0; Column < N; Column++)
+    {
+        Int_t Pivot = Column;
+        for (Int_t Row = Column + 1; Row < N; Row++)
+        {
+            if (std::fabs(A[Row * N + Column]) > std::fabs(A[Pivot * N + Column]))
+            {
+                Pivot = Row;
+            }
+        }
+
+        if (std::fabs(A[Pivot * N + Column]) < 1e-300)
+        {
+            return false;
+        }
+
+        if (Pivot != Column)
+        {
+            for (Int_t k = 0; k < N; k++)
+            {
+                std::swap(A[Pivot * N + k], A[Column * N + k]);
+            }
+            std::swap(B[Pivot], B[Column]);
+        }
+
+        for (Int_t Row = Column + 1; Row < N; Row++)
+        {
+            const Double_t Factor = A[Row * N + Column] / A[Column * N + Column];
+            for (Int_t k = Column; k < N; k++)
+            {
+                A[Row * N + k] -= Factor * A[Column * N + k];
+            }
+            B[Row] -= Factor * B[Column];
+        }
+    }
+
+    for (Int_t Row = N - 1; Row >= 0; Row--)
+    {
+        Double_t Sum = B[Row];
+        for (Int_t k = Row + 1; k < N; k++)
+        {
+            Sum -= A[Row * N + k] * B[k];
+        }
+        B[Row] = Sum / A[Row * N + Row];
+    }
+
+    return true;
+}
+
+/**
+ * Least-squares weights of Series[0, Size) on a constant and exponentials exp(-(Offset + i) / Tau)
+ * @return Weights, constant first, or an empty vector for a singular system
+ */
+std::vector<Double_t> FitExponentialWeights(const std::vector<Double_t> &Series, const Int_t Offset,
+                                            const std::vector<Double_t> &DecayConstants)
+{
+    const auto Terms = static_cast<Int_t>(DecayConstants.size()) + 1;
+    std::vector<Double_t> Normal(Terms * Terms, 0.0);
+    std::vector<Double_t> Weights(Terms, 0.0);
+    std::vector<Double_t> Basis(Terms, 1.0);
+
+    for (Int_t i = 0; i < static_cast<Int_t>(Series.size()); i++)
+    {
+        for (Int_t j = 1; j < Terms; j++)
+        {
+            Basis[j] = std::exp(-(Offset + i) / DecayConstants[j - 1]);
+        }
+
+        for (Int_t j = 0; j < Terms; j++)
+        {
+            for (Int_t k = 0; k < Terms; k++)
+            {
+                Normal[j * Terms + k] += Basis[j] * Basis[k];
+            }
+            Weights[j] += Basis[j] * Series[i];
+        }
+    }
+
+    if (!SolveLinearSystem(Normal, Weights))
+    {
+        return {};
+    }
+    return Weights;
+}
+
+/**
+ * Decay rates of a constant plus a sum of Order exponentials, by Prony's method in integral form.
+ *
+ * Such a signal solves a linear ODE of order Order with constant forcing. Integrating it Order
+ * times turns the ODE into a linear regression of y on a polynomial of degree Order in t and on
+ * the running integrals S1..SOrder of y, whose coefficients are those of the characteristic
+ * polynomial. Integration averages the noise instead of amplifying it as differencing would.
+ * The rates are the positive real roots of the characteristic polynomial.
+ *
+ * @param Series Samples, one per ns, baseline removed
+ * @param Order Number of exponentials
+ * @return Decay rates in 1/ns, ascending
+ */
+std::vector<Double_t> EstimateDecayRates(const std::vector<Double_t> &Series, const Int_t Order)
+{
+    const auto SampleCount = static_cast<Int_t>(Series.size());
+    const Int_t PolynomialTerms = Order + 1;
+    const Int_t Terms = PolynomialTerms + Order;
+
+    // Time normalized to [0, 1] keeps the regressors on comparable scales
+    const Double_t Length = SampleCount - 1;
+
+    std::vector<Double_t> Integrals(Order, 0.0);
+    std::vector<Double_t> Previous(Order, 0.0);
+    std::vector<Double_t> Regressors(Terms);
+    std::vector<Double_t> Normal(Terms * Terms, 0.0);
+    std::vector<Double_t> Coefficients(Terms, 0.0);
+
+    for (Int_t i = 0; i < SampleCount; i++)
+    {
+        // Trapezoidal running integrals S_o = int S_{o-1} dt, with S_0 = y. Previous[o] holds the
+        // integrand of S_o at the previous sample
+        Double_t Integrand = Series[i];
+        for (Int_t o = 0; o < Order && i > 0; o++)
+        {
+            Integrals[o] += 0.5 * (Integrand + Previous[o]) / Length;
+            Previous[o] = Integrand;
+            Integrand = Integrals[o];
+        }
+        if (i == 0)
+        {
+            Previous[0] = Series[0];
+        }
+
+        const Double_t T = i / Length;
+        Double_t Power = 1.0;
+        for (Int_t d = 0; d < PolynomialTerms; d++)
+        {
+            Regressors[d] = Power;
+            Power *= T;
+        }
+        for (Int_t o = 0; o < Order; o++)
+        {
+            Regressors[PolynomialTerms + o] = Integrals[o];
+        }
+
+        for (Int_t j = 0; j < Terms; j++)
+        {
+            for (Int_t k = 0; k < Terms; k++)
+            {
+                Normal[j * Terms + k] += Regressors[j] * Regressors[k];
+            }
+            Coefficients[j] += Regressors[j] * Series[i];
+        }
+    }
+
+    // Equilibrate the normal equations, the integral columns span many orders of magnitude
+    std::vector<Double_t> Scale(Terms);
+    for (Int_t j = 0; j < Terms; j++)
+    {
+        Scale[j] = Normal[j * Terms + j] > 0 ? 1.0 / std::sqrt(Normal[j * Terms + j]) : 1.0;
+    }
+    for (Int_t j = 0; j < Terms; j++)
+    {
+        for (Int_t k = 0; k < Terms; k++)
+        {
+            Normal[j * Terms + k] *= Scale[j] * Scale[k];
+        }
+        Coefficients[j] *= Scale[j];
+    }
+
+    if (!SolveLinearSystem(Normal, Coefficients))
+    {
+        return {};
+    }
+
+    // y = poly(t) - sum_o P[Order - o] S_o, where D^Order + P[Order-1] D^(Order-1) + ... + P[0]
+    // annihilates the exponentials. With D = -k the rates are the roots of sum_j P[j] (-k)^j
+    std::vector<Double_t> Characteristic(Order + 1);
+    for (Int_t o = 1; o <= Order; o++)
+    {
+        const Double_t P = -Coefficients[PolynomialTerms + o - 1] * Scale[PolynomialTerms + o - 1];
+        Characteristic[Order - o] = (Order - o) % 2 == 0 ? P : -P;
+    }
+    Characteristic[Order] = Order % 2 == 0 ? 1.0 : -1.0;
+
+    const auto Evaluate = [&](const Double_t K)
+    {
+        Double_t Value = 0;
+        for (Int_t j = Order; j >= 0; j--)
+        {
+            Value = Value * K + Characteristic[j];
+        }
+        return Value;
+    };
+
+    // Bracket roots on a logarithmic grid of normalized rates, time constants 0.3 ns to 10^4 windows
+    constexpr Int_t GridPoints = 400;
+    const Double_t LogMin = std::log(1e-4);
+    const Double_t LogMax = std::log(3.0 * Length);
+
+    std::vector<Double_t> Rates;
+    Double_t Left = std::exp(LogMin);
+    Double_t LeftValue = Evaluate(Left);
+    for (Int_t g = 1; g <= GridPoints; g++)
+    {
+        const Double_t Right = std::exp(LogMin + (LogMax - LogMin) * g / GridPoints);
+        const Double_t RightValue = Evaluate(Right);
+
+        if (LeftValue * RightValue < 0)
+        {
+            Double_t Low = Left;
+            Double_t High = Right;
+            Double_t LowValue = LeftValue;
+            for (Int_t Iteration = 0; Iteration < 50; Iteration++)
+            {
+                const Double_t Middle = 0.5 * (Low + High);
+                const Double_t MiddleValue = Evaluate(Middle);
+                if (LowValue * MiddleValue <= 0)
+                {
+                    High = Middle;
+                }
+                else
+                {
+                    Low = Middle;
+                    LowValue = MiddleValue;
+                }
+            }
+            Rates.push_back(0.5 * (Low + High) / Length);
+        }
+
+        Left = Right;
+        LeftValue = RightValue;
+    }
+
+    return Rates;
+}
+
+/**
+ * Non-iterative estimate of the dynode decay constants and weights.
+ *
+ * After the rise, DynodePeakFunction is a constant (-UndershootAmp) plus three exponentials:
+ * fast and slow decay and the undershoot recovery. The decay constants come from Prony's method
+ * in integral form (EstimateDecayRates), the weights from a linear least-squares fit on the same
+ * samples. Positive components are assigned by time constant: the longest one is the recovery if
+ * the constant shows an undershoot, the two shortest are the fast and slow decay.
+ * Cost is one pass for the regression, one for the weights and a small root search.
+ *
+ * @param Samples Trace samples, one per ns
+ * @param SampleCount Number of samples
+ * @param PeakIndex Index of the trace maximum, used as the time origin t0
+ * @param Baseline Baseline estimate
+ * @return Estimate, or nullopt if no decaying component could be identified
+ */
+std::optional<DynodeDecayEstimate> EstimateDynodeDecays(const Double_t *Samples, const Int_t SampleCount,
+                                                        const Int_t PeakIndex, const Double_t Baseline)
+{
+    constexpr Int_t RiseSkip = 15; // Past the rise, 5 rise time constants
+    constexpr Int_t MinSamples = 50;
+    constexpr Int_t Components = 3;
+    constexpr Double_t MinRecoveryTime = 100.0;
+
+    const Int_t Start = PeakIndex + RiseSkip;
+    if (!Samples || PeakIndex < 0 || SampleCount - Start < MinSamples)
+    {
+        return std::nullopt;
+    }
+
+    std::vector<Double_t> Series(Samples + Start, Samples + SampleCount);
+    for (auto &Value: Series)
+    {
+        Value -= Baseline;
+    }
+
+    std::vector<Double_t> DecayConstants;
+    for (const Double_t Rate: EstimateDecayRates(Series, Components))
+    {
+        DecayConstants.push_back(1.0 / Rate);
+    }
+    if (DecayConstants.empty())
+    {
+        return std::nullopt;
+    }
+
+    const std::vector<Double_t> Weights = FitExponentialWeights(Series, RiseSkip, DecayConstants);
+    if (Weights.empty())
+    {
+        return std::nullopt;
+    }
+
+    std::vector<std::pair<Double_t, Double_t> > PositiveComponents;
+    for (size_t i = 0; i < DecayConstants.size(); i++)
+    {
+        if (Weights[i + 1] > 0)
+        {
+            PositiveComponents.emplace_back(DecayConstants[i], Weights[i + 1]);
+        }
+    }
+    std::sort(PositiveComponents.begin(), PositiveComponents.end());
+
+    DynodeDecayEstimate Estimate;
+    Estimate.UndershootAmp = TMath::Max(0.0, -Weights[0]);
+
+    if (Estimate.UndershootAmp > 0 && PositiveComponents.size() >= 2 &&
+        PositiveComponents.back().first >= MinRecoveryTime)
+    {
+        Estimate.UndershootRecovery = PositiveComponents.back().first;
+        PositiveComponents.pop_back();
+    }
+
+    if (PositiveComponents.empty())
+    {
+        return std::nullopt;
+    }
+
+    const auto &[FastTau, FastWeight] = PositiveComponents.front();
+    const auto &[SlowTau, SlowWeight] = PositiveComponents.size() >= 2
+                                            ? PositiveComponents[1]
+                                            : PositiveComponents.front();
+
+    Estimate.FastDecay = FastTau;
+    Estimate.SlowDecay = SlowTau;
+    Estimate.Amplitude = PositiveComponents.size() >= 2 ? FastWeight + SlowWeight : FastWeight;
+    Estimate.FastFraction = FastWeight / Estimate.Amplitude;
+
+    return Estimate;
+}
@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <Math/MinimizerOptions.h>
+#include <TF1.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#include "main.h"
+
+/**
+ * Waits between attempts on a full or empty queue: spins first, then yields, then sleeps,
+ * so a stalled stage neither burns a core nor adds latency to a briefly blocked one
+ * @param Attempt Failed attempts so far
+ */
+void QueueBackoff(const Int_t Attempt)
+{
+    if (Attempt < 64)
+    {
+        return;
+    }
+    if (Attempt < 256)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+/**
+ * Bounded multi-producer multi-consumer queue without locks. Every cell carries a sequence number
+ * telling producers and consumers whether it is free or filled for their lap around the ring, so
+ * a push or pop is one compare-exchange on the shared index
+ */
+template<typename T>
+class BoundedQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> Sequence{0};
+        T Value;
+    };
+
+    std::unique_ptr<Cell[]> Cells;
+    size_t Mask = 0;
+    alignas(64) std::atomic<size_t> Head{0}; // Next cell to push
+    alignas(64) std::atomic<size_t> Tail{0}; // Next cell to pop
+    alignas(64) std::atomic<Bool_t> Closed{false};
+
+public:
+    explicit BoundedQueue(const size_t Capacity)
+    {
+        size_t Size = 2;
+        while (Size < Capacity)
+        {
+            Size <<= 1;
+        }
+        Cells = std::make_unique<Cell[]>(Size);
+        Mask = Size - 1;
+        for (size_t i = 0; i < Size; i++)
+        {
+            Cells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    Bool_t TryPush(T &Value)
+    {
+        size_t Position = Head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &Slot = Cells[Position & Mask];
+            const size_t Sequence = Slot.Sequence.load(std::memory_order_acquire);
+            const auto Difference = static_cast<std::ptrdiff_t>(Sequence - Position);
+            if (Difference == 0)
+            {
+                if (Head.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed))
+                {
+                    Slot.Value = std::move(Value);
+                    Slot.Sequence.store(Position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (Difference < 0)
+            {
+                return false; // Full, the cell still holds the previous lap
+            }
+            else
+            {
+                Position = Head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Bool_t TryPop(T &Value)
+    {
+        size_t Position = Tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &Slot = Cells[Position & Mask];
+            const size_t Sequence = Slot.Sequence.load(std::memory_order_acquire);
+            const auto Difference = static_cast<std::ptrdiff_t>(Sequence - (Position + 1));
+            if (Difference == 0)
+            {
+                if (Tail.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed))
+                {
+                    Value = std::move(Slot.Value);
+                    Slot.Sequence.store(Position + Mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (Difference < 0)
+            {
+                return false; // Empty, the cell was not filled for this lap yet
+            }
+            else
+            {
+                Position = Tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Waits while full, the backpressure that holds a stage to the pace of the next one
+    void Push(T Value)
+    {
+        for (Int_t Attempt = 0; !TryPush(Value); Attempt++)
+        {
+            QueueBackoff(Attempt);
+        }
+    }
+
+    // Waits while empty, false once the queue is closed and drained
+    Bool_t Pop(T &Value)
+    {
+        for (Int_t Attempt = 0;; Attempt++)
+        {
+            if (TryPop(Value))
+            {
+                return true;
+            }
+            if (Closed.load(std::memory_order_acquire))
+            {
+                // Pushes made before Close are visible now
+                return TryPop(Value);
+            }
+            QueueBackoff(Attempt);
+        }
+    }
+
+    // Called by the last producer once it has pushed everything
+    void Close()
+    {
+        Closed.store(true, std::memory_order_release);
+    }
+};
+
+// One event on its way through the pipeline, recycled through the free list once written
+struct PipelineEvent
+{
+    size_t Sequence = 0; // Index in QualifyingEvents, the output order
+    Long64_t Entry = -1;
+    DecodedEvent Event;
+    Bool_t Ready = false; // Decoded and prepared, to be fitted
+    EventReport Report;
+    std::optional<AnalysisResults> Results;
+};
+
+using PipelineSlot = std::unique_ptr<PipelineEvent>;
+
+/**
+ * Reader, decoder, fit workers and writer of one subrun, connected by bounded queues:
+ * - reader: the only thread touching the tree, reads and decompresses each entry into a DecodedEvent
+ * - decoder: position check, seed statistics and trace screening in entry order, the screening
+ *   keeps per-run baselines
+ * - fit workers: FitDecodedEvent or EstimateDecodedEvent, in any order
+ * - writer, the calling thread: restores entry order, records the event status and fills the results tree
+ * Events come from a free list of MaxInFlight slots, so the decoded traces held at once are bounded
+ * however far the reader runs ahead
+ */
+class EventPipeline
+{
+private:
+    TTree *Tree;
+    const std::vector<Long64_t> &Entries;
+    AnalysisMode Mode;
+    EventPipelineConfig Config;
+
+    BoundedQueue<PipelineSlot> FreeEvents;
+    BoundedQueue<PipelineSlot> ReadEvents;
+    BoundedQueue<PipelineSlot> PreparedEvents;
+    BoundedQueue<PipelineSlot> FittedEvents;
+    std::atomic<Int_t> RunningWorkers{0};
+
+    static void Fail(PipelineEvent &Slot, const std::exception &Error)
+    {
+        Slot.Ready = false;
+        Slot.Report.Status = EventStatus::Exception;
+        Slot.Report.Detail = Error.what();
+    }
+
+    void Read()
+    {
+        for (size_t i = 0; i < Entries.size(); i++)
+        {
+            PipelineSlot Slot;
+            FreeEvents.Pop(Slot);
+            Slot->Sequence = i;
+            Slot->Entry = Entries[i];
+            Slot->Event.EventNumber = Slot->Entry;
+            Slot->Report = EventReport();
+            Slot->Results.reset();
+            try
+            {
+                Slot->Ready = DecodeEvent(Tree, Slot->Entry, Slot->Event, &Slot->Report);
+            }
+            catch (const std::exception &Error)
+            {
+                Fail(*Slot, Error);
+            }
+            ReadEvents.Push(std::move(Slot));
+        }
+        ReadEvents.Close();
+
+        // The readers of this thread must not outlive the tree, which the caller deletes
+        ReleaseTreeReaders();
+    }
+
+    void Prepare()
+    {
+        PipelineSlot Slot;
+        while (ReadEvents.Pop(Slot))
+        {
+            try
+            {
+                if (Slot->Ready && Mode == AnalysisMode::Fit)
+                {
+                    Slot->Ready = PrepareEventFits(Slot->Event, &Slot->Report);
+                }
+            }
+            catch (const std::exception &Error)
+            {
+                Fail(*Slot, Error);
+            }
+            PreparedEvents.Push(std::move(Slot));
+        }
+        PreparedEvents.Close();
+    }
+
+    void Fit()
+    {
+        PipelineSlot Slot;
+        while (PreparedEvents.Pop(Slot))
+        {
+            try
+            {
+                if (Slot->Ready)
+                {
+                    Slot->Results = Mode == AnalysisMode::Fit
+                                        ? FitDecodedEvent(Slot->Event, &Slot->Report)
+                                        : EstimateDecodedEvent(Slot->Event, Mode == AnalysisMode::Template,
+                                                               &Slot->Report);
+                }
+            }
+            catch (const std::exception &Error)
+            {
+                Fail(*Slot, Error);
+            }
+            FittedEvents.Push(std::move(Slot));
+        }
+
+        // The last worker out closes the writer's queue
+        if (RunningWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            FittedEvents.Close();
+        }
+    }
+
+public:
+    EventPipeline(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents, const AnalysisMode AnalysisKind,
+                  const EventPipelineConfig &PipelineConfig)
+        : Tree(TreeInput),
+          Entries(QualifyingEvents),
+          Mode(AnalysisKind),
+          Config(PipelineConfig),
+          FreeEvents(std::max(PipelineConfig.MaxInFlight, 1)),
+          ReadEvents(std::max(PipelineConfig.QueueCapacity, 1)),
+          PreparedEvents(std::max(PipelineConfig.QueueCapacity, 1)),
+          FittedEvents(std::max(PipelineConfig.QueueCapacity, 1))
+    {
+        Config.MaxInFlight = std::max(Config.MaxInFlight, 1);
+        for (Int_t i = 0; i < Config.MaxInFlight; i++)
+        {
+            FreeEvents.Push(std::make_unique<PipelineEvent>());
+        }
+    }
+
+    std::vector<AnalysisResults> Run(AnalysisResultsFile *Output)
+    {
+        std::vector<AnalysisResults> Results;
+        Results.reserve(Entries.size());
+
+        RunningWorkers = Config.FitWorkers;
+        std::vector<std::thread> Threads;
+        Threads.emplace_back(&EventPipeline::Read, this);
+        Threads.emplace_back(&EventPipeline::Prepare, this);
+        for (Int_t i = 0; i < Config.FitWorkers; i++)
+        {
+            Threads.emplace_back(&EventPipeline::Fit, this);
+        }
+
+        // Write on this thread, holding back events that overtook an earlier one
+        std::map<size_t, PipelineSlot> Pending;
+        size_t NextSequence = 0;
+        PipelineSlot Slot;
+        while (FittedEvents.Pop(Slot))
+        {
+            const size_t Sequence = Slot->Sequence;
+            Pending.emplace(Sequence, std::move(Slot));
+
+            for (auto PendingIter = Pending.find(NextSequence); PendingIter != Pending.end();
+                 PendingIter = Pending.find(NextSequence))
+            {
+                PipelineSlot Done = std::move(PendingIter->second);
+                Pending.erase(PendingIter);
+                NextSequence++;
+
+                if (NextSequence % 1000 == 0)
+                {
+                    std::cout << "Processing event " << NextSequence << " of "
+                            << Entries.size() << "..." << std::endl;
+                }
+
+                RecordEventStatus(Done->Event.EventNumber, Done->Report);
+                if (Done->Results)
+                {
+                    if (Output)
+                    {
+                        FillAnalysisResults(*Output, *Done->Results);
+                    }
+                    Results.push_back(std::move(*Done->Results));
+                }
+                FreeEvents.Push(std::move(Done));
+            }
+        }
+
+        for (auto &Thread: Threads)
+        {
+            Thread.join();
+        }
+        return Results;
+    }
+};
+
+/**
+ * Makes the fit path safe for concurrent workers, once per process
+ */
+void PrepareConcurrentFits()
+{
+    static Bool_t Prepared = false;
+    if (Prepared)
+    {
+        return;
+    }
+    Prepared = true;
+
+    ROOT::EnableThreadSafety();
+
+    // TMinuit keeps global state, each Minuit2 minimizer is independent
+    const std::string Minimizer = ROOT::Math::MinimizerOptions::DefaultMinimizerType();
+    if (Minimizer == "Minuit" || Minimizer == "TMinuit")
+    {
+        std::cout << "Switching the default minimizer from " << Minimizer
+                << " to Minuit2 for concurrent fits" << std::endl;
+        ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2");
+    }
+
+    // The fit functions are private to their fit, keep the workers off the locked global list
+    TF1::DefaultAddToGlobalList(false);
+}
+
+/**
+ * Fits or estimates the qualifying events of a subrun, with the results in entry order either way.
+ * With fit workers the tree is read on one thread, screened in order on a second and the events are
+ * fitted on the workers while this thread writes; without, every event is processed here in turn
+ * @param TreeInput Input tree, read by one thread only
+ * @param QualifyingEvents Entries to process, in output order
+ * @param Mode Fits or one of the estimators
+ * @param Config Worker count, queue capacity and in-flight bound
+ * @param Output Optional results file filled as events complete, see OpenAnalysisResults
+ * @return Results of the events that produced parameters, in entry order
+ */
+std::vector<AnalysisResults> RunEventPipeline(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents,
+                                              const AnalysisMode Mode, const EventPipelineConfig &Config,
+                                              AnalysisResultsFile *Output)
+{
+    if (Config.FitWorkers > 0)
+    {
+        PrepareConcurrentFits();
+        EventPipeline Pipeline(TreeInput, QualifyingEvents, Mode, Config);
+        return Pipeline.Run(Output);
+    }
+
+    std::vector<AnalysisResults> Results;
+    Results.reserve(QualifyingEvents.size());
+
+    int EventCounter = 0;
+    for (const Long64_t EventNumber: QualifyingEvents)
+    {
+        EventCounter++;
+
+        if (EventCounter % 1000 == 0)
+        {
+            std::cout << "Processing event " << EventCounter << " of "
+                    << QualifyingEvents.size() << "..." << std::endl;
+        }
+
+        // Failures come back as a status, the catch only guards against ROOT or allocation errors
+        EventReport Report;
+        std::optional<AnalysisResults> EventResults;
+        try
+        {
+            EventResults = Mode == AnalysisMode::Fit
+                               ? GetEventFitParameters(TreeInput, EventNumber, &Report)
+                               : GetEventEstimatedParameters(TreeInput, EventNumber,
+                                                             Mode == AnalysisMode::Template, &Report);
+        }
+        catch (const std::exception &Error)
+        {
+            Report.Status = EventStatus::Exception;
+            Report.Detail = Error.what();
+        }
+        RecordEventStatus(EventResults ? EventResults->EventNumber : GetSourceEntry(TreeInput, EventNumber),
+                          Report);
+
+        if (EventResults)
+        {
+            if (Output)
+            {
+                FillAnalysisResults(*Output, *EventResults);
+            }
+            Results.push_back(std::move(*EventResults));
+        }
+    }
+    return Results;
+}
@@ -0,0 +1,132 @@
+#include <array>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include "main.h"
+
+constexpr const char *EventStatusNames[EventStatusCount] = {
+    "accepted", "not_selected", "invalid_input", "trace_rejected", "position_out_of_range", "fit_failed", "exception"
+};
+
+/**
+ * Per-subrun event status counters and the quarantined events of the subrun.
+ * Events that fail selection are only counted, everything else that produced no
+ * results is kept with its reason for the rejects tree
+ */
+class EventQuarantineManager
+{
+private:
+    struct QuarantinedEvent
+    {
+        Long64_t EntryNumber = -1;
+        Int_t Status = 0;
+        std::string Channel;
+        std::string Detail;
+    };
+
+    // Upper bound on the quarantined events of one subrun, the counters keep counting past it
+    static constexpr size_t MaxQuarantinedEvents = 100000;
+
+    std::array<Long64_t, EventStatusCount> Counts{};
+    std::vector<QuarantinedEvent> Quarantined;
+
+public:
+    void BeginSubRun()
+    {
+        Counts.fill(0);
+        Quarantined.clear();
+    }
+
+    void Record(const Long64_t Entry, const EventReport &Report)
+    {
+        Counts[static_cast<Int_t>(Report.Status)]++;
+
+        if (Report.Status == EventStatus::Accepted || Report.Status == EventStatus::NotSelected ||
+            Quarantined.size() >= MaxQuarantinedEvents)
+        {
+            return;
+        }
+
+        QuarantinedEvent Event;
+        Event.EntryNumber = Entry;
+        Event.Status = static_cast<Int_t>(Report.Status);
+        Event.Channel = Report.Channel;
+        Event.Detail = Report.Detail;
+        Quarantined.push_back(std::move(Event));
+    }
+
+    void PrintSummary(const Int_t RunNumber, const Int_t SubRunNumber) const
+    {
+        std::cout << "[EventStatus] Run " << std::setfill('0') << std::setw(3) << RunNumber
+                << "_" << std::setfill('0') << std::setw(2) << SubRunNumber << ":";
+        for (Int_t Status = 0; Status < EventStatusCount; Status++)
+        {
+            std::cout << " " << EventStatusNames[Status] << "=" << Counts[Status];
+        }
+        std::cout << std::endl;
+    }
+
+    void Write(TFile &OutputFile) const
+    {
+        OutputFile.cd();
+
+        TTree RejectTree("rejects", "Events Without Results");
+        QuarantinedEvent Current;
+        RejectTree.Branch("event_number", &Current.EntryNumber);
+        RejectTree.Branch("status", &Current.Status);
+        RejectTree.Branch("channel", &Current.Channel);
+        RejectTree.Branch("detail", &Current.Detail);
+
+        for (const auto &Event: Quarantined)
+        {
+            Current = Event;
+            RejectTree.Fill();
+        }
+
+        RejectTree.Write();
+    }
+};
+
+// Create a global instance
+EventQuarantineManager EventQuarantine;
+
+/**
+ * Starts a new subrun, clears the status counters and the quarantined events
+ */
+void BeginEventStatusSubRun()
+{
+    EventQuarantine.BeginSubRun();
+}
+
+/**
+ * Counts the status of one event and quarantines it unless it was accepted or not selected
+ * @param Entry Raw entry number of the event, its source entry when reading a skim
+ * @param Report Status of the event
+ */
+void RecordEventStatus(const Long64_t Entry, const EventReport &Report)
+{
+    EventQuarantine.Record(Entry, Report);
+}
+
+/**
+ * Prints the per-status event counts of the current subrun
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ */
+void PrintEventStatusSummary(const Int_t RunNumber, const Int_t SubRunNumber)
+{
+    EventQuarantine.PrintSummary(RunNumber, SubRunNumber);
+}
+
+/**
+ * Writes the quarantined events of the current subrun as the rejects tree
+ * @param OutputFile Open output file
+ */
+void WriteRejectTree(TFile &OutputFile)
+{
+    EventQuarantine.Write(OutputFile);
+}
@@ -1,159 +1,1042 @@
-#include <TTreeReader.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include <TFile.h>
+#include <TH1D.h>
+#include <TLeaf.h>
 
 #include "PaassRootStruct.hpp"
 
 #include "main.h"
 
+// Built-in selection, used unless LoadSelection reads a file. One cut per line:
+// <name> <variable> <operator> <values>, operators ==, !=, <, <=, >, >=, inside (closed range),
+// between (open range) and present (rootdev_vec_ only, channels that need a valid trace)
+constexpr const char *DefaultSelection = R"(
+high_gain_valid   high_gain_.valid_   ==        1
+low_gain_valid    low_gain_.valid_    ==        0
+qdc_window        high_gain_.qdc_     between   10000 50000
+pos_x_range       high_gain_.pos_x_   inside    0.1 0.4
+pos_y_range       high_gain_.pos_y_   inside    0.1 0.4
+channels          rootdev_vec_        present   xa xb ya yb dynode
+)";
+
+// Trace channels a present cut can require, as bits of the found-channel mask
+const std::map<std::string, UInt_t> SelectionChannelBits = {
+    {"xa", 1u << 0}, {"xb", 1u << 1}, {"ya", 1u << 2}, {"yb", 1u << 3}, {"dynode", 1u << 4}
+};
+
 /**
- * Scans all events in a tree and returns selected event numbers
- * @param Tree Pointer to the input tree
- * @param MaxEventsToSave Maximum number of events to save
- * @return Vector of selected event numbers
+ * Selection cuts compiled into a flat list of typed predicates.
+ * Each scalar cut reads only its own branch, once per entry, into a buffer owned here, so events
+ * rejected by the cheap cuts never touch rootdev_vec_. The first LearningEvents counted events
+ * evaluate every cut to measure its rejection rate, after which the cuts are ordered by
+ * cost over rejection rate. Present cuts always come after the scalar cuts, which the block
+ * evaluation relies on. Pass and fail counters follow the pipeline order and are reset per subrun;
+ * the learning events of the subrun are recounted in the learned order once it is known
  */
-std::vector<Long64_t> ScanEvents(TTree* Tree, const Long64_t MaxEventsToSave)
+class SelectionPipeline
 {
-    if (!Tree)
+private:
+    enum class CutOperator { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Inside, Between, Present };
+
+    enum class LeafType { Integer, UnsignedInteger, Long, Float, Double, Boolean };
+
+    struct ScalarInput
     {
-        throw std::runtime_error("Invalid tree pointer");
+        std::string Name;
+        TBranch *Branch = nullptr;
+        LeafType Type = LeafType::Double;
+        Long64_t LoadedEntry = -1;
+
+        union
+        {
+            Int_t Integer;
+            UInt_t UnsignedInteger;
+            Long64_t Long;
+            Float_t Float;
+            Double_t Double;
+            Bool_t Boolean;
+        } Buffer{};
+    };
+
+    struct SelectionCut
+    {
+        std::string Name;
+        CutOperator Operator = CutOperator::Equal;
+        Int_t Input = -1; // Index into Inputs, -1 for present cuts
+        Double_t Lower = 0;
+        Double_t Upper = 0;
+        UInt_t RequiredChannels = 0;
+        Double_t Cost = 1;
+        Long64_t LearningRejects = 0;
+        Long64_t Passed = 0;
+        Long64_t Failed = 0;
+        std::vector<UChar_t> LearningPasses; // Outcome of each learning event of the current subrun
+    };
+
+    static constexpr Long64_t LearningEvents = 2000;
+    static constexpr Double_t ScalarCutCost = 1;
+    static constexpr Double_t ChannelCutCost = 50; // Reads and walks the rootdev_vec_ flags and channels
+
+    std::vector<ScalarInput> Inputs;
+    std::vector<SelectionCut> Cuts;
+    TTree *BoundTree = nullptr;
+    UInt_t BoundTag = 0; // GetTreeTag of BoundTree, a new tree at a freed address is not taken for it
+    Long64_t LearnedEvents = 0;
+    Long64_t CountedEvents = 0;
+    Long64_t ZoneSkippedEvents = 0; // Counted events in clusters the zone maps ruled out
+    Bool_t ZoneMapsApplied = false; // The zone maps were consulted this subrun, adds their row to the cut flow
+
+    Double_t Load(ScalarInput &Input, const Long64_t Entry)
+    {
+        if (Input.LoadedEntry != Entry)
+        {
+            Attach(Input);
+            Input.Branch->GetEntry(Entry);
+            Input.LoadedEntry = Entry;
+        }
+        return Value(Input);
     }
 
-    const Long64_t Entries = Tree->GetEntries();
-    std::vector<Long64_t> SelectedEventNumbers;
-    Long64_t SavedEvents = 0;
-    Long64_t TotalQualifyingEvents = 0;
+    // Points the branch at the input buffer, set in Bind and only set again if another reader of the tree moved it
+    static void Attach(ScalarInput &Input)
+    {
+        if (Input.Branch->GetAddress() != reinterpret_cast<char *>(&Input.Buffer))
+        {
+            Input.Branch->SetAddress(&Input.Buffer);
+        }
+    }
 
-    std::cout << "Scanning " << Entries << " events..." << std::endl;
+    static Double_t Value(const ScalarInput &Input)
+    {
+        switch (Input.Type)
+        {
+            case LeafType::Integer:
+                return Input.Buffer.Integer;
+            case LeafType::UnsignedInteger:
+                return Input.Buffer.UnsignedInteger;
+            case LeafType::Long:
+                return static_cast<Double_t>(Input.Buffer.Long);
+            case LeafType::Float:
+                return Input.Buffer.Float;
+            case LeafType::Boolean:
+                return Input.Buffer.Boolean ? 1 : 0;
+            case LeafType::Double:
+            default:
+                return Input.Buffer.Double;
+        }
+    }
 
-    for (Long64_t Event = 0; Event < Entries; Event++)
+    static UInt_t FindChannels(TTree *Tree, const Long64_t Entry)
     {
-        /*if (Event % 10000 == 0)
+        // Subtype, channel and flags only, the traces are not read
+        static thread_local std::vector<processor_struct::ROOTDEV> RootDevVector;
+        if (!ReadRootDevices(Tree, Entry, RootDevVector, false))
         {
-            std::cout << "Scanning event " << Event << "/" << Entries << "\r" << std::flush;
-        }*/
+            return 0;
+        }
 
-        if (MeetsSelectionCriteria(Tree, Event))
+        UInt_t Found = 0;
+        for (const auto &Device: RootDevVector)
         {
-            TotalQualifyingEvents++;
-            if (SavedEvents < MaxEventsToSave)
+            if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
             {
-                SelectedEventNumbers.push_back(Event);
-                SavedEvents++;
+                continue;
+            }
+
+            if (Device.subtype == "dynode_high")
+            {
+                Found |= SelectionChannelBits.at("dynode");
+            }
+            else if (const auto ChannelIter = AnodeChannelMap.find(Device.chanNum);
+                     Device.subtype == "anode_high" && ChannelIter != AnodeChannelMap.end())
+            {
+                Found |= SelectionChannelBits.at(ChannelIter->second.first);
             }
         }
+        return Found;
     }
 
-    std::cout << "\nTotal events meeting criteria: " << TotalQualifyingEvents << std::endl;
-    std::cout << "Selected " << SavedEvents << " events for processing" << std::endl;
+    Bool_t Test(const SelectionCut &Cut, TTree *Tree, const Long64_t Entry)
+    {
+        if (Cut.Operator == CutOperator::Present)
+        {
+            return (FindChannels(Tree, Entry) & Cut.RequiredChannels) == Cut.RequiredChannels;
+        }
 
-    return SelectedEventNumbers;
-}
+        const Double_t Value = Load(Inputs[Cut.Input], Entry);
+        switch (Cut.Operator)
+        {
+            case CutOperator::Equal:
+                return Value == Cut.Lower;
+            case CutOperator::NotEqual:
+                return Value != Cut.Lower;
+            case CutOperator::Less:
+                return Value < Cut.Lower;
+            case CutOperator::LessEqual:
+                return Value <= Cut.Lower;
+            case CutOperator::Greater:
+                return Value > Cut.Lower;
+            case CutOperator::GreaterEqual:
+                return Value >= Cut.Lower;
+            case CutOperator::Inside:
+                return Value >= Cut.Lower && Value <= Cut.Upper;
+            case CutOperator::Between:
+                return Value > Cut.Lower && Value < Cut.Upper;
+            default:
+                return false;
+        }
+    }
 
-Bool_t MeetsSelectionCriteria(TTree* TreeInput, const Long64_t Entry)
-{
-    if (!TreeInput)
+    // Reads entries [First, End) of one input into a column, a basket at a time and without cut dispatch
+    void LoadColumn(ScalarInput &Input, const Long64_t First, const Long64_t End, std::vector<Double_t> &Column)
     {
-        throw std::runtime_error("Invalid tree pointer");
+        Column.resize(static_cast<size_t>(End - First));
+        Attach(Input);
+        for (Long64_t Entry = First; Entry < End; Entry++)
+        {
+            Input.Branch->GetEntry(Entry);
+            Column[static_cast<size_t>(Entry - First)] = Value(Input);
+        }
+        Input.LoadedEntry = End - 1;
+    }
+
+    // Branch-free compare of a whole column into a byte mask, vectorized by the compiler
+    template <typename Predicate>
+    static void CompareColumn(const std::vector<Double_t> &Column, std::vector<UChar_t> &Pass, Predicate Compare)
+    {
+        const Double_t *Values = Column.data();
+        UChar_t *Result = Pass.data();
+        const size_t Size = Column.size();
+        for (size_t i = 0; i < Size; i++)
+        {
+            Result[i] = static_cast<UChar_t>(Compare(Values[i]));
+        }
+    }
+
+    static void TestColumn(const SelectionCut &Cut, const std::vector<Double_t> &Column, std::vector<UChar_t> &Pass)
+    {
+        const Double_t Lower = Cut.Lower;
+        const Double_t Upper = Cut.Upper;
+        switch (Cut.Operator)
+        {
+            case CutOperator::Equal:
+                CompareColumn(Column, Pass, [Lower](const Double_t Value) { return Value == Lower; });
+                break;
+            case CutOperator::NotEqual:
+                CompareColumn(Column, Pass, [Lower](const Double_t Value) { return Value != Lower; });
+                break;
+            case CutOperator::Less:
+                CompareColumn(Column, Pass, [Lower](const Double_t Value) { return Value < Lower; });
+                break;
+            case CutOperator::LessEqual:
+                CompareColumn(Column, Pass, [Lower](const Double_t Value) { return Value <= Lower; });
+                break;
+            case CutOperator::Greater:
+                CompareColumn(Column, Pass, [Lower](const Double_t Value) { return Value > Lower; });
+                break;
+            case CutOperator::GreaterEqual:
+                CompareColumn(Column, Pass, [Lower](const Double_t Value) { return Value >= Lower; });
+                break;
+            case CutOperator::Inside:
+                CompareColumn(Column, Pass, [Lower, Upper](const Double_t Value)
+                {
+                    return (Value >= Lower) & (Value <= Upper);
+                });
+                break;
+            case CutOperator::Between:
+                CompareColumn(Column, Pass, [Lower, Upper](const Double_t Value)
+                {
+                    return (Value > Lower) & (Value < Upper);
+                });
+                break;
+            default:
+                std::fill(Pass.begin(), Pass.end(), 0);
+                break;
+        }
+    }
+
+    // Folds one cut into the survivor mask, counting passes and fails among the current survivors
+    void ApplyMask(SelectionCut &Cut, const std::vector<UChar_t> &Pass, std::vector<UChar_t> &Mask,
+                   const Bool_t Count)
+    {
+        Long64_t Survivors = 0;
+        Long64_t Passed = 0;
+        const size_t Size = Mask.size();
+        for (size_t i = 0; i < Size; i++)
+        {
+            Survivors += Mask[i];
+            Mask[i] &= Pass[i];
+            Passed += Mask[i];
+        }
+        if (Count)
+        {
+            Cut.Passed += Passed;
+            Cut.Failed += Survivors - Passed;
+        }
+    }
+
+    // Moves present cuts behind the scalar cuts, keeping the order within both groups
+    static void PresentCutsLast(std::vector<SelectionCut> &CutList)
+    {
+        std::stable_partition(CutList.begin(), CutList.end(), [](const SelectionCut &Cut)
+        {
+            return Cut.Operator != CutOperator::Present;
+        });
+    }
+
+    // Every event counted so far in the subrun is a learning event, recount them in the current order
+    void RecountLearningEvents()
+    {
+        for (auto &Cut: Cuts)
+        {
+            Cut.Passed = 0;
+            Cut.Failed = 0;
+        }
+
+        const size_t Events = Cuts.empty() ? 0 : Cuts.front().LearningPasses.size();
+        for (size_t Event = 0; Event < Events; Event++)
+        {
+            for (auto &Cut: Cuts)
+            {
+                const Bool_t Passed = Cut.LearningPasses[Event];
+                (Passed ? Cut.Passed : Cut.Failed)++;
+                if (!Passed)
+                {
+                    break;
+                }
+            }
+        }
+
+        for (auto &Cut: Cuts)
+        {
+            Cut.LearningPasses.clear();
+        }
+    }
+
+    // Expected cost per rejected event, cheap and selective cuts first
+    void Reorder()
+    {
+        const auto Priority = [this](const SelectionCut &Cut)
+        {
+            const Double_t RejectionRate = static_cast<Double_t>(Cut.LearningRejects) / LearnedEvents;
+            return Cut.Cost / std::max(RejectionRate, 1e-4);
+        };
+        std::stable_sort(Cuts.begin(), Cuts.end(), [&Priority](const SelectionCut &A, const SelectionCut &B)
+        {
+            return Priority(A) < Priority(B);
+        });
+        PresentCutsLast(Cuts);
+        RecountLearningEvents();
+
+        std::cout << "[Selection] Cut order after " << LearnedEvents << " events:";
+        for (const auto &Cut: Cuts)
+        {
+            std::cout << " " << Cut.Name << " (" << std::fixed << std::setprecision(1)
+                    << 100.0 * Cut.LearningRejects / LearnedEvents << "% rejected)";
+        }
+        std::cout << std::defaultfloat << std::endl;
     }
 
-    // Setup branch variables for previous criteria
-    Int_t HighGainValid;
-    Int_t LowGainValid;
-    Double_t HighGainQdc;
-    Double_t PosX;
-    Double_t PosY;
+public:
+    SelectionPipeline()
+    {
+        std::istringstream Stream(DefaultSelection);
+        Compile(Stream, "built-in selection");
+    }
+
+    void Compile(std::istream &Stream, const std::string &Source)
+    {
+        const std::map<std::string, CutOperator> Operators = {
+            {"==", CutOperator::Equal}, {"!=", CutOperator::NotEqual},
+            {"<", CutOperator::Less}, {"<=", CutOperator::LessEqual},
+            {">", CutOperator::Greater}, {">=", CutOperator::GreaterEqual},
+            {"inside", CutOperator::Inside}, {"between", CutOperator::Between},
+            {"present", CutOperator::Present}
+        };
+
+        std::vector<ScalarInput> NewInputs;
+        std::vector<SelectionCut> NewCuts;
+
+        std::string Line;
+        Int_t LineNumber = 0;
+        while (std::getline(Stream, Line))
+        {
+            LineNumber++;
+            Line = Line.substr(0, Line.find('#'));
+
+            std::istringstream Tokens(Line);
+            std::string Name, Variable, OperatorName;
+            if (!(Tokens >> Name))
+            {
+                continue;
+            }
+
+            const auto Error = [&](const std::string &Message)
+            {
+                return std::runtime_error(Source + ":" + std::to_string(LineNumber) + ": " + Message);
+            };
+
+            const auto OperatorIter = (Tokens >> Variable >> OperatorName) ? Operators.find(OperatorName)
+                                                                           : Operators.end();
+            if (OperatorIter == Operators.end())
+            {
+                throw Error("expected <name> <variable> <operator> <values>");
+            }
+
+            SelectionCut Cut;
+            Cut.Name = Name;
+            Cut.Operator = OperatorIter->second;
+
+            if (Cut.Operator == CutOperator::Present)
+            {
+                if (Variable != "rootdev_vec_")
+                {
+                    throw Error("present only applies to rootdev_vec_");
+                }
+                std::string Channel;
+                while (Tokens >> Channel)
+                {
+                    const auto BitIter = SelectionChannelBits.find(Channel);
+                    if (BitIter == SelectionChannelBits.end())
+                    {
+                        throw Error("unknown channel " + Channel);
+                    }
+                    Cut.RequiredChannels |= BitIter->second;
+                }
+                Cut.Cost = ChannelCutCost;
+            }
+            else
+            {
+                const Bool_t Range = Cut.Operator == CutOperator::Inside || Cut.Operator == CutOperator::Between;
+                if (!(Tokens >> Cut.Lower) || (Range && !(Tokens >> Cut.Upper)))
+                {
+                    throw Error(Range ? "expected two numeric bounds" : "expected a numeric value");
+                }
+
+                const auto InputIter = std::find_if(NewInputs.begin(), NewInputs.end(),
+                                                    [&Variable](const ScalarInput &Input)
+                                                    {
+                                                        return Input.Name == Variable;
+                                                    });
+                Cut.Input = static_cast<Int_t>(InputIter - NewInputs.begin());
+                if (InputIter == NewInputs.end())
+                {
+                    ScalarInput Input;
+                    Input.Name = Variable;
+                    NewInputs.push_back(Input);
+                }
+                Cut.Cost = ScalarCutCost;
+            }
 
-    // Set branch addresses
-    TreeInput->SetBranchAddress("high_gain_.valid_", &HighGainValid);
-    TreeInput->SetBranchAddress("low_gain_.valid_", &LowGainValid);
-    TreeInput->SetBranchAddress("high_gain_.qdc_", &HighGainQdc);
-    TreeInput->SetBranchAddress("high_gain_.pos_x_", &PosX);
-    TreeInput->SetBranchAddress("high_gain_.pos_y_", &PosY);
+            if (std::string Extra; Tokens >> Extra)
+            {
+                throw Error("unexpected " + Extra);
+            }
 
-    // Get the values for this entry
-    TreeInput->GetEntry(Entry);
+            NewCuts.push_back(Cut);
+        }
+
+        PresentCutsLast(NewCuts);
+        Inputs = std::move(NewInputs);
+        Cuts = std::move(NewCuts);
+        Unbind();
+        LearnedEvents = 0;
+        CountedEvents = 0;
 
-    // Check previous conditions first
-    if (HighGainValid != 1)
+        std::cout << "[Selection] " << Cuts.size() << " cuts from " << Source << std::endl;
+    }
+
+    void Bind(TTree *Tree)
     {
-        return false;
+        const std::map<std::string, LeafType> LeafTypes = {
+            {"Int_t", LeafType::Integer}, {"UInt_t", LeafType::UnsignedInteger},
+            {"Long64_t", LeafType::Long}, {"Float_t", LeafType::Float},
+            {"Double_t", LeafType::Double}, {"Bool_t", LeafType::Boolean}
+        };
+
+        for (auto &Input: Inputs)
+        {
+            TLeaf *Leaf = Tree->GetLeaf(Input.Name.c_str());
+            const auto TypeIter = Leaf ? LeafTypes.find(Leaf->GetTypeName()) : LeafTypes.end();
+            if (!Leaf || !Leaf->GetBranch() || TypeIter == LeafTypes.end())
+            {
+                throw std::runtime_error("Selection variable " + Input.Name + " is not a scalar leaf of the tree");
+            }
+            Input.Branch = Leaf->GetBranch();
+            Input.Type = TypeIter->second;
+            Input.LoadedEntry = -1;
+            Input.Branch->SetAddress(&Input.Buffer);
+        }
+        BoundTree = Tree;
+        BoundTag = GetTreeTag(Tree);
     }
 
-    if (LowGainValid != 0)
+    // Drops the branches of the bound tree, copies must bind again before reading
+    void Unbind()
     {
-        return false;
+        for (auto &Input: Inputs)
+        {
+            Input.Branch = nullptr;
+            Input.LoadedEntry = -1;
+        }
+        BoundTree = nullptr;
+        BoundTag = 0;
     }
 
-    if (HighGainQdc <= 10000 || HighGainQdc >= 50000)
+    [[nodiscard]] Bool_t IsBound(TTree *Tree) const
     {
-        return false;
+        return Tree == BoundTree && Tree->GetUniqueID() == BoundTag;
     }
 
-    // Check position range
-    constexpr Double_t MinPos = 0.1;
-    constexpr Double_t MaxPos = 0.4;
+    Bool_t Evaluate(TTree *Tree, const Long64_t Entry, const Bool_t Count)
+    {
+        if (!IsBound(Tree))
+        {
+            Bind(Tree);
+        }
+
+        const Bool_t Learning = Count && LearnedEvents < LearningEvents;
+        Bool_t Selected = true;
+        for (auto &Cut: Cuts)
+        {
+            if (!Selected && !Learning)
+            {
+                break;
+            }
 
-    if (PosX < MinPos || PosX > MaxPos || PosY < MinPos || PosY > MaxPos)
+            const Bool_t Passed = Test(Cut, Tree, Entry);
+            if (Learning)
+            {
+                Cut.LearningRejects += Passed ? 0 : 1;
+                Cut.LearningPasses.push_back(static_cast<UChar_t>(Passed));
+            }
+            if (Count && Selected)
+            {
+                (Passed ? Cut.Passed : Cut.Failed)++;
+            }
+            Selected = Selected && Passed;
+        }
+
+        if (Count)
+        {
+            CountedEvents++;
+        }
+        if (Learning && ++LearnedEvents == LearningEvents)
+        {
+            Reorder();
+        }
+        return Selected;
+    }
+
+    /**
+     * Bulk form of Evaluate over a block of entries, ideally one TTree cluster. Each scalar input
+     * is read as a column, every scalar cut is compared over the whole column into a byte mask
+     * and rootdev_vec_ is only read for entries that survive all scalar cuts, which the present
+     * cuts being last in the pipeline order guarantees. Entries of the learning phase
+     * go through Evaluate so the cut order is learned the same way
+     */
+    void EvaluateBlock(TTree *Tree, Long64_t First, const Long64_t End, const Bool_t Count,
+                       std::vector<Long64_t> &Selected)
     {
-        return false;
+        if (!IsBound(Tree))
+        {
+            Bind(Tree);
+        }
+
+        for (; Count && LearnedEvents < LearningEvents && First < End; First++)
+        {
+            if (Evaluate(Tree, First, true))
+            {
+                Selected.push_back(First);
+            }
+        }
+        if (First >= End)
+        {
+            return;
+        }
+
+        const auto Size = static_cast<size_t>(End - First);
+        std::vector<std::vector<Double_t> > Columns(Inputs.size());
+        for (size_t i = 0; i < Inputs.size(); i++)
+        {
+            LoadColumn(Inputs[i], First, End, Columns[i]);
+        }
+
+        std::vector<UChar_t> Mask(Size, 1);
+        std::vector<UChar_t> Pass(Size);
+        std::vector<UInt_t> Channels(Size, 0);
+        Bool_t ChannelsFound = false;
+        for (auto &Cut: Cuts)
+        {
+            if (Cut.Operator == CutOperator::Present)
+            {
+                for (size_t i = 0; i < Size; i++)
+                {
+                    if (Mask[i] && !ChannelsFound)
+                    {
+                        Channels[i] = FindChannels(Tree, First + static_cast<Long64_t>(i));
+                    }
+                    Pass[i] = static_cast<UChar_t>((Channels[i] & Cut.RequiredChannels) == Cut.RequiredChannels);
+                }
+                ChannelsFound = true;
+            }
+            else
+            {
+                TestColumn(Cut, Columns[Cut.Input], Pass);
+            }
+            ApplyMask(Cut, Pass, Mask, Count);
+        }
+
+        for (size_t i = 0; i < Size; i++)
+        {
+            if (Mask[i])
+            {
+                Selected.push_back(First + static_cast<Long64_t>(i));
+            }
+        }
+        if (Count)
+        {
+            CountedEvents += static_cast<Long64_t>(Size);
+        }
+    }
+
+    // Canonical text of the cuts, independent of the learned order
+    [[nodiscard]] std::string Fingerprint() const
+    {
+        std::vector<std::string> Lines;
+        for (const auto &Cut: Cuts)
+        {
+            std::ostringstream Line;
+            Line << std::setprecision(17) << Cut.Name << " " << static_cast<Int_t>(Cut.Operator) << " ";
+            if (Cut.Operator == CutOperator::Present)
+            {
+                Line << "rootdev_vec_ " << Cut.RequiredChannels;
+            }
+            else
+            {
+                Line << Inputs[Cut.Input].Name << " " << Cut.Lower << " " << Cut.Upper;
+            }
+            Lines.push_back(Line.str());
+        }
+        std::sort(Lines.begin(), Lines.end());
+
+        std::string Text;
+        for (const auto &Line: Lines)
+        {
+            Text += Line + "\n";
+        }
+        return Text;
     }
 
-    // Set up reader for rootdev_vec_ branch
-    TTreeReader Reader;
-    Reader.SetTree(TreeInput);
-    TTreeReaderValue<std::vector<processor_struct::ROOTDEV>> RootDevVector(Reader, "rootdev_vec_");
+    [[nodiscard]] BitmapQuery ToBitmapQuery() const
+    {
+        // Binned variables of BuildSelectionBitmaps
+        const std::map<std::string, std::string> BinnedVariables = {
+            {"high_gain_.qdc_", "qdc"}, {"high_gain_.pos_x_", "pos_x"}, {"high_gain_.pos_y_", "pos_y"}
+        };
 
-    // Get entry
-    Reader.SetEntry(Entry);
+        BitmapQuery Query;
+        for (const auto &Cut: Cuts)
+        {
+            if (Cut.Operator == CutOperator::Present)
+            {
+                for (const auto &[Channel, Bit]: SelectionChannelBits)
+                {
+                    if (Cut.RequiredChannels & Bit)
+                    {
+                        Query.push_back({"channel_" + Channel});
+                    }
+                }
+                continue;
+            }
 
-    // Variables to track if we found all required channels
-    Bool_t FoundXa = false;
-    Bool_t FoundXb = false;
-    Bool_t FoundYa = false;
-    Bool_t FoundYb = false;
-    Bool_t FoundDynodeHigh = false;
+            const std::string &Variable = Inputs[Cut.Input].Name;
+            if (Cut.Operator == CutOperator::Equal && Variable == "high_gain_.valid_" && Cut.Lower == 1)
+            {
+                Query.push_back({"high_gain_valid"});
+            }
+            else if (Cut.Operator == CutOperator::Equal && Variable == "low_gain_.valid_" && Cut.Lower == 0)
+            {
+                Query.push_back({"low_gain_invalid"});
+            }
+            else if ((Cut.Operator == CutOperator::Inside || Cut.Operator == CutOperator::Between)
+                     && BinnedVariables.count(Variable))
+            {
+                Query.push_back(SelectionBitmapRange(BinnedVariables.at(Variable), Cut.Lower, Cut.Upper));
+            }
+            else
+            {
+                throw std::runtime_error("Selection cut " + Cut.Name + " has no selection bitmap, "
+                                         "disable the bitmap selection or drop the cut");
+            }
+        }
+        return Query;
+    }
 
-    // Check each device in the vector
-    for (const auto& Device : *RootDevVector)
+    [[nodiscard]] std::vector<std::string> GetScalarVariables() const
     {
-        // Check for valid timing and waveform analysis
-        if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
+        std::vector<std::string> Variables;
+        for (const auto &Input: Inputs)
         {
-            continue;
+            Variables.push_back(Input.Name);
         }
+        return Variables;
+    }
 
-        // Check for anode channels
-        if (Device.subtype == "anode_high")
+    // Whether any event with values inside the zone ranges can pass every scalar cut
+    [[nodiscard]] Bool_t MayPass(const ClusterZone &Zone) const
+    {
+        for (const auto &Cut: Cuts)
         {
-            switch (Device.chanNum)
+            if (Cut.Operator == CutOperator::Present)
+            {
+                continue;
+            }
+
+            const auto RangeIter = Zone.Ranges.find(Inputs[Cut.Input].Name);
+            if (RangeIter == Zone.Ranges.end())
+            {
+                continue;
+            }
+
+            const auto &[Min, Max] = RangeIter->second;
+            Bool_t Feasible = true;
+            switch (Cut.Operator)
             {
-                case 4:  // xa
-                    FoundXa = true;
+                case CutOperator::Equal:
+                    Feasible = Min <= Cut.Lower && Cut.Lower <= Max;
+                    break;
+                case CutOperator::NotEqual:
+                    Feasible = !(Min == Cut.Lower && Max == Cut.Lower);
+                    break;
+                case CutOperator::Less:
+                    Feasible = Min < Cut.Lower;
                     break;
-                case 7:  // xb
-                    FoundXb = true;
+                case CutOperator::LessEqual:
+                    Feasible = Min <= Cut.Lower;
                     break;
-                case 6:  // ya
-                    FoundYa = true;
+                case CutOperator::Greater:
+                    Feasible = Max > Cut.Lower;
                     break;
-                case 5:  // yb
-                    FoundYb = true;
+                case CutOperator::GreaterEqual:
+                    Feasible = Max >= Cut.Lower;
+                    break;
+                case CutOperator::Inside:
+                    Feasible = Max >= Cut.Lower && Min <= Cut.Upper;
+                    break;
+                case CutOperator::Between:
+                    Feasible = Max > Cut.Lower && Min < Cut.Upper;
                     break;
                 default:
                     break;
             }
+
+            if (!Feasible)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void BeginSubRun()
+    {
+        for (auto &Cut: Cuts)
+        {
+            Cut.Passed = 0;
+            Cut.Failed = 0;
+            Cut.LearningPasses.clear();
+        }
+        CountedEvents = 0;
+        ZoneSkippedEvents = 0;
+        ZoneMapsApplied = false;
+    }
+
+    // Counts events of a cluster the zone maps ruled out without reading it
+    void CountZoneSkipped(const Long64_t Events)
+    {
+        CountedEvents += Events;
+        ZoneSkippedEvents += Events;
+        ZoneMapsApplied = true;
+    }
+
+    void PrintCutFlow(const Int_t RunNumber, const Int_t SubRunNumber) const
+    {
+        std::cout << "[Selection] Run " << std::setfill('0') << std::setw(3) << RunNumber
+                << "_" << std::setfill('0') << std::setw(2) << SubRunNumber
+                << " cut flow over " << CountedEvents << " events:" << std::endl;
+        std::cout << std::setfill(' ');
+        if (ZoneMapsApplied)
+        {
+            std::cout << "  " << std::left << std::setw(20) << "zone_maps" << std::right
+                    << " pass " << std::setw(10) << CountedEvents - ZoneSkippedEvents
+                    << " fail " << std::setw(10) << ZoneSkippedEvents << std::endl;
+        }
+        for (const auto &Cut: Cuts)
+        {
+            std::cout << "  " << std::left << std::setw(20) << Cut.Name << std::right
+                    << " pass " << std::setw(10) << Cut.Passed
+                    << " fail " << std::setw(10) << Cut.Failed << std::endl;
+        }
+    }
+
+    void WriteCutFlow(TFile &OutputFile) const
+    {
+        OutputFile.cd();
+
+        // Scanned events, events left after the zone maps when they were applied, then the events passing each cut
+        const Int_t FirstCutBin = ZoneMapsApplied ? 3 : 2;
+        const auto Bins = static_cast<Int_t>(Cuts.size()) + FirstCutBin - 1;
+        auto *CutFlow = new TH1D("cut_flow", "Selection Cut Flow;Cut;Events", Bins, 0, Bins);
+        CutFlow->GetXaxis()->SetBinLabel(1, "scanned");
+        CutFlow->SetBinContent(1, static_cast<Double_t>(CountedEvents));
+        if (ZoneMapsApplied)
+        {
+            CutFlow->GetXaxis()->SetBinLabel(2, "zone_maps");
+            CutFlow->SetBinContent(2, static_cast<Double_t>(CountedEvents - ZoneSkippedEvents));
+        }
+        for (size_t i = 0; i < Cuts.size(); i++)
+        {
+            const auto Bin = static_cast<Int_t>(i) + FirstCutBin;
+            CutFlow->GetXaxis()->SetBinLabel(Bin, Cuts[i].Name.c_str());
+            CutFlow->SetBinContent(Bin, static_cast<Double_t>(Cuts[i].Passed));
+        }
+        CutFlow->Write();
+    }
+};
+
+// Create a global instance
+SelectionPipeline Selection;
+
+// Pipeline of a subrun prefetch thread, scanned on a copy so the cut flow of the subrun being fitted is kept
+thread_local std::shared_ptr<SelectionPipeline> ThreadSelection;
+
+/**
+ * Pipeline the selection functions use on the calling thread, Selection unless UseThreadSelection set one
+ */
+SelectionPipeline &ActiveSelection()
+{
+    return ThreadSelection ? *ThreadSelection : Selection;
+}
+
+/**
+ * Copies the selection of the calling thread, cuts, learned order and cut flow. The copy is not
+ * bound to a tree, it binds to the first tree it reads, so it may outlive the current one
+ * @return Independent pipeline for UseThreadSelection
+ */
+std::shared_ptr<SelectionPipeline> ForkSelection()
+{
+    auto Pipeline = std::make_shared<SelectionPipeline>(ActiveSelection());
+    Pipeline->Unbind();
+    return Pipeline;
+}
+
+/**
+ * Makes the selection functions of the calling thread use a forked pipeline, nullptr returns to the global one
+ * @param Pipeline Pipeline from ForkSelection
+ */
+void UseThreadSelection(std::shared_ptr<SelectionPipeline> Pipeline)
+{
+    ThreadSelection = std::move(Pipeline);
+}
+
+/**
+ * Replaces the global selection with a forked pipeline, taking over the cut flow of the subrun it scanned
+ * @param Pipeline Pipeline from ForkSelection
+ */
+void AdoptSelection(const std::shared_ptr<SelectionPipeline> &Pipeline)
+{
+    Selection = *Pipeline;
+    Selection.Unbind();
+}
+
+// Events come from an externally selected entry list, MeetsSelectionCriteria accepts every entry
+Bool_t SelectionFromEntryList = false;
+
+/**
+ * Lets an entry list, e.g. from SelectFromBitmaps, replace the per-event selection check,
+ * so cut combinations other than the compiled selection reach the fits
+ * @param Enabled Whether MeetsSelectionCriteria accepts every entry
+ */
+void SetSelectionFromEntryList(const Bool_t Enabled)
+{
+    SelectionFromEntryList = Enabled;
+}
+
+/**
+ * Replaces the selection with the cuts of a selection file, see DefaultSelection for the syntax.
+ * Keeps the built-in selection if the file does not exist
+ * @param FileName Selection file
+ * @throws std::runtime_error on a malformed line
+ */
+void LoadSelection(const char *FileName)
+{
+    std::ifstream SelectionFile(FileName);
+    if (!SelectionFile)
+    {
+        std::cout << "[Selection] " << FileName << " not found, keeping the built-in selection" << std::endl;
+        return;
+    }
+    Selection.Compile(SelectionFile, FileName);
+}
+
+/**
+ * Starts a new subrun, resets the cut flow counters
+ */
+void BeginSelectionSubRun()
+{
+    ActiveSelection().BeginSubRun();
+}
+
+/**
+ * Prints the per-cut pass and fail counts of the events scanned in the current subrun
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ */
+void PrintSelectionCutFlow(const Int_t RunNumber, const Int_t SubRunNumber)
+{
+    ActiveSelection().PrintCutFlow(RunNumber, SubRunNumber);
+}
+
+/**
+ * Writes the cut flow of the current subrun as the cut_flow histogram
+ * @param OutputFile Open output file
+ */
+void WriteSelectionCutFlow(TFile &OutputFile)
+{
+    ActiveSelection().WriteCutFlow(OutputFile);
+}
+
+
+/**
+ * Entry ranges of the TTree clusters, the blocks in which baskets of all branches start and end
+ * @param Tree Pointer to the input tree
+ * @return First and one-past-last entry of each cluster
+ */
+std::vector<std::pair<Long64_t, Long64_t> > GetClusterRanges(TTree* Tree)
+{
+    const Long64_t Entries = Tree->GetEntries();
+    std::vector<std::pair<Long64_t, Long64_t> > Ranges;
+    auto ClusterIter = Tree->GetClusterIterator(0);
+    for (Long64_t Start = ClusterIter.Next(); Start < Entries; Start = ClusterIter.Next())
+    {
+        Ranges.emplace_back(Start, std::min(ClusterIter.GetNextEntry(), Entries));
+    }
+    return Ranges;
+}
+
+/**
+ * Scans all events in a tree and returns selected event numbers
+ * @param Tree Pointer to the input tree
+ * @param MaxEventsToSave Maximum number of events to save
+ * @return Vector of selected event numbers
+ */
+std::vector<Long64_t> ScanEvents(TTree* Tree, const Long64_t MaxEventsToSave)
+{
+    if (!Tree)
+    {
+        throw std::runtime_error("Invalid tree pointer");
+    }
+
+    const Long64_t Entries = Tree->GetEntries();
+    std::vector<Long64_t> SelectedEventNumbers;
+    Long64_t SavedEvents = 0;
+    Long64_t TotalQualifyingEvents = 0;
+
+    std::cout << "Scanning " << Entries << " events..." << std::endl;
+
+    std::vector<Long64_t> ClusterEvents;
+    for (const auto& [First, End] : GetClusterRanges(Tree))
+    {
+        ClusterEvents.clear();
+        if (SelectionFromEntryList || IsSkimTree(Tree))
+        {
+            for (Long64_t Event = First; Event < End; Event++)
+            {
+                ClusterEvents.push_back(Event);
+            }
         }
-        // Check for dynode
-        else if (Device.subtype == "dynode_high")
+        else
         {
-            FoundDynodeHigh = true;
+            ActiveSelection().EvaluateBlock(Tree, First, End, false, ClusterEvents);
+        }
+
+        for (const Long64_t Event : ClusterEvents)
+        {
+            TotalQualifyingEvents++;
+            if (SavedEvents < MaxEventsToSave)
+            {
+                SelectedEventNumbers.push_back(Event);
+                SavedEvents++;
+            }
         }
     }
 
-    // Event is selected only if all required channels are present
-    return FoundXa && FoundXb && FoundYa && FoundYb && FoundDynodeHigh;
+    std::cout << "\nTotal events meeting criteria: " << TotalQualifyingEvents << std::endl;
+    std::cout << "Selected " << SavedEvents << " events for processing" << std::endl;
+
+    return SelectedEventNumbers;
 }
 
-std::vector<Long64_t> GetAllQualifyingEvents(TTree* TreeInput)
+/**
+ * Query on the selection bitmaps equivalent to the compiled selection, up to the half-open bin
+ * windows of the range cuts. Cuts without a bitmap, e.g. any variable other than the valid flags,
+ * qdc and position, make it throw rather than select a different set of events
+ * @return Query for SelectFromBitmaps
+ * @throws std::runtime_error if a cut cannot be expressed as bitmaps
+ */
+BitmapQuery SelectionBitmapQuery()
+{
+    return ActiveSelection().ToBitmapQuery();
+}
+
+/**
+ * Canonical text of the compiled cuts, one line per cut sorted by name, so files derived from
+ * a selection, e.g. skims, can tell whether they were written with the current one
+ */
+std::string GetSelectionFingerprint()
+{
+    return ActiveSelection().Fingerprint();
+}
+
+/**
+ * Scalar branches read by the compiled selection, the variables BuildZoneMaps should index
+ */
+std::vector<std::string> GetSelectionVariables()
+{
+    return ActiveSelection().GetScalarVariables();
+}
+
+/**
+ * Checks an event against the compiled selection, without touching the cut flow counters.
+ * Always true while SetSelectionFromEntryList is enabled and for skims, which only hold selected events
+ * @param TreeInput Pointer to the input tree
+ * @param Entry Entry number
+ * @return Whether the event passes every cut
+ */
+Bool_t MeetsSelectionCriteria(TTree* TreeInput, const Long64_t Entry)
+{
+    if (!TreeInput)
+    {
+        throw std::runtime_error("Invalid tree pointer");
+    }
+
+    return SelectionFromEntryList || IsSkimTree(TreeInput) || ActiveSelection().Evaluate(TreeInput, Entry, false);
+}
+
+/**
+ * Scans a tree with the compiled selection and counts the cut flow
+ * @param TreeInput Pointer to the input tree
+ * @param Zones Optional zone maps of the tree, clusters whose ranges fail a scalar cut are not read
+ * @return Qualifying entry numbers
+ */
+std::vector<Long64_t> GetAllQualifyingEvents(TTree* TreeInput, const std::vector<ClusterZone>* Zones)
 {
     if (!TreeInput)
     {
@@ -165,26 +1048,55 @@ std::vector<Long64_t> GetAllQualifyingEvents(TTree* TreeInput)
 
     std::cout << "Scanning " << Entries << " events for qualification..." << std::endl;
 
-    int EventCounter = 1;
-
-    for (Long64_t Event = 0; Event < Entries; Event++)
+    // Every entry of a skim passed the selection, OpenSkimFile rewrites skims of another selection
+    if (IsSkimTree(TreeInput))
     {
-
-
-        /*if (EventCounter % 10000 == 0)
+        for (Long64_t Event = 0; Event < Entries; Event++)
         {
-            std::cout << "Processing event " << Event << "/" << Entries << "\r" << std::flush;
-        }*/
+            QualifyingEvents.push_back(Event);
+        }
+        std::cout << "Skim tree, all " << Entries << " events qualify" << std::endl;
+        return QualifyingEvents;
+    }
+
+    // A new file may reuse the address of the previous tree, always rebind its branches
+    ActiveSelection().Bind(TreeInput);
 
-        if (MeetsSelectionCriteria(TreeInput, Event))
+    // One block per cluster, without zone maps every cluster is scanned
+    std::vector<std::pair<Long64_t, Long64_t> > Ranges;
+    Long64_t SkippedClusters = 0;
+    Long64_t SkippedEvents = 0;
+    if (Zones)
+    {
+        for (const auto& Zone : *Zones)
         {
-            QualifyingEvents.push_back(Event);
+            if (ActiveSelection().MayPass(Zone))
+            {
+                Ranges.emplace_back(Zone.FirstEntry, std::min(Zone.EndEntry, Entries));
+            }
+            else
+            {
+                SkippedClusters++;
+                SkippedEvents += std::min(Zone.EndEntry, Entries) - Zone.FirstEntry;
+            }
         }
+    }
+    else
+    {
+        Ranges = GetClusterRanges(TreeInput);
+    }
 
-        EventCounter++;
+    for (const auto& [First, End] : Ranges)
+    {
+        ActiveSelection().EvaluateBlock(TreeInput, First, End, true, QualifyingEvents);
+    }
+    if (Zones)
+    {
+        ActiveSelection().CountZoneSkipped(SkippedEvents);
+        std::cout << "Zone maps skipped " << SkippedClusters << " of " << Zones->size() << " clusters ("
+                << SkippedEvents << " events)" << std::endl;
     }
 
     std::cout << "\nFound " << QualifyingEvents.size() << " qualifying events" << std::endl;
     return QualifyingEvents;
 }
-
@@ -7,8 +7,19 @@
 #include <TSystem.h>
 #include <TTree.h>
 
+#include <TList.h>
+#include <Fit/BinData.h>
+#include <Fit/Fitter.h>
+#include <HFitInterface.h>
+#include <Math/Minimizer.h>
+#include <Math/WrappedMultiTF1.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <map>
+#include <memory>
 
 #include "main.h"
 
@@ -31,20 +42,27 @@ const std::map<std::string, RisePowerCoefficients> ChannelRisePowerFits = {
     {"yb", {1.178, 0.1177, 7.531, 33.51, 1235.0, 0.2512}}
 };
 
-Double_t CalculateRisePower(const std::string &Channel, const Double_t Position)
+/**
+ * Expected anode rise power at an X position, without throwing
+ * @param Channel Anode name (xa, xb, ya, yb)
+ * @param Position X position, the polynomials cover 0.1 to 0.4
+ * @return Rise power, nullopt for an unknown channel or a position outside the range
+ */
+std::optional<Double_t> TryCalculateRisePower(const std::string &Channel, const Double_t Position)
 {
-    if (ChannelRisePowerFits.find(Channel) == ChannelRisePowerFits.end())
+    const auto FitIter = ChannelRisePowerFits.find(Channel);
+    if (FitIter == ChannelRisePowerFits.end())
     {
-        throw std::runtime_error("Invalid channel name");
+        return std::nullopt;
     }
 
     // Validate X position range
     if (Position < 0.1 || Position > 0.4)
     {
-        throw std::runtime_error("Invalid X position: " + std::to_string(Position));
+        return std::nullopt;
     }
 
-    const auto &[Offset, Linear, Quadratic, Cubic, Quartic, Center] = ChannelRisePowerFits.at(Channel);
+    const auto &[Offset, Linear, Quadratic, Cubic, Quartic, Center] = FitIter->second;
     const Double_t X = Position - Center;
 
     return Offset +
@@ -54,6 +72,22 @@ Double_t CalculateRisePower(const std::string &Channel, const Double_t Position)
            Quartic * std::pow(X, 4);
 }
 
+Double_t CalculateRisePower(const std::string &Channel, const Double_t Position)
+{
+    if (ChannelRisePowerFits.find(Channel) == ChannelRisePowerFits.end())
+    {
+        throw std::runtime_error("Invalid channel name");
+    }
+
+    const auto RisePower = TryCalculateRisePower(Channel, Position);
+    if (!RisePower)
+    {
+        throw std::runtime_error("Invalid X position: " + std::to_string(Position));
+    }
+
+    return *RisePower;
+}
+
 /**
  * Function defining the peak shape for fitting the anode trace
  * p[0] = amplitude
@@ -149,87 +183,330 @@ public:
 // Create a global instance
 RiseTimeMapManager RiseTimeManager;
 
-// Modify the FitPeakToTrace function
-TF1 *FitPeakToTrace(TGraph *TraceGraph, const Double_t FitRangeStart,
-                    const Double_t FitRangeEnd, const std::string &Channel = "",
-                    const Double_t PosX = -1, const Double_t PosY = -1)
+// Budget applied to every FitPeakToTrace/FitDynodePeak call
+FitBudget ActiveFitBudget;
+
+void SetFitBudget(const FitBudget &Budget)
+{
+    ActiveFitBudget = Budget;
+}
+
+const FitBudget &GetFitBudget()
+{
+    return ActiveFitBudget;
+}
+
+// Strategy used by FitDynodePeak
+DynodeFitMode ActiveDynodeFitMode = DynodeFitMode::Joint;
+
+void SetDynodeFitMode(const DynodeFitMode Mode)
 {
-    if (!TraceGraph)
+    ActiveDynodeFitMode = Mode;
+}
+
+// Whether GetEventFitParameters fits the anodes one by one or jointly
+AnodeFitMode ActiveAnodeFitMode = AnodeFitMode::Independent;
+
+// Fixed onset offset of each anode relative to the shared one in the joint fit
+std::map<std::string, Double_t> JointAnodeOffsets = {{"xa", 0.0}, {"xb", 0.0}, {"ya", 0.0}, {"yb", 0.0}};
+
+void SetAnodeFitMode(const AnodeFitMode Mode)
+{
+    ActiveAnodeFitMode = Mode;
+}
+
+AnodeFitMode GetAnodeFitMode()
+{
+    return ActiveAnodeFitMode;
+}
+
+void SetJointAnodeOffsets(const std::map<std::string, Double_t> &Offsets)
+{
+    for (const auto &[Channel, Offset]: Offsets)
     {
-        throw std::runtime_error("Invalid graph pointer");
+        JointAnodeOffsets.at(Channel) = Offset;
     }
+}
 
-    static int FitCounter = 0;
-    const TString FitName = TString::Format("PeakFit_%d", FitCounter++);
-    const auto FitFunc = new TF1(FitName, AnodePeakFunction, FitRangeStart, FitRangeEnd, 6);
+// Per-trace model selection, see SelectPulseModel
+ModelSelectionPolicy AnodeModelPolicy;
+ModelSelectionPolicy DynodeModelPolicy;
 
-    // Parameter setup code...
-    FitFunc->SetParName(0, "Amplitude");
-    FitFunc->SetParName(1, "PeakPosition");
-    FitFunc->SetParName(2, "DecayConstant");
-    FitFunc->SetParName(3, "RiseTimeConstant");
-    FitFunc->SetParName(4, "RiseTimePower");
-    FitFunc->SetParName(5, "Baseline");
+void SetModelSelectionPolicies(const ModelSelectionPolicy &AnodePolicy, const ModelSelectionPolicy &DynodePolicy)
+{
+    AnodeModelPolicy = AnodePolicy;
+    DynodeModelPolicy = DynodePolicy;
+}
+
+/**
+ * Picks the model for one trace from cheap pre-fit features. Saturated, small or noisy
+ * pulses only get the estimators, intermediate ones the reduced model
+ * @param Statistics Seed statistics of the trace
+ * @param Dynode Use the dynode policy instead of the anode one
+ * @return Model to run
+ */
+PulseModel SelectPulseModel(const TraceStatistics &Statistics, const Bool_t Dynode)
+{
+    const ModelSelectionPolicy &Policy = Dynode ? DynodeModelPolicy : AnodeModelPolicy;
+    if (!Policy.Enabled)
+    {
+        return PulseModel::Full;
+    }
+
+    const Double_t Amplitude = Statistics.MaxValue - Statistics.BaselineMean;
+    const Bool_t Noisy = Amplitude < Policy.MinSignalToNoise * Statistics.BaselineRMS;
+
+    if (Statistics.MaxValue >= Policy.SaturationLevel || Noisy || Amplitude < Policy.ReducedModelAmplitude)
+    {
+        return PulseModel::Estimator;
+    }
+    return Amplitude < Policy.FullModelAmplitude ? PulseModel::Reduced : PulseModel::Full;
+}
+
+// Seed and bound the dynode decay parameters with EstimateDynodeDecays
+Bool_t DynodeDecaySeeding = false;
 
-    // Find initial parameters
-    Double_t MaxY = -1e9;
-    Double_t MaxX = 0;
-    Double_t BaselineValue = 0;
-    Int_t BaselineSamples = 0;
+void SetDynodeDecaySeeding(const Bool_t Enabled)
+{
+    DynodeDecaySeeding = Enabled;
+}
+
+/**
+ * Wall-time state of the fit in progress. The clock is only read every
+ * CheckInterval model evaluations to keep the overhead negligible
+ */
+struct FitBudgetGuard
+{
+    static constexpr UInt_t CheckInterval = 64;
+
+    std::chrono::steady_clock::time_point Deadline;
+    UInt_t EvaluationsSinceCheck = 0;
+    Bool_t Armed = false;
+    Bool_t Exceeded = false;
+};
+
+/**
+ * Model function wrapper that enforces the wall-time budget while armed. Once the deadline passes
+ * it returns a constant, the objective turns flat and the minimizer stops at its current point
+ * through its own convergence test, without unwinding ROOT frames.
+ * It is disarmed once the fit returns, so the fitted TF1 can still be drawn
+ */
+struct BudgetedModel
+{
+    Double_t (*Model)(const Double_t *, const Double_t *);
+    std::shared_ptr<FitBudgetGuard> Guard;
 
-    constexpr Int_t BaselinePoints = 20;
-    for (Int_t i = 0; i < TMath::Min(BaselinePoints, TraceGraph->GetN()); i++)
+    Double_t operator()(const Double_t *X, const Double_t *Parameters) const
     {
-        Double_t X, Y;
-        TraceGraph->GetPoint(i, X, Y);
-        BaselineValue += Y;
-        BaselineSamples++;
+        if (Guard->Armed)
+        {
+            if (Guard->Exceeded)
+            {
+                return 0;
+            }
+            if (++Guard->EvaluationsSinceCheck >= FitBudgetGuard::CheckInterval)
+            {
+                Guard->EvaluationsSinceCheck = 0;
+                if (std::chrono::steady_clock::now() > Guard->Deadline)
+                {
+                    Guard->Exceeded = true;
+                    return 0;
+                }
+            }
+        }
+
+        return Model(X, Parameters);
     }
-    BaselineValue /= BaselineSamples;
+};
 
-    Double_t BaselineRMS = 0;
-    for (Int_t i = 0; i < BaselineSamples; i++)
+/**
+ * Fits TraceGraph with FitFunc under the active budget and collects convergence telemetry.
+ * Uses ROOT::Fit::Fitter directly, since TGraph::Fit hides the minimizer (and its iteration count)
+ * @param TraceGraph Graph to fit
+ * @param FitFunc Function built around a BudgetedModel sharing Guard, fit within its own range
+ * @param Guard Wall-time state shared with the model wrapper
+ * @param Report Optional report receiving outcome and telemetry
+ * @param PreviousStages Combined report of earlier stages of the same fit, which share its budget
+ */
+void RunBudgetedFit(TGraph *TraceGraph, TF1 *FitFunc, FitBudgetGuard &Guard, FitReport *Report,
+                    const FitReport *PreviousStages = nullptr)
+{
+    const auto Start = std::chrono::steady_clock::now();
+
+    // Earlier stages already spent part of the budget, keep at least one unit so the limit stays active
+    Long64_t MaxMicroseconds = ActiveFitBudget.MaxMicroseconds;
+    Int_t MaxFunctionCalls = ActiveFitBudget.MaxFunctionCalls;
+    if (PreviousStages)
     {
-        Double_t X, Y;
-        TraceGraph->GetPoint(i, X, Y);
-        BaselineRMS += (Y - BaselineValue) * (Y - BaselineValue);
+        if (MaxMicroseconds > 0)
+        {
+            MaxMicroseconds = std::max<Long64_t>(
+                1, MaxMicroseconds - static_cast<Long64_t>(PreviousStages->Telemetry.WallTime));
+        }
+        if (MaxFunctionCalls > 0)
+        {
+            MaxFunctionCalls = std::max(1, MaxFunctionCalls - PreviousStages->Telemetry.FunctionCalls);
+        }
     }
-    BaselineRMS = TMath::Sqrt(BaselineRMS / BaselineSamples);
 
-    Double_t RiseStartX = 0;
-    Bool_t RiseStartFound = false;
-    const Double_t RiseThreshold = BaselineValue + 10 * BaselineRMS;
+    Guard.Deadline = Start + std::chrono::microseconds(MaxMicroseconds);
+    Guard.EvaluationsSinceCheck = 0;
+    Guard.Exceeded = false;
+    Guard.Armed = MaxMicroseconds > 0;
+
+    Double_t RangeStart, RangeEnd;
+    FitFunc->GetRange(RangeStart, RangeEnd);
+
+    ROOT::Fit::DataOptions Options;
+    ROOT::Fit::DataRange Range(RangeStart, RangeEnd);
+    ROOT::Fit::BinData Data(Options, Range);
+    ROOT::Fit::FillData(Data, TraceGraph, FitFunc);
 
-    for (Int_t i = 0; i < TraceGraph->GetN(); i++)
+    ROOT::Fit::Fitter Fitter;
+    Fitter.SetFunction(ROOT::Math::WrappedMultiTF1(*FitFunc, 1), false);
+
+    // Translate TF1 limits, FixParameter stores the fixed value as equal limits
+    for (Int_t i = 0; i < FitFunc->GetNpar(); i++)
     {
-        Double_t X, Y;
-        TraceGraph->GetPoint(i, X, Y);
+        Double_t Lower, Upper;
+        FitFunc->GetParLimits(i, Lower, Upper);
 
-        if (!RiseStartFound && Y > RiseThreshold)
+        if ((Lower != 0 || Upper != 0) && Lower >= Upper)
+        {
+            Fitter.Config().ParSettings(i).Fix();
+        }
+        else if (Lower < Upper)
         {
-            RiseStartX = X;
-            RiseStartFound = true;
+            Fitter.Config().ParSettings(i).SetLimits(Lower, Upper);
         }
+    }
+
+    Fitter.Config().MinimizerOptions().SetPrintLevel(0);
+    if (MaxFunctionCalls > 0)
+    {
+        Fitter.Config().MinimizerOptions().SetMaxFunctionCalls(MaxFunctionCalls);
+    }
+
+    FitReport Result;
+    Result.InitialParameters.assign(FitFunc->GetParameters(), FitFunc->GetParameters() + FitFunc->GetNpar());
+
+    const Bool_t Success = Fitter.Fit(Data);
+    const ROOT::Fit::FitResult &FitResult = Fitter.Result();
+
+    FitFunc->SetFitResult(FitResult);
+
+    Result.Telemetry.Chi2 = FitResult.Chi2();
+    Result.Telemetry.Ndf = static_cast<Int_t>(FitResult.Ndf());
+    Result.Telemetry.MinimizerStatus = FitResult.Status();
+    Result.Telemetry.Edm = FitResult.Edm();
+    Result.Telemetry.FunctionCalls = static_cast<Int_t>(FitResult.NCalls());
+    if (Fitter.GetMinimizer())
+    {
+        Result.Telemetry.Iterations = static_cast<Int_t>(Fitter.GetMinimizer()->NIterations());
+    }
+
+    // Chi2 and status of a fit stopped by the wall-time budget describe the flattened objective,
+    // the parameters are those of the minimizer's last step
+    if (Guard.Exceeded || (MaxFunctionCalls > 0 && Result.Telemetry.FunctionCalls >= MaxFunctionCalls))
+    {
+        Result.Outcome = FitOutcome::BudgetExceeded;
+    }
+    else
+    {
+        Result.Outcome = Success && FitResult.Status() == 0 ? FitOutcome::Converged : FitOutcome::Failed;
+    }
 
-        if (Y > MaxY)
+    Guard.Armed = false;
+
+    Result.FinalParameters.assign(FitFunc->GetParameters(), FitFunc->GetParameters() + FitFunc->GetNpar());
+    Result.Telemetry.WallTime = std::chrono::duration<Double_t, std::micro>(
+        std::chrono::steady_clock::now() - Start).count();
+
+    // Staged fits report the sum of their stages and the worst outcome of any stage
+    if (PreviousStages)
+    {
+        Result.InitialParameters = PreviousStages->InitialParameters;
+        Result.Telemetry.WallTime += PreviousStages->Telemetry.WallTime;
+        Result.Telemetry.FunctionCalls += std::max(0, PreviousStages->Telemetry.FunctionCalls);
+        Result.Telemetry.Iterations += std::max(0, PreviousStages->Telemetry.Iterations);
+        if (PreviousStages->Outcome != FitOutcome::Converged && Result.Outcome == FitOutcome::Converged)
         {
-            MaxY = Y;
-            MaxX = X;
+            Result.Outcome = PreviousStages->Outcome;
         }
     }
 
-    [[maybe_unused]] Double_t DecayEndX = MaxX;
-    for (auto i = static_cast<Int_t>(MaxX); i < TraceGraph->GetN(); i++)
+    if (Report)
     {
-        Double_t X, Y;
-        TraceGraph->GetPoint(i, X, Y);
-        if (Y <= BaselineValue + (MaxY - BaselineValue) * 1 / M_E)
+        *Report = Result;
+    }
+}
+
+/**
+ * Attaches a copy of the fitted function to the graph, as TGraph::Fit does,
+ * so drawn traces still show their fit
+ * @param TraceGraph Fitted graph, takes ownership of the copy
+ * @param FitFunc Fitted function
+ */
+void AttachFitToGraph(TGraph *TraceGraph, const TF1 *FitFunc)
+{
+    auto *AttachedFunc = new TF1();
+    FitFunc->Copy(*AttachedFunc);
+    TraceGraph->GetListOfFunctions()->Add(AttachedFunc);
+}
+
+// Modify the FitPeakToTrace function
+TF1 *FitPeakToTrace(TGraph *TraceGraph, const Double_t FitRangeStart,
+                    const Double_t FitRangeEnd, const std::string &Channel = "",
+                    const Double_t PosX = -1, const Double_t PosY = -1, FitReport *Report,
+                    const TraceStatistics *Statistics, const PulseModel Model)
+{
+    // Invalid input is reported as a failed fit, nothing here throws for a bad event
+    const auto Fail = [Report]() -> TF1 *
+    {
+        if (Report)
         {
-            DecayEndX = X;
-            break;
+            *Report = FitReport();
         }
+        return nullptr;
+    };
+
+    const auto RisePowerAtPosition = TryCalculateRisePower(Channel, PosX);
+    if (!TraceGraph || TraceGraph->GetN() == 0 || !RisePowerAtPosition)
+    {
+        return Fail();
+    }
+
+    static std::atomic<Int_t> FitCounter{0};
+    const TString FitName = TString::Format("PeakFit_%d", FitCounter++);
+    const auto Guard = std::make_shared<FitBudgetGuard>();
+    const auto FitFunc = new TF1(FitName, BudgetedModel{AnodePeakFunction, Guard}, FitRangeStart, FitRangeEnd, 6);
+
+    // Parameter setup code...
+    FitFunc->SetParName(0, "Amplitude");
+    FitFunc->SetParName(1, "PeakPosition");
+    FitFunc->SetParName(2, "DecayConstant");
+    FitFunc->SetParName(3, "RiseTimeConstant");
+    FitFunc->SetParName(4, "RiseTimePower");
+    FitFunc->SetParName(5, "Baseline");
+
+    // Find initial parameters in one pass, on the raw trace if the caller already has it
+    const TraceStatistics Seeds = Statistics
+                                      ? *Statistics
+                                      : ComputeTraceStatistics(TraceGraph->GetY(), TraceGraph->GetN());
+    if (Seeds.MaxIndex < 0)
+    {
+        delete FitFunc;
+        return Fail();
     }
 
+    const Double_t *GraphX = TraceGraph->GetX();
+    const Double_t BaselineValue = Seeds.BaselineMean;
+    const Double_t BaselineRMS = Seeds.BaselineRMS;
+    const Double_t MaxY = Seeds.MaxValue;
+    const Double_t MaxX = GraphX[Seeds.MaxIndex];
+    const Double_t RiseStartX = Seeds.ThresholdCrossing >= 0 ? GraphX[Seeds.ThresholdCrossing] : 0;
+    [[maybe_unused]] const Double_t DecayEndX = Seeds.DecayCrossing >= 0 ? GraphX[Seeds.DecayCrossing] : MaxX;
+
     // const Double_t EstimatedDecayConstant = DecayEndX - MaxX;
     constexpr Double_t EstimatedDecayConstant = 28.00;
 
@@ -245,7 +522,7 @@ TF1 *FitPeakToTrace(TGraph *TraceGraph, const Double_t FitRangeStart,
     }
 
     // Calculate expected rise power from position
-    const Double_t ExpectedRisePower = CalculateRisePower(Channel, PosX);
+    const Double_t ExpectedRisePower = *RisePowerAtPosition;
     constexpr Double_t RisePowerTolerance = 0.05; // Allow some variation around the expected value
 
     // Set parameters with map-based estimates
@@ -267,8 +544,16 @@ TF1 *FitPeakToTrace(TGraph *TraceGraph, const Double_t FitRangeStart,
     FitFunc->SetParLimits(4, ExpectedRisePower - RisePowerTolerance, ExpectedRisePower + RisePowerTolerance);
     FitFunc->SetParLimits(5, BaselineValue - 5 * BaselineRMS, BaselineValue + 5 * BaselineRMS);
 
+    // Reduced model, rise shape taken from the maps
+    if (Model == PulseModel::Reduced)
+    {
+        FitFunc->FixParameter(3, EstimatedRiseTime);
+        FitFunc->FixParameter(4, ExpectedRisePower);
+    }
+
     // Perform the fit
-    TraceGraph->Fit(FitFunc, "QR");
+    RunBudgetedFit(TraceGraph, FitFunc, *Guard, Report);
+    AttachFitToGraph(TraceGraph, FitFunc);
 
     FitFunc->SetLineColor(kRed);
     FitFunc->SetLineWidth(100);
@@ -277,6 +562,130 @@ TF1 *FitPeakToTrace(TGraph *TraceGraph, const Double_t FitRangeStart,
     return FitFunc;
 }
 
+/**
+ * Four anode pulses on one axis, channel c occupying [c * JointAnodeStride, (c + 1) * JointAnodeStride).
+ * Parameter 0 is the shared onset, 1-4 the fixed channel offsets, then per channel
+ * AnodePeakFunction's Amplitude, DecayConstant, RiseTimeConstant, RisePower and Baseline
+ */
+Double_t JointAnodePeakFunction(const Double_t *X, const Double_t *Parameters)
+{
+    const auto Channel = TMath::Min(static_cast<Int_t>(X[0] / JointAnodeStride), JointAnodeChannels - 1);
+    const Double_t Time = X[0] - Channel * JointAnodeStride;
+    const Double_t *ChannelParameters = Parameters + 1 + JointAnodeChannels + 5 * Channel;
+
+    const Double_t AnodeParameters[6] = {
+        ChannelParameters[0],
+        Parameters[0] + Parameters[1 + Channel],
+        ChannelParameters[1],
+        ChannelParameters[2],
+        ChannelParameters[3],
+        ChannelParameters[4]
+    };
+    return AnodePeakFunction(&Time, AnodeParameters);
+}
+
+/**
+ * Fits the four anode traces of an event together, with one onset shared by all channels up to
+ * the fixed JointAnodeOffsets. Seeds and limits of each channel follow FitPeakToTrace
+ * @param TraceGraphs Anode traces by channel name (xa, xb, ya, yb)
+ * @param PosX X position of the event
+ * @param PosY Y position of the event
+ * @param Report Optional report receiving the outcome of the single minimization
+ * @return Fitted function, read back with ExtractJointAnodeFitParameters, nullptr for a missing or empty trace
+ * or a position without rise power
+ */
+TF1 *FitAnodesJointly(const std::map<std::string, TGraph *> &TraceGraphs, const Double_t PosX, const Double_t PosY,
+                      FitReport *Report)
+{
+    const auto Fail = [Report]() -> TF1 *
+    {
+        if (Report)
+        {
+            *Report = FitReport();
+        }
+        return nullptr;
+    };
+
+    static std::atomic<Int_t> FitCounter{0};
+    const TString FitName = TString::Format("JointAnodeFit_%d", FitCounter++);
+    const auto Guard = std::make_shared<FitBudgetGuard>();
+    constexpr Int_t ParameterCount = 1 + JointAnodeChannels + 5 * JointAnodeChannels;
+    const auto FitFunc = new TF1(FitName, BudgetedModel{JointAnodePeakFunction, Guard},
+                                 0, JointAnodeChannels * JointAnodeStride, ParameterCount);
+    FitFunc->SetParName(0, "PeakPosition");
+
+    // All channels on one axis
+    TGraph Combined;
+    Double_t OnsetSum = 0;
+
+    for (Int_t Channel = 0; Channel < JointAnodeChannels; Channel++)
+    {
+        const std::string Name = JointAnodeChannelNames[Channel];
+        const auto GraphIter = TraceGraphs.find(Name);
+        const auto RisePowerAtPosition = TryCalculateRisePower(Name, PosX);
+        if (GraphIter == TraceGraphs.end() || !GraphIter->second || !RisePowerAtPosition)
+        {
+            delete FitFunc;
+            return Fail();
+        }
+
+        TGraph *TraceGraph = GraphIter->second;
+        const TraceStatistics Seeds = ComputeTraceStatistics(TraceGraph->GetY(), TraceGraph->GetN());
+        if (Seeds.MaxIndex < 0)
+        {
+            delete FitFunc;
+            return Fail();
+        }
+
+        for (Int_t i = 0; i < TraceGraph->GetN(); i++)
+        {
+            Combined.SetPoint(Combined.GetN(), Channel * JointAnodeStride + TraceGraph->GetX()[i],
+                              TraceGraph->GetY()[i]);
+        }
+
+        const Double_t MaxX = TraceGraph->GetX()[Seeds.MaxIndex];
+        const Double_t RiseStartX = Seeds.ThresholdCrossing >= 0 ? TraceGraph->GetX()[Seeds.ThresholdCrossing] : 0;
+        const Double_t EstimatedRiseTime = PosX >= 0 && PosY >= 0
+                                               ? RiseTimeManager.GetRiseTime(Name, PosX, PosY)
+                                               : MaxX - RiseStartX;
+        const Double_t ExpectedRisePower = *RisePowerAtPosition;
+        constexpr Double_t RisePowerTolerance = 0.05;
+        constexpr Double_t EstimatedDecayConstant = 28.00;
+        const Double_t Height = Seeds.MaxValue - Seeds.BaselineMean;
+
+        OnsetSum += MaxX - JointAnodeOffsets.at(Name);
+
+        const Int_t First = 1 + JointAnodeChannels + 5 * Channel;
+        FitFunc->SetParName(First, (Name + "_Amplitude").c_str());
+        FitFunc->SetParName(First + 1, (Name + "_DecayConstant").c_str());
+        FitFunc->SetParName(First + 2, (Name + "_RiseTimeConstant").c_str());
+        FitFunc->SetParName(First + 3, (Name + "_RiseTimePower").c_str());
+        FitFunc->SetParName(First + 4, (Name + "_Baseline").c_str());
+
+        FitFunc->SetParameter(First, Height);
+        FitFunc->SetParameter(First + 2, EstimatedRiseTime);
+        FitFunc->SetParameter(First + 3, ExpectedRisePower);
+        FitFunc->SetParameter(First + 4, Seeds.BaselineMean);
+        FitFunc->FixParameter(First + 1, EstimatedDecayConstant);
+        FitFunc->FixParameter(1 + Channel, JointAnodeOffsets.at(Name));
+
+        FitFunc->SetParLimits(First, 0.5 * Height, 1.2 * Seeds.MaxValue);
+        FitFunc->SetParLimits(First + 2, 0.9 * EstimatedRiseTime, 1.1 * EstimatedRiseTime);
+        FitFunc->SetParLimits(First + 3, ExpectedRisePower - RisePowerTolerance, ExpectedRisePower + RisePowerTolerance);
+        FitFunc->SetParLimits(First + 4, Seeds.BaselineMean - 5 * Seeds.BaselineRMS,
+                              Seeds.BaselineMean + 5 * Seeds.BaselineRMS);
+    }
+
+    // Shared onset seeded at the mean peak, with the per-channel window of FitPeakToTrace
+    const Double_t OnsetSeed = OnsetSum / JointAnodeChannels;
+    FitFunc->SetParameter(0, OnsetSeed);
+    FitFunc->SetParLimits(0, OnsetSeed - 30, OnsetSeed + 30);
+
+    RunBudgetedFit(&Combined, FitFunc, *Guard, Report);
+
+    return FitFunc;
+}
+
 /**
  * Function to fit dynode PMT signals with double exponential decay and undershoot
  * Parameters:
@@ -320,19 +729,33 @@ Double_t DynodePeakFunction(const Double_t *X, const Double_t *Parameters)
  * @param TraceGraph Pointer to the graph containing the trace
  * @param FitRangeStart Start of the fit range
  * @param FitRangeEnd End of the fit range
- * @return Pointer to the fitted function
+ * @param Report Optional report receiving the fit outcome under the active budget
+ * @param Statistics Optional seed statistics of the trace, computed from the graph if null
+ * @param Model Full, or Reduced to drop the undershoot and slow component
+ * @return Pointer to the fitted function, nullptr for a missing or empty trace
  */
-TF1 *FitDynodePeak(TGraph *TraceGraph, const Double_t FitRangeStart, const Double_t FitRangeEnd)
+TF1 *FitDynodePeak(TGraph *TraceGraph, const Double_t FitRangeStart, const Double_t FitRangeEnd,
+                   FitReport *Report, const TraceStatistics *Statistics, const PulseModel Model)
 {
-    if (!TraceGraph)
+    const auto Fail = [Report]() -> TF1 *
+    {
+        if (Report)
+        {
+            *Report = FitReport();
+        }
+        return nullptr;
+    };
+
+    if (!TraceGraph || TraceGraph->GetN() == 0)
     {
-        throw std::runtime_error("Invalid graph pointer");
+        return Fail();
     }
 
     // Create the fit function
-    static Int_t FitCounter = 0;
+    static std::atomic<Int_t> FitCounter{0};
     const TString FitName = TString::Format("DynodeFit_%d", FitCounter++);
-    const auto FitFunc = new TF1(FitName, DynodePeakFunction, FitRangeStart, FitRangeEnd, 9);
+    const auto Guard = std::make_shared<FitBudgetGuard>();
+    const auto FitFunc = new TF1(FitName, BudgetedModel{DynodePeakFunction, Guard}, FitRangeStart, FitRangeEnd, 9);
 
     // Set parameter names
     FitFunc->SetParName(0, "Amplitude");
@@ -345,48 +768,21 @@ TF1 *FitDynodePeak(TGraph *TraceGraph, const Double_t FitRangeStart, const Doubl
     FitFunc->SetParName(7, "FastFraction");
     FitFunc->SetParName(8, "Baseline");
 
-    // Find initial parameter estimates
-    Double_t MaxY = -1e9;
-    Double_t MaxX = 0;
-    Double_t BaselineValue = 0;
-    Int_t BaselineSamples = 0;
-
-    // Use first ~20 points for baseline estimation
-    constexpr Int_t BaselinePoints = 20;
-    for (Int_t i = 0; i < TMath::Min(BaselinePoints, TraceGraph->GetN()); i++)
+    // Find initial parameter estimates in one pass, on the raw trace if the caller already has it
+    const TraceStatistics Seeds = Statistics
+                                      ? *Statistics
+                                      : ComputeTraceStatistics(TraceGraph->GetY(), TraceGraph->GetN());
+    if (Seeds.MaxIndex < 0)
     {
-        Double_t X, Y;
-        TraceGraph->GetPoint(i, X, Y);
-        BaselineValue += Y;
-        BaselineSamples++;
+        delete FitFunc;
+        return Fail();
     }
-    BaselineValue /= BaselineSamples;
 
-    // Find peak
-    for (Int_t i = 0; i < TraceGraph->GetN(); i++)
-    {
-        Double_t X, Y;
-        TraceGraph->GetPoint(i, X, Y);
-        if (Y > MaxY)
-        {
-            MaxY = Y;
-            MaxX = X;
-        }
-    }
-
-    // Estimate undershoot
-    Double_t MinAfterPeak = 1e9;
-    [[maybe_unused]] Double_t MinAfterPeakX = 0;
-    for (auto i = static_cast<Int_t>(MaxX + 100); i < TraceGraph->GetN(); i++)
-    {
-        Double_t X, Y;
-        TraceGraph->GetPoint(i, X, Y);
-        if (Y < MinAfterPeak)
-        {
-            MinAfterPeak = Y;
-            MinAfterPeakX = X;
-        }
-    }
+    const Double_t BaselineValue = Seeds.BaselineMean;
+    const Double_t MaxY = Seeds.MaxValue;
+    const Double_t MaxX = TraceGraph->GetX()[Seeds.MaxIndex];
+    const Int_t MaxIndex = Seeds.MaxIndex;
+    const Double_t MinAfterPeak = Seeds.PostPeakMin;
 
     // Set initial parameters
     FitFunc->SetParameter(0, MaxY - BaselineValue); // Amplitude
@@ -399,19 +795,145 @@ TF1 *FitDynodePeak(TGraph *TraceGraph, const Double_t FitRangeStart, const Doubl
     FitFunc->SetParameter(7, 2.0); // Fast fraction
     FitFunc->SetParameter(8, BaselineValue); // Baseline
 
-    // Set parameter limits
-    FitFunc->SetParLimits(0, 0.5 * (MaxY - BaselineValue), 2.5 * (MaxY - BaselineValue));
-    FitFunc->SetParLimits(1, MaxX - 50, MaxX + 50);
-    FitFunc->SetParLimits(2, 1.0, 100.0); // Fast decay
-    FitFunc->SetParLimits(3, 10.0, 200.0); // Slow decay
-    FitFunc->SetParLimits(4, 0.5, 20.0); // Rise time
-    FitFunc->SetParLimits(5, 0.0, BaselineValue - MinAfterPeak + 300);
-    FitFunc->SetParLimits(6, 50.0, 1000.0); // Undershoot recovery
-    FitFunc->SetParLimits(7, 0.0, 50.0); // Fast fraction
-    FitFunc->SetParLimits(8, BaselineValue - 100, BaselineValue + 100);
+    // Set parameter limits, kept so the staged fit can restore them after fixing parameters
+    Double_t ParameterLimits[9][2] = {
+        {0.5 * (MaxY - BaselineValue), 2.5 * (MaxY - BaselineValue)},
+        {MaxX - 50, MaxX + 50},
+        {1.0, 100.0}, // Fast decay
+        {10.0, 200.0}, // Slow decay
+        {0.5, 20.0}, // Rise time
+        {0.0, BaselineValue - MinAfterPeak + 300},
+        {50.0, 1000.0}, // Undershoot recovery
+        {0.0, 50.0}, // Fast fraction
+        {BaselineValue - 100, BaselineValue + 100}
+    };
+
+    // Data-driven decay seeds, with the limits narrowed to a factor of 2 around them
+    const auto EstimateStart = std::chrono::steady_clock::now();
+    std::optional<DynodeDecayEstimate> Estimate;
+    if (DynodeDecaySeeding || ActiveDynodeFitMode == DynodeFitMode::Estimate)
+    {
+        Estimate = EstimateDynodeDecays(TraceGraph->GetY(), TraceGraph->GetN(), MaxIndex, BaselineValue);
+    }
 
-    // Perform the fit
-    TraceGraph->Fit(FitFunc, "QR"); // Q: quiet, R: use range
+    if (Estimate)
+    {
+        const auto Seed = [&](const Int_t Index, const Double_t Value)
+        {
+            const Double_t Lower = TMath::Max(ParameterLimits[Index][0], 0.5 * Value);
+            const Double_t Upper = TMath::Min(ParameterLimits[Index][1], 2.0 * Value);
+            if (Value > 0 && Lower < Upper)
+            {
+                FitFunc->SetParameter(Index, TMath::Min(TMath::Max(Value, Lower), Upper));
+                ParameterLimits[Index][0] = Lower;
+                ParameterLimits[Index][1] = Upper;
+            }
+        };
+
+        Seed(0, Estimate->Amplitude);
+        Seed(2, Estimate->FastDecay);
+        Seed(3, Estimate->SlowDecay);
+        Seed(7, Estimate->FastFraction);
+        if (Estimate->UndershootRecovery > 0)
+        {
+            Seed(5, Estimate->UndershootAmp);
+            Seed(6, Estimate->UndershootRecovery);
+        }
+    }
+
+    for (Int_t i = 0; i < 9; i++)
+    {
+        FitFunc->SetParLimits(i, ParameterLimits[i][0], ParameterLimits[i][1]);
+    }
+
+    // Ultra-fast mode, the seeds are the result
+    if (ActiveDynodeFitMode == DynodeFitMode::Estimate)
+    {
+        if (Report)
+        {
+            Report->Outcome = Estimate ? FitOutcome::Estimated : FitOutcome::Failed;
+            Report->Telemetry = FitTelemetry();
+            Report->Telemetry.WallTime = std::chrono::duration<Double_t, std::micro>(
+                std::chrono::steady_clock::now() - EstimateStart).count();
+            Report->InitialParameters.assign(FitFunc->GetParameters(), FitFunc->GetParameters() + 9);
+            Report->FinalParameters = Report->InitialParameters;
+        }
+        AttachFitToGraph(TraceGraph, FitFunc);
+        return FitFunc;
+    }
+
+    // Reduced model: single decay without undershoot, fitted jointly since there is nothing to stage
+    const Bool_t Reduced = Model == PulseModel::Reduced;
+    if (Reduced)
+    {
+        FitFunc->FixParameter(3, FitFunc->GetParameter(3));
+        FitFunc->FixParameter(5, 0.0);
+        FitFunc->FixParameter(6, FitFunc->GetParameter(6));
+        FitFunc->FixParameter(7, 1.0);
+    }
+
+    if (ActiveDynodeFitMode == DynodeFitMode::Joint || Reduced)
+    {
+        // Perform the fit
+        RunBudgetedFit(TraceGraph, FitFunc, *Guard, Report);
+        AttachFitToGraph(TraceGraph, FitFunc);
+        return FitFunc;
+    }
+
+    // Stage one: rise and fast/slow decay in the peak region, undershoot held at its estimate
+    constexpr Double_t PeakRegionLength = 100.0;
+    const Double_t PeakRegionEnd = TMath::Min(MaxX + PeakRegionLength, FitRangeEnd);
+    const std::vector<Int_t> UndershootParameters = {5, 6};
+    const std::vector<Int_t> PeakParameters = {0, 1, 2, 3, 4, 7, 8};
+
+    for (const Int_t i: UndershootParameters)
+    {
+        FitFunc->FixParameter(i, FitFunc->GetParameter(i));
+    }
+    FitFunc->SetRange(FitRangeStart, PeakRegionEnd);
+
+    FitReport StagedReport;
+    RunBudgetedFit(TraceGraph, FitFunc, *Guard, &StagedReport);
+
+    // Stage two: undershoot amplitude and recovery on the tail, peak parameters fixed
+    if (StagedReport.Outcome != FitOutcome::BudgetExceeded && PeakRegionEnd < FitRangeEnd)
+    {
+        for (const Int_t i: PeakParameters)
+        {
+            FitFunc->FixParameter(i, FitFunc->GetParameter(i));
+        }
+        for (const Int_t i: UndershootParameters)
+        {
+            FitFunc->ReleaseParameter(i);
+            FitFunc->SetParLimits(i, ParameterLimits[i][0], ParameterLimits[i][1]);
+        }
+        FitFunc->SetRange(PeakRegionEnd, FitRangeEnd);
+
+        const FitReport PeakReport = StagedReport;
+        RunBudgetedFit(TraceGraph, FitFunc, *Guard, &StagedReport, &PeakReport);
+    }
+
+    // Restore the free parameters, so the returned function looks like a joint fit
+    for (Int_t i = 0; i < 9; i++)
+    {
+        FitFunc->ReleaseParameter(i);
+        FitFunc->SetParLimits(i, ParameterLimits[i][0], ParameterLimits[i][1]);
+    }
+    FitFunc->SetRange(FitRangeStart, FitRangeEnd);
+
+    // Optional joint polish starting from the staged values
+    if (ActiveDynodeFitMode == DynodeFitMode::StagedWithPolish && StagedReport.Outcome != FitOutcome::BudgetExceeded)
+    {
+        const FitReport StageReport = StagedReport;
+        RunBudgetedFit(TraceGraph, FitFunc, *Guard, &StagedReport, &StageReport);
+    }
+
+    AttachFitToGraph(TraceGraph, FitFunc);
+
+    if (Report)
+    {
+        *Report = StagedReport;
+    }
 
     return FitFunc;
 }
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+// One fit kept for replay, together with the trace it was run on
+struct SlowFitRecord
+{
+    Int_t RunNumber = -1;
+    Int_t SubRunNumber = -1;
+    Long64_t EntryNumber = -1;
+    std::string Channel;
+    Double_t PosX = -1;
+    Double_t PosY = -1;
+    Int_t FitStatus = -1;
+    FitTelemetry Telemetry;
+    std::vector<Double_t> InitialParameters;
+    std::vector<Double_t> FinalParameters;
+    std::vector<UInt_t> Trace;
+};
+
+/**
+ * Keeps the K slowest anode and dynode fits of the current subrun in min-heaps
+ * keyed on wall time, so a fit faster than the current K-th slowest costs one comparison
+ */
+class SlowFitRecorder
+{
+private:
+    struct FasterFit
+    {
+        bool operator()(const SlowFitRecord &A, const SlowFitRecord &B) const
+        {
+            return A.Telemetry.WallTime > B.Telemetry.WallTime;
+        }
+    };
+
+    using FitHeap = std::priority_queue<SlowFitRecord, std::vector<SlowFitRecord>, FasterFit>;
+
+    Int_t FitsPerCategory = 0;
+    Int_t RunNumber = -1;
+    Int_t SubRunNumber = -1;
+    FitHeap AnodeFits;
+    FitHeap DynodeFits;
+    std::vector<SlowFitRecord> FinishedFits;
+    std::mutex RecordMutex; // Fits are recorded from the fit workers of the event pipeline
+
+    void FlushHeap(FitHeap &Heap)
+    {
+        while (!Heap.empty())
+        {
+            FinishedFits.push_back(Heap.top());
+            Heap.pop();
+        }
+    }
+
+public:
+    void Enable(const Int_t FitsToKeep)
+    {
+        FitsPerCategory = FitsToKeep;
+    }
+
+    [[nodiscard]] Bool_t IsEnabled() const
+    {
+        return FitsPerCategory > 0;
+    }
+
+    void BeginSubRun(const Int_t Run, const Int_t SubRun)
+    {
+        FlushHeap(AnodeFits);
+        FlushHeap(DynodeFits);
+        RunNumber = Run;
+        SubRunNumber = SubRun;
+    }
+
+    void Record(const Long64_t Entry, const std::string &Channel, const Double_t PosX, const Double_t PosY,
+                const FitReport &Report, const processor_struct::ROOTDEV &Device)
+    {
+        std::lock_guard<std::mutex> Lock(RecordMutex);
+        FitHeap &Heap = Channel == "dynode" ? DynodeFits : AnodeFits;
+
+        if (static_cast<Int_t>(Heap.size()) >= FitsPerCategory &&
+            Report.Telemetry.WallTime <= Heap.top().Telemetry.WallTime)
+        {
+            return;
+        }
+
+        SlowFitRecord Record;
+        Record.RunNumber = RunNumber;
+        Record.SubRunNumber = SubRunNumber;
+        Record.EntryNumber = Entry;
+        Record.Channel = Channel;
+        Record.PosX = PosX;
+        Record.PosY = PosY;
+        Record.FitStatus = static_cast<Int_t>(Report.Outcome);
+        Record.Telemetry = Report.Telemetry;
+        Record.InitialParameters = Report.InitialParameters;
+        Record.FinalParameters = Report.FinalParameters;
+        Record.Trace.assign(Device.trace.begin(), Device.trace.end());
+
+        Heap.push(std::move(Record));
+        if (static_cast<Int_t>(Heap.size()) > FitsPerCategory)
+        {
+            Heap.pop();
+        }
+    }
+
+    void Save(const char *FileName)
+    {
+        FlushHeap(AnodeFits);
+        FlushHeap(DynodeFits);
+
+        TFile OutputFile(FileName, "RECREATE");
+        if (OutputFile.IsZombie())
+        {
+            throw std::runtime_error("Failed to create slow fit file: " + std::string(FileName));
+        }
+
+        TTree SlowFitTree("slow_fits", "Slowest Fits per Subrun");
+
+        SlowFitRecord Current;
+        SlowFitTree.Branch("run", &Current.RunNumber);
+        SlowFitTree.Branch("subrun", &Current.SubRunNumber);
+        SlowFitTree.Branch("entry", &Current.EntryNumber);
+        SlowFitTree.Branch("channel", &Current.Channel);
+        SlowFitTree.Branch("pos_x", &Current.PosX);
+        SlowFitTree.Branch("pos_y", &Current.PosY);
+        SlowFitTree.Branch("fit_status", &Current.FitStatus);
+        SlowFitTree.Branch("fit_time", &Current.Telemetry.WallTime);
+        SlowFitTree.Branch("iterations", &Current.Telemetry.Iterations);
+        SlowFitTree.Branch("function_calls", &Current.Telemetry.FunctionCalls);
+        SlowFitTree.Branch("chi2", &Current.Telemetry.Chi2);
+        SlowFitTree.Branch("ndf", &Current.Telemetry.Ndf);
+        SlowFitTree.Branch("initial_parameters", &Current.InitialParameters);
+        SlowFitTree.Branch("final_parameters", &Current.FinalParameters);
+        SlowFitTree.Branch("trace", &Current.Trace);
+
+        // Slowest first within each subrun
+        std::stable_sort(FinishedFits.begin(), FinishedFits.end(),
+                         [](const SlowFitRecord &A, const SlowFitRecord &B)
+                         {
+                             if (A.RunNumber != B.RunNumber) return A.RunNumber < B.RunNumber;
+                             if (A.SubRunNumber != B.SubRunNumber) return A.SubRunNumber < B.SubRunNumber;
+                             return A.Telemetry.WallTime > B.Telemetry.WallTime;
+                         });
+
+        for (const auto &Record: FinishedFits)
+        {
+            Current = Record;
+            SlowFitTree.Fill();
+        }
+
+        SlowFitTree.Write();
+        OutputFile.Close();
+
+        std::cout << "[SlowFitRecorder] Saved " << FinishedFits.size() << " slow fits to "
+                << FileName << std::endl;
+        FinishedFits.clear();
+    }
+};
+
+// Create a global instance
+SlowFitRecorder SlowFits;
+
+/**
+ * Enables the slow fit recorder
+ * @param FitsPerCategory Number of slowest anode and dynode fits kept per subrun
+ */
+void EnableSlowFitRecorder(const Int_t FitsPerCategory)
+{
+    SlowFits.Enable(FitsPerCategory);
+}
+
+/**
+ * Starts a new subrun, the fits kept for the previous one are retained for SaveSlowFits
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ */
+void BeginSlowFitSubRun(const Int_t RunNumber, const Int_t SubRunNumber)
+{
+    if (SlowFits.IsEnabled())
+    {
+        SlowFits.BeginSubRun(RunNumber, SubRunNumber);
+    }
+}
+
+/**
+ * Offers a finished fit to the recorder, no-op unless the recorder is enabled
+ * @param Entry Raw entry number of the event, its source entry when reading a skim
+ * @param Channel Channel name, "dynode" for the dynode
+ * @param PosX X position of the event
+ * @param PosY Y position of the event
+ * @param Report Fit report, including initial and final parameters
+ * @param Device Device holding the fitted trace
+ */
+void RecordFitForProfiling(const Long64_t Entry, const std::string &Channel, const Double_t PosX,
+                           const Double_t PosY, const FitReport &Report, const processor_struct::ROOTDEV &Device)
+{
+    if (SlowFits.IsEnabled())
+    {
+        SlowFits.Record(Entry, Channel, PosX, PosY, Report, Device);
+    }
+}
+
+/**
+ * Writes the slow fits recorded since the last save with their raw traces to a ROOT file
+ * @param FileName Output file name
+ */
+void SaveSlowFits(const char *FileName)
+{
+    if (SlowFits.IsEnabled())
+    {
+        SlowFits.Save(FileName);
+    }
+}
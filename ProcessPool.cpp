@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <ROOT/TProcessExecutor.hxx>
+#include <TFileMerger.h>
+#include <TString.h>
+#include <TSystem.h>
+
+#include "main.h"
+
+/**
+ * Slow fit file a worker writes for one task
+ * @param Task Task of the worker
+ * @return slow_fits_RRR_SS.root, with a _partPP suffix for a slice of a subrun
+ */
+std::string SlowFitPartFileName(const SubRunTask &Task)
+{
+    const TString FileName = Task.Part >= 0
+                                 ? TString::Format("slow_fits_%03d_%02d_part%02d.root",
+                                                   Task.RunNumber, Task.SubRunNumber, Task.Part)
+                                 : TString::Format("slow_fits_%03d_%02d.root", Task.RunNumber, Task.SubRunNumber);
+    return FileName.Data();
+}
+
+/**
+ * Merges partial output files and removes them. Trees are concatenated in the order of the
+ * list, so the merged entries keep the part order, and histograms are added
+ * @param PartFileNames Partial files in merge order, missing ones are skipped
+ * @param OutputFileName Merged file, replaced if it exists
+ * @return False if the merge failed, the partial files are then kept
+ */
+Bool_t MergePartialFiles(const std::vector<std::string> &PartFileNames, const std::string &OutputFileName)
+{
+    // A part without qualifying events writes no file
+    std::vector<std::string> ExistingParts;
+    for (const auto &FileName: PartFileNames)
+    {
+        if (!gSystem->AccessPathName(FileName.c_str()))
+        {
+            ExistingParts.push_back(FileName);
+        }
+    }
+    if (ExistingParts.empty())
+    {
+        return true;
+    }
+
+    TFileMerger Merger(false);
+    Merger.OutputFile(OutputFileName.c_str(), "RECREATE");
+    for (const auto &FileName: ExistingParts)
+    {
+        if (!Merger.AddFile(FileName.c_str(), false))
+        {
+            std::cerr << "Failed to add " << FileName << " to " << OutputFileName << std::endl;
+            return false;
+        }
+    }
+    if (!Merger.Merge())
+    {
+        std::cerr << "Failed to merge " << ExistingParts.size() << " parts into " << OutputFileName << std::endl;
+        return false;
+    }
+
+    for (const auto &FileName: ExistingParts)
+    {
+        gSystem->Unlink(FileName.c_str());
+    }
+    return true;
+}
+
+/**
+ * Slice of the qualifying events of one part of a subrun split into Parts. The bounds are rounded
+ * up, so the first part, which carries the cut flow of the subrun, is only empty when all are
+ * @param Size Qualifying events of the subrun
+ * @param Part Part index
+ * @param Parts Number of parts
+ * @return First and one-past-last index into the qualifying events
+ */
+constexpr std::pair<size_t, size_t> SubRunPartRange(const size_t Size, const Int_t Part, const Int_t Parts)
+{
+    const auto Count = static_cast<size_t>(Parts);
+    const auto Index = static_cast<size_t>(Part);
+    return {(Size * Index + Count - 1) / Count, (Size * (Index + 1) + Count - 1) / Count};
+}
+
+// Fewer events than parts still give the first part an event, the remaining ones go to the next parts
+static_assert(SubRunPartRange(1, 0, 4) == std::pair<size_t, size_t>(0, 1), "First part of one event");
+static_assert(SubRunPartRange(1, 1, 4) == std::pair<size_t, size_t>(1, 1), "Later parts of one event");
+static_assert(SubRunPartRange(3, 0, 4) == std::pair<size_t, size_t>(0, 1), "First part of three events");
+static_assert(SubRunPartRange(3, 2, 4) == std::pair<size_t, size_t>(2, 3), "Third part of three events");
+static_assert(SubRunPartRange(3, 3, 4) == std::pair<size_t, size_t>(3, 3), "Last part of three events");
+static_assert(SubRunPartRange(10, 3, 4) == std::pair<size_t, size_t>(8, 10), "Last part of ten events");
+static_assert(SubRunPartRange(0, 0, 4) == std::pair<size_t, size_t>(0, 0), "No events");
+
+/**
+ * Selects a subrun in this process and splits its qualifying events into the tasks of its parts,
+ * each holding the pipeline with the cut flow of the whole subrun
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ * @param Parts Number of equal slices
+ * @param Selector Opens the subrun and fills its qualifying events
+ * @param Tasks Receives the tasks in part order, none if the subrun cannot be selected
+ */
+void AddSubRunPartTasks(const Int_t RunNumber, const Int_t SubRunNumber, const Int_t Parts,
+                        const SubRunLoader &Selector, std::vector<SubRunTask> &Tasks)
+{
+    SubRunInput Input;
+    Input.RunNumber = RunNumber;
+    Input.SubRunNumber = SubRunNumber;
+    try
+    {
+        BeginSelectionSubRun();
+        Selector(Input);
+    }
+    catch (const std::exception &Error)
+    {
+        Input.Error = Error.what();
+    }
+    const Bool_t Selected = Input.File && Input.Error.empty();
+    // Forked while the tree is open, the fork itself is unbound and rebinds in the worker
+    const std::shared_ptr<SelectionPipeline> Selection = Selected ? ForkSelection() : nullptr;
+    CloseRootFile(Input.File);
+    if (!Selected)
+    {
+        std::cerr << "Skipping run " << RunNumber << "_" << SubRunNumber << ": " << Input.Error << std::endl;
+        return;
+    }
+    const size_t Size = Input.QualifyingEvents.size();
+    for (Int_t Part = 0; Part < Parts; Part++)
+    {
+        SubRunTask Task;
+        Task.RunNumber = RunNumber;
+        Task.SubRunNumber = SubRunNumber;
+        Task.Part = Part;
+        Task.Parts = Parts;
+        const auto [First, Last] = SubRunPartRange(Size, Part, Parts);
+        Task.Events.assign(Input.QualifyingEvents.begin() + static_cast<std::ptrdiff_t>(First),
+                           Input.QualifyingEvents.begin() + static_cast<std::ptrdiff_t>(Last));
+        Task.Selection = Selection;
+        Tasks.push_back(std::move(Task));
+    }
+}
+
+/**
+ * Processes a run list on forked worker processes instead of threads. Every worker is a copy of
+ * this process with its own ROOT and analysis globals, so nothing it calls has to be thread-safe.
+ * Each subrun, or each of its PartsPerSubRun slices, is one task writing its own results file;
+ * the parts of a subrun are merged into analysis_RRR_SS.root in part order and the per-task slow
+ * fits into Config.SlowFitsFileName once every worker is done.
+ * A split subrun is selected once, here, before the workers start: its sidecar files are written
+ * by this process only and every part receives its slice of the qualifying events, the first part
+ * also the cut flow. Trace screening baselines and the slow fit ranking start over in every part
+ * @param SubRuns Run and sub-run numbers to process
+ * @param Config Worker count, slices per subrun and merged slow fit file
+ * @param Selector Opens a subrun and fills its qualifying events, used for split subruns
+ * @param Processor Loads and fits one task, runs in a worker process
+ * @return Events with results over all tasks
+ */
+Long64_t RunSubRunProcesses(const std::vector<std::pair<Int_t, Int_t> > &SubRuns, const ProcessPoolConfig &Config,
+                            const SubRunLoader &Selector, const SubRunTaskProcessor &Processor)
+{
+    const Int_t Parts = std::max(Config.PartsPerSubRun, 1);
+    const Int_t Workers = std::max(Config.Workers, 1);
+
+    std::vector<SubRunTask> Tasks;
+    Tasks.reserve(SubRuns.size() * Parts);
+    for (const auto &[RunNumber, SubRunNumber]: SubRuns)
+    {
+        if (Parts > 1)
+        {
+            AddSubRunPartTasks(RunNumber, SubRunNumber, Parts, Selector, Tasks);
+        }
+        else
+        {
+            SubRunTask Task;
+            Task.RunNumber = RunNumber;
+            Task.SubRunNumber = SubRunNumber;
+            Tasks.push_back(std::move(Task));
+        }
+    }
+
+    std::cout << "\nProcessing " << SubRuns.size() << " subruns as " << Tasks.size() << " tasks on "
+            << Workers << " worker processes" << std::endl;
+
+    ROOT::TProcessExecutor Executor(static_cast<UInt_t>(Workers));
+    std::vector<Long64_t> TaskEvents = Executor.Map([&Processor](const SubRunTask &Task) -> Long64_t
+    {
+        Long64_t Events = -1;
+        try
+        {
+            // The first part counts the cut flow of the subrun, the others start empty
+            if (Task.Selection)
+            {
+                AdoptSelection(Task.Selection);
+                if (Task.Part > 0)
+                {
+                    BeginSelectionSubRun();
+                }
+            }
+            Events = Processor(Task);
+
+            // Saving clears the recorder, the next task of this worker starts empty
+            SaveSlowFits(SlowFitPartFileName(Task).c_str());
+        }
+        catch (const std::exception &Error)
+        {
+            std::cerr << "Task " << Task.RunNumber << "_" << Task.SubRunNumber << " part " << Task.Part
+                    << " failed: " << Error.what() << std::endl;
+        }
+        return Events;
+    }, Tasks);
+
+    // Tasks are grouped by subrun, in part order
+    Long64_t TotalEvents = 0;
+    Int_t FailedTasks = 0;
+    std::vector<std::string> SlowFitParts;
+    for (size_t First = 0; First < Tasks.size(); First += Parts)
+    {
+        const SubRunTask &SubRun = Tasks[First];
+        Int_t FailedParts = 0;
+        std::vector<std::string> AnalysisParts;
+        for (Int_t Part = 0; Part < Parts; Part++)
+        {
+            const SubRunTask &Task = Tasks[First + Part];
+            if (TaskEvents[First + Part] < 0)
+            {
+                FailedParts++;
+            }
+            else
+            {
+                TotalEvents += TaskEvents[First + Part];
+            }
+            AnalysisParts.push_back(AnalysisResultsFileName(Task.RunNumber, Task.SubRunNumber, Task.Part));
+            SlowFitParts.push_back(SlowFitPartFileName(Task));
+        }
+        FailedTasks += FailedParts;
+
+        if (Parts == 1)
+        {
+            continue;
+        }
+        if (FailedParts > 0)
+        {
+            std::cerr << "Not merging run " << SubRun.RunNumber << "_" << SubRun.SubRunNumber << ": "
+                    << FailedParts << " of " << Parts << " parts failed" << std::endl;
+            continue;
+        }
+        MergePartialFiles(AnalysisParts, AnalysisResultsFileName(SubRun.RunNumber, SubRun.SubRunNumber));
+    }
+    MergePartialFiles(SlowFitParts, Config.SlowFitsFileName);
+
+    std::cout << "\n[ProcessPool] " << TotalEvents << " events with results from " << Tasks.size() - FailedTasks
+            << " of " << Tasks.size() << " tasks" << std::endl;
+    return TotalEvents;
+}
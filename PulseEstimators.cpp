@@ -0,0 +1,635 @@
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#include <TFile.h>
+#include <TH1D.h>
+#include <TMath.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+// Digital constant-fraction discriminator, delay in samples
+constexpr Double_t CfdFraction = 0.3;
+constexpr Int_t CfdDelay = 5;
+
+// Decay tail used by the log-linear regression, as fractions of the pulse height
+constexpr Double_t TailStartFraction = 0.7;
+constexpr Double_t TailEndFraction = 0.1;
+
+// Amplitude integration window after the onset, in decay constants
+constexpr Double_t IntegralWindowDecays = 5.0;
+
+/**
+ * Sub-sample time where the rising edge crosses Level, searching back from the maximum
+ * @param Pulse Baseline-subtracted samples
+ * @param MaxIndex Index of the maximum
+ * @param Level Crossing level
+ * @return Interpolated crossing time in samples, nullopt if the pulse never drops below Level
+ */
+std::optional<Double_t> LeadingEdgeCrossing(const Double_t *Pulse, const Int_t MaxIndex, const Double_t Level)
+{
+    for (Int_t i = MaxIndex; i > 0; i--)
+    {
+        if (Pulse[i - 1] < Level)
+        {
+            return i - 1 + (Level - Pulse[i - 1]) / (Pulse[i] - Pulse[i - 1]);
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * Zero crossing of the digital CFD signal CfdFraction * x[i] - x[i - CfdDelay]
+ * @param Pulse Baseline-subtracted samples
+ * @param SampleCount Number of samples
+ * @param Start First sample on the leading edge, where the CFD signal is positive
+ * @return Interpolated crossing time in samples
+ */
+std::optional<Double_t> CfdCrossing(const Double_t *Pulse, const Int_t SampleCount, const Int_t Start)
+{
+    Bool_t Armed = false;
+    Double_t Previous = 0;
+    for (Int_t i = TMath::Max(Start, CfdDelay); i < SampleCount; i++)
+    {
+        const Double_t Value = CfdFraction * Pulse[i] - Pulse[i - CfdDelay];
+        if (Value > 0)
+        {
+            Armed = true;
+        }
+        else if (Armed)
+        {
+            return i - 1 + Previous / (Previous - Value);
+        }
+        Previous = Value;
+    }
+    return std::nullopt;
+}
+
+/**
+ * CFD zero crossing of a unit pulse shape starting at t = 0, the offset between onset and CFD time
+ * @param Shape Pulse shape, zero for t <= 0
+ * @param Horizon Search range
+ * @return Crossing time
+ */
+std::optional<Double_t> ModelCfdCrossing(const std::function<Double_t(Double_t)> &Shape, const Double_t Horizon)
+{
+    const auto Cfd = [&](const Double_t T)
+    {
+        return CfdFraction * Shape(T) - (T > CfdDelay ? Shape(T - CfdDelay) : 0.0);
+    };
+
+    constexpr Double_t Step = 0.25;
+    Bool_t Armed = false;
+    for (Double_t T = Step; T < Horizon; T += Step)
+    {
+        if (Cfd(T) > 0)
+        {
+            Armed = true;
+        }
+        else if (Armed)
+        {
+            Double_t Low = T - Step;
+            Double_t High = T;
+            for (Int_t Iteration = 0; Iteration < 30; Iteration++)
+            {
+                const Double_t Middle = 0.5 * (Low + High);
+                (Cfd(Middle) > 0 ? Low : High) = Middle;
+            }
+            return 0.5 * (Low + High);
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * 10-90% rise time of a unimodal unit pulse shape starting at t = 0
+ * @param Shape Pulse shape as a function of time and rise time constant
+ * @param Tau Rise time constant
+ * @param Horizon Upper bound on the time of the maximum
+ * @return Rise time
+ */
+Double_t ModelRiseTime(const std::function<Double_t(Double_t, Double_t)> &Shape, const Double_t Tau,
+                       const Double_t Horizon)
+{
+    // Ternary search for the maximum
+    Double_t Low = 0;
+    Double_t High = Horizon;
+    for (Int_t Iteration = 0; Iteration < 40; Iteration++)
+    {
+        const Double_t Left = Low + (High - Low) / 3;
+        const Double_t Right = High - (High - Low) / 3;
+        if (Shape(Left, Tau) < Shape(Right, Tau))
+        {
+            Low = Left;
+        }
+        else
+        {
+            High = Right;
+        }
+    }
+    const Double_t PeakTime = 0.5 * (Low + High);
+    const Double_t Peak = Shape(PeakTime, Tau);
+
+    const auto Crossing = [&](const Double_t Fraction)
+    {
+        Double_t Before = 0;
+        Double_t After = PeakTime;
+        for (Int_t Iteration = 0; Iteration < 30; Iteration++)
+        {
+            const Double_t Middle = 0.5 * (Before + After);
+            (Shape(Middle, Tau) < Fraction * Peak ? Before : After) = Middle;
+        }
+        return 0.5 * (Before + After);
+    };
+
+    return Crossing(0.9) - Crossing(0.1);
+}
+
+/**
+ * Rise time constant whose model shape reproduces a measured 10-90% rise time. The decay
+ * shortens the rise of the shape, so the constant is solved for instead of converted
+ * @param Shape Pulse shape as a function of time and rise time constant
+ * @param MeasuredRise Measured 10-90% rise time
+ * @return Rise time constant, nullopt if no constant within a factor 100 reproduces the rise
+ */
+std::optional<Double_t> SolveRiseTimeConstant(const std::function<Double_t(Double_t, Double_t)> &Shape,
+                                              const Double_t MeasuredRise)
+{
+    const Double_t Horizon = 20 * MeasuredRise + 10;
+
+    // The model rise time grows monotonically with the constant, bisect in log space
+    Double_t Low = std::log(MeasuredRise / 100);
+    Double_t High = std::log(MeasuredRise * 10);
+    if (ModelRiseTime(Shape, std::exp(High), Horizon) < MeasuredRise ||
+        ModelRiseTime(Shape, std::exp(Low), Horizon) > MeasuredRise)
+    {
+        return std::nullopt;
+    }
+
+    for (Int_t Iteration = 0; Iteration < 30; Iteration++)
+    {
+        const Double_t Middle = 0.5 * (Low + High);
+        (ModelRiseTime(Shape, std::exp(Middle), Horizon) < MeasuredRise ? Low : High) = Middle;
+    }
+    return std::exp(0.5 * (Low + High));
+}
+
+/**
+ * Decay constant from a weighted linear regression of log(x) on t over the tail between
+ * TailStartFraction and TailEndFraction of the height. Weights x^2 undo the noise amplification
+ * of the logarithm
+ * @return Decay constant in samples, nullopt if the tail is too short or not decaying
+ */
+std::optional<Double_t> LogLinearDecay(const Double_t *Pulse, const Int_t SampleCount, const Int_t MaxIndex,
+                                       const Double_t Height, const Double_t NoiseRMS)
+{
+    Double_t SumW = 0, SumWT = 0, SumWT2 = 0, SumWL = 0, SumWTL = 0;
+    Int_t Points = 0;
+
+    for (Int_t i = MaxIndex + 1; i < SampleCount; i++)
+    {
+        const Double_t Y = Pulse[i];
+        if (Y < TailEndFraction * Height || Y < 3 * NoiseRMS)
+        {
+            break;
+        }
+        if (Y > TailStartFraction * Height)
+        {
+            continue;
+        }
+
+        const Double_t W = Y * Y;
+        const Double_t L = std::log(Y);
+        SumW += W;
+        SumWT += W * i;
+        SumWT2 += W * i * i;
+        SumWL += W * L;
+        SumWTL += W * i * L;
+        Points++;
+    }
+
+    const Double_t Denominator = SumW * SumWT2 - SumWT * SumWT;
+    if (Points < 3 || Denominator <= 0)
+    {
+        return std::nullopt;
+    }
+
+    const Double_t Slope = (SumW * SumWTL - SumWT * SumWL) / Denominator;
+    if (Slope >= 0)
+    {
+        return std::nullopt;
+    }
+    return -1.0 / Slope;
+}
+
+/**
+ * Anode parameters without a fit, in the AnodePeakFunction parametrization.
+ *
+ * - RiseTimeConstant solved from the 10-90% rise, with the position-dependent RisePower
+ * - DecayConstant from a log-linear regression of the tail
+ * - PeakPosition (onset) from a CFD pick, minus the CFD time of the model shape
+ * - Amplitude from the integral over IntegralWindowDecays decay constants, divided by the model integral
+ *
+ * The rise time is interpolated linearly on a rise of a few samples. CompareEstimatesWithFits
+ * measures the agreement of every parameter with the fits on data.
+ *
+ * @param Samples Trace samples
+ * @param SampleCount Number of samples
+ * @param Statistics Seed statistics of the trace
+ * @param RisePower Rise power of the channel at the event position
+ * @return Estimated parameters, nullopt if a feature could not be found
+ */
+std::optional<AnalysisResults::ChannelFit> EstimateAnodeParameters(const Double_t *Samples, const Int_t SampleCount,
+                                                                   const TraceStatistics &Statistics,
+                                                                   const Double_t RisePower)
+{
+    if (Statistics.MaxIndex < 0 || Statistics.ThresholdCrossing < 0 || RisePower <= 0)
+    {
+        return std::nullopt;
+    }
+
+    std::vector<Double_t> Pulse(Samples, Samples + SampleCount);
+    for (auto &Value: Pulse)
+    {
+        Value -= Statistics.BaselineMean;
+    }
+    const Double_t Height = Statistics.MaxValue - Statistics.BaselineMean;
+
+    const auto T10 = LeadingEdgeCrossing(Pulse.data(), Statistics.MaxIndex, 0.1 * Height);
+    const auto T90 = LeadingEdgeCrossing(Pulse.data(), Statistics.MaxIndex, 0.9 * Height);
+    const auto DecayConstant = LogLinearDecay(Pulse.data(), SampleCount, Statistics.MaxIndex, Height,
+                                              Statistics.BaselineRMS);
+    if (!T10 || !T90 || *T90 <= *T10 || !DecayConstant)
+    {
+        return std::nullopt;
+    }
+
+    const auto ShapeWithRise = [&](const Double_t T, const Double_t Tau)
+    {
+        return T <= 0 ? 0.0 : (1.0 - std::exp(-std::pow(T / Tau, RisePower))) * std::exp(-T / *DecayConstant);
+    };
+
+    const auto RiseTimeConstant = SolveRiseTimeConstant(ShapeWithRise, *T90 - *T10);
+    if (!RiseTimeConstant)
+    {
+        return std::nullopt;
+    }
+    const auto Shape = [&](const Double_t T)
+    {
+        return ShapeWithRise(T, *RiseTimeConstant);
+    };
+
+    const auto Crossing = CfdCrossing(Pulse.data(), SampleCount, Statistics.ThresholdCrossing);
+    const auto ModelCrossing = ModelCfdCrossing(Shape, 10 * (*RiseTimeConstant + CfdDelay) + *DecayConstant);
+    if (!Crossing || !ModelCrossing)
+    {
+        return std::nullopt;
+    }
+    const Double_t Onset = *Crossing - *ModelCrossing;
+
+    Double_t Integral = 0;
+    Double_t ShapeIntegral = 0;
+    const auto WindowEnd = static_cast<Int_t>(TMath::Min(static_cast<Double_t>(SampleCount),
+                                                         Onset + IntegralWindowDecays * *DecayConstant));
+    for (Int_t i = TMath::Max(0, static_cast<Int_t>(std::floor(Onset)) + 1); i < WindowEnd; i++)
+    {
+        Integral += Pulse[i];
+        ShapeIntegral += Shape(i - Onset);
+    }
+    if (ShapeIntegral <= 0)
+    {
+        return std::nullopt;
+    }
+
+    AnalysisResults::ChannelFit Fit;
+    Fit.Amplitude = Integral / ShapeIntegral;
+    Fit.PeakPosition = Onset;
+    Fit.DecayConstant = *DecayConstant;
+    Fit.RiseTimeConstant = *RiseTimeConstant;
+    Fit.RisePower = RisePower;
+    Fit.Baseline = Statistics.BaselineMean;
+    return Fit;
+}
+
+/**
+ * Dynode parameters without a fit, in the DynodePeakFunction parametrization.
+ *
+ * Decays, fast fraction and undershoot come from EstimateDynodeDecays, whose least-squares weights
+ * also give the amplitude. RiseTime is solved from the 10-90% rise and the onset a CFD pick minus
+ * the CFD time of the model shape, with the undershoot neglected on the leading edge.
+ * The decay estimate, and with it the amplitude, becomes noisy for small pulses; CompareEstimatesWithFits
+ * measures the agreement with the fits on data.
+ *
+ * @param Samples Trace samples
+ * @param SampleCount Number of samples
+ * @param Statistics Seed statistics of the trace
+ * @return Estimated parameters, nullopt if a feature could not be found
+ */
+std::optional<AnalysisResults::DynodeFit> EstimateDynodeParameters(const Double_t *Samples, const Int_t SampleCount,
+                                                                   const TraceStatistics &Statistics)
+{
+    if (Statistics.MaxIndex < 0 || Statistics.ThresholdCrossing < 0)
+    {
+        return std::nullopt;
+    }
+
+    const auto Decays = EstimateDynodeDecays(Samples, SampleCount, Statistics.MaxIndex, Statistics.BaselineMean);
+    if (!Decays)
+    {
+        return std::nullopt;
+    }
+
+    std::vector<Double_t> Pulse(Samples, Samples + SampleCount);
+    for (auto &Value: Pulse)
+    {
+        Value -= Statistics.BaselineMean;
+    }
+    const Double_t Height = Statistics.MaxValue - Statistics.BaselineMean;
+
+    const auto T10 = LeadingEdgeCrossing(Pulse.data(), Statistics.MaxIndex, 0.1 * Height);
+    const auto T90 = LeadingEdgeCrossing(Pulse.data(), Statistics.MaxIndex, 0.9 * Height);
+    if (!T10 || !T90 || *T90 <= *T10)
+    {
+        return std::nullopt;
+    }
+
+    const auto ShapeWithRise = [&](const Double_t T, const Double_t Tau)
+    {
+        return T <= 0
+                   ? 0.0
+                   : (1.0 - std::exp(-T / Tau)) * (Decays->FastFraction * std::exp(-T / Decays->FastDecay) +
+                                                   (1.0 - Decays->FastFraction) * std::exp(-T / Decays->SlowDecay));
+    };
+
+    const auto RiseTime = SolveRiseTimeConstant(ShapeWithRise, *T90 - *T10);
+    if (!RiseTime)
+    {
+        return std::nullopt;
+    }
+    const auto Shape = [&](const Double_t T)
+    {
+        return ShapeWithRise(T, *RiseTime);
+    };
+
+    const auto Crossing = CfdCrossing(Pulse.data(), SampleCount, Statistics.ThresholdCrossing);
+    const auto ModelCrossing = ModelCfdCrossing(Shape, 10 * (*RiseTime + CfdDelay) + Decays->SlowDecay);
+    if (!Crossing || !ModelCrossing)
+    {
+        return std::nullopt;
+    }
+    const Double_t Onset = *Crossing - *ModelCrossing;
+
+    // The estimate is referenced to the maximum, the model to the onset
+    const Double_t Lead = Statistics.MaxIndex - Onset;
+    const Double_t FastWeight = Decays->Amplitude * Decays->FastFraction * std::exp(Lead / Decays->FastDecay);
+    const Double_t SlowWeight = Decays->Amplitude * (1.0 - Decays->FastFraction) * std::exp(Lead / Decays->SlowDecay);
+
+    AnalysisResults::DynodeFit Fit;
+    Fit.Amplitude = FastWeight + SlowWeight;
+    Fit.PeakPosition = Onset;
+    Fit.FastDecay = Decays->FastDecay;
+    Fit.SlowDecay = Decays->SlowDecay;
+    Fit.RiseTime = *RiseTime;
+    Fit.UndershootAmp = Decays->UndershootAmp;
+    Fit.UndershootRecovery = Decays->UndershootRecovery;
+    Fit.FastFraction = FastWeight / Fit.Amplitude;
+    Fit.Baseline = Statistics.BaselineMean;
+    return Fit;
+}
+
+/**
+ * Counterpart of FitDecodedEvent that fills the same results from the fast estimators,
+ * without TF1. Every channel gets FitOutcome::Estimated and its estimation time as WallTime
+ * @param Event Event from DecodeEvent
+ * @param MatchTemplates Match anodes against their position template first, FitOutcome::TemplateMatched;
+ * only amplitude, onset and baseline are then filled
+ * @param StatusReport Optional report receiving why the event produced no results
+ * @return Optional analysis results, nullopt if any channel estimate fails
+ */
+std::optional<AnalysisResults> EstimateDecodedEvent(const DecodedEvent &Event, const Bool_t MatchTemplates,
+                                                    EventReport *StatusReport)
+{
+    const auto Reject = [StatusReport](const EventStatus Status, const std::string &Channel = "")
+        -> std::optional<AnalysisResults>
+    {
+        if (StatusReport)
+        {
+            StatusReport->Status = Status;
+            StatusReport->Channel = Channel;
+        }
+        return std::nullopt;
+    };
+
+    AnalysisResults Results;
+    Results.EventNumber = Event.EventNumber;
+    Results.PosX = Event.PosX;
+    Results.PosY = Event.PosY;
+
+    const auto &RootDevVector = Event.Devices;
+    for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.size(); DeviceIndex++)
+    {
+        const auto &Device = RootDevVector[DeviceIndex];
+
+        if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
+        {
+            continue;
+        }
+
+        const auto Start = std::chrono::steady_clock::now();
+        const auto SampleCount = static_cast<Int_t>(Device.trace.size());
+        const TraceStatistics Statistics = ComputeTraceStatistics(Device.trace.data(), SampleCount);
+        const std::vector<Double_t> Samples(Device.trace.begin(), Device.trace.end());
+
+        FitTelemetry Telemetry;
+        const auto Elapsed = [&]
+        {
+            return std::chrono::duration<Double_t, std::micro>(std::chrono::steady_clock::now() - Start).count();
+        };
+
+        if (Device.subtype == "dynode_high")
+        {
+            auto DynodeParams = EstimateDynodeParameters(Samples.data(), SampleCount, Statistics);
+            if (!DynodeParams)
+            {
+                return Reject(EventStatus::FitFailed, "dynode");
+            }
+            Telemetry.WallTime = Elapsed();
+            Results.DynodeFitParams = *DynodeParams;
+            Results.DynodeFitParams.FitStatus = static_cast<Int_t>(FitOutcome::Estimated);
+            Results.DynodeFitParams.Model = static_cast<Int_t>(PulseModel::Estimator);
+            Results.DynodeFitParams.Telemetry = Telemetry;
+        }
+        else if (Device.subtype == "anode_high")
+        {
+            const auto ChannelIter = AnodeChannelMap.find(Device.chanNum);
+            if (ChannelIter == AnodeChannelMap.end())
+            {
+                continue;
+            }
+            const std::string &Channel = ChannelIter->second.first;
+
+            if (const auto *Template = MatchTemplates
+                                           ? GetPulseTemplate(Channel, Results.PosX, Results.PosY)
+                                           : nullptr)
+            {
+                auto AnodeParams = MatchPulseTemplate(Samples.data(), SampleCount, Statistics, *Template);
+                if (!AnodeParams)
+                {
+                    return Reject(EventStatus::FitFailed, Channel);
+                }
+                AnodeParams->FitStatus = static_cast<Int_t>(FitOutcome::TemplateMatched);
+                AnodeParams->Model = static_cast<Int_t>(PulseModel::Template);
+                AnodeParams->Telemetry.WallTime = Elapsed();
+                Results.AnodeFits[Channel] = *AnodeParams;
+                continue;
+            }
+
+            // Always use X position for rise power calculation
+            const auto RisePower = TryCalculateRisePower(Channel, Results.PosX);
+            if (!RisePower)
+            {
+                return Reject(EventStatus::PositionOutOfRange, Channel);
+            }
+            auto AnodeParams = EstimateAnodeParameters(Samples.data(), SampleCount, Statistics, *RisePower);
+            if (!AnodeParams)
+            {
+                return Reject(EventStatus::FitFailed, Channel);
+            }
+            Telemetry.WallTime = Elapsed();
+            AnodeParams->FitStatus = static_cast<Int_t>(FitOutcome::Estimated);
+            AnodeParams->Model = static_cast<Int_t>(PulseModel::Estimator);
+            AnodeParams->Telemetry = Telemetry;
+            Results.AnodeFits[Channel] = *AnodeParams;
+        }
+    }
+
+    if (StatusReport)
+    {
+        StatusReport->Status = EventStatus::Accepted;
+    }
+    return Results;
+}
+
+/**
+ * Counterpart of GetEventFitParameters that fills the same results from the fast estimators, see EstimateDecodedEvent
+ * @param TreeInput Pointer to the input tree
+ * @param Entry Entry number to process
+ * @param MatchTemplates Match anodes against their position template first
+ * @param StatusReport Optional report receiving why the event produced no results
+ * @return Optional analysis results, nullopt if the event fails selection or any channel estimate
+ */
+std::optional<AnalysisResults> GetEventEstimatedParameters(TTree *TreeInput, const Long64_t Entry,
+                                                           const Bool_t MatchTemplates, EventReport *StatusReport)
+{
+    static thread_local DecodedEvent Event;
+    if (!DecodeEvent(TreeInput, Entry, Event, StatusReport))
+    {
+        return std::nullopt;
+    }
+    return EstimateDecodedEvent(Event, MatchTemplates, StatusReport);
+}
+
+/**
+ * Runs fits and estimators on the same events and reports the estimator accuracy per parameter:
+ * relative difference (estimate - fit) / fit, or the difference in ns for positions. Histograms
+ * go to OutputFileName, mean and RMS of each difference and the time per event to stdout
+ * @param InputFileName Raw trace file
+ * @param MaxEvents Number of qualifying events to compare
+ * @param OutputFileName Output file for the difference histograms
+ */
+void CompareEstimatesWithFits(const char *InputFileName, const Long64_t MaxEvents, const char *OutputFileName)
+{
+    TFile *InputFile = OpenRootFile(InputFileName);
+    TTree *Tree = GetTree(InputFile, "pspmt");
+    const std::vector<Long64_t> QualifyingEvents = GetAllQualifyingEvents(Tree);
+
+    TFile OutputFile(OutputFileName, "RECREATE");
+    std::map<std::string, TH1D *> Differences;
+
+    const auto Compare = [&](const std::string &Name, const Double_t Estimate, const Double_t Fitted,
+                             const Bool_t Relative)
+    {
+        auto &Histogram = Differences[Name];
+        if (!Histogram)
+        {
+            Histogram = Relative
+                            ? new TH1D(Name.c_str(), (Name + ";(estimate - fit) / fit;Events").c_str(), 200, -1, 1)
+                            : new TH1D(Name.c_str(), (Name + ";estimate - fit [ns];Events").c_str(), 200, -20, 20);
+        }
+        if (Relative && Fitted == 0)
+        {
+            return;
+        }
+        Histogram->Fill(Relative ? (Estimate - Fitted) / Fitted : Estimate - Fitted);
+    };
+
+    Double_t FitTime = 0;
+    Double_t EstimateTime = 0;
+    Long64_t Compared = 0;
+
+    for (Long64_t i = 0; i < TMath::Min(MaxEvents, static_cast<Long64_t>(QualifyingEvents.size())); i++)
+    {
+        const auto FitStart = std::chrono::steady_clock::now();
+        const auto Fitted = GetEventFitParameters(Tree, QualifyingEvents[i]);
+        const auto EstimateStart = std::chrono::steady_clock::now();
+        const auto Estimated = GetEventEstimatedParameters(Tree, QualifyingEvents[i]);
+        const auto End = std::chrono::steady_clock::now();
+
+        if (!Fitted || !Estimated)
+        {
+            continue;
+        }
+
+        FitTime += std::chrono::duration<Double_t>(EstimateStart - FitStart).count();
+        EstimateTime += std::chrono::duration<Double_t>(End - EstimateStart).count();
+        Compared++;
+
+        for (const auto &[Channel, Fit]: Fitted->AnodeFits)
+        {
+            const auto EstimateIter = Estimated->AnodeFits.find(Channel);
+            if (EstimateIter == Estimated->AnodeFits.end())
+            {
+                continue;
+            }
+            const auto &Estimate = EstimateIter->second;
+            Compare(Channel + "_amplitude", Estimate.Amplitude, Fit.Amplitude, true);
+            Compare(Channel + "_peak_position", Estimate.PeakPosition, Fit.PeakPosition, false);
+            Compare(Channel + "_decay_constant", Estimate.DecayConstant, Fit.DecayConstant, true);
+            Compare(Channel + "_rise_time", Estimate.RiseTimeConstant, Fit.RiseTimeConstant, true);
+        }
+
+        const auto &Fit = Fitted->DynodeFitParams;
+        const auto &Estimate = Estimated->DynodeFitParams;
+        Compare("dynode_amplitude", Estimate.Amplitude, Fit.Amplitude, true);
+        Compare("dynode_peak_position", Estimate.PeakPosition, Fit.PeakPosition, false);
+        Compare("dynode_fast_decay", Estimate.FastDecay, Fit.FastDecay, true);
+        Compare("dynode_slow_decay", Estimate.SlowDecay, Fit.SlowDecay, true);
+        Compare("dynode_rise_time", Estimate.RiseTime, Fit.RiseTime, true);
+        Compare("dynode_undershoot_amp", Estimate.UndershootAmp, Fit.UndershootAmp, true);
+    }
+
+    std::cout << "\n[CompareEstimatesWithFits] " << InputFileName << ": " << Compared << " events" << std::endl;
+    if (Compared > 0)
+    {
+        std::cout << "Time per event: fit " << 1e3 * FitTime / Compared << " ms, estimate "
+                << 1e3 * EstimateTime / Compared << " ms" << std::endl;
+    }
+    std::cout << std::left << std::setw(28) << "Parameter" << std::setw(12) << "Mean" << "RMS" << std::endl;
+    for (const auto &[Name, Histogram]: Differences)
+    {
+        std::cout << std::left << std::setw(28) << Name << std::setw(12) << Histogram->GetMean()
+                << Histogram->GetRMS() << std::endl;
+        Histogram->Write();
+    }
+
+    OutputFile.Close();
+    CloseRootFile(InputFile);
+}
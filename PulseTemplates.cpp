@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <TFile.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TMath.h>
+#include <TTree.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+// Position cells over the selected range, see MeetsSelectionCriteria
+constexpr Int_t TemplateCells = 6;
+constexpr Double_t TemplateMinPos = 0.1;
+constexpr Double_t TemplateMaxPos = 0.4;
+
+// Template samples, starting TemplatePreSamples before the fitted onset
+constexpr Int_t TemplateLength = 200;
+constexpr Int_t TemplatePreSamples = 20;
+
+// Events required before a cell template is written
+constexpr Int_t MinTemplateEvents = 20;
+
+// Shifts tried on each side of the peak-aligned position
+constexpr Int_t TemplateSearchShifts = 5;
+
+/**
+ * Position cell of an event
+ * @return Cell index, ix * TemplateCells + iy, or -1 outside the selected range
+ */
+Int_t TemplateCell(const Double_t PosX, const Double_t PosY)
+{
+    if (PosX < TemplateMinPos || PosX > TemplateMaxPos || PosY < TemplateMinPos || PosY > TemplateMaxPos)
+    {
+        return -1;
+    }
+
+    const auto Bin = [](const Double_t Position)
+    {
+        const auto Index = static_cast<Int_t>((Position - TemplateMinPos) / (TemplateMaxPos - TemplateMinPos) *
+                                              TemplateCells);
+        return TMath::Min(Index, TemplateCells - 1);
+    };
+    return Bin(PosX) * TemplateCells + Bin(PosY);
+}
+
+/**
+ * Builds averaged, onset-aligned anode templates per channel and position cell from fitted runs.
+ * Each converged fit contributes (trace - baseline) / amplitude, resampled by linear interpolation
+ * on TemplateLength samples starting TemplatePreSamples before its fitted onset
+ * @param RunsToProcess Runs with both the raw traces and the analysis results
+ * @param OutputFileName Output file, one TH1D per channel and populated cell
+ */
+void BuildPulseTemplates(const std::vector<std::pair<Int_t, Int_t> > &RunsToProcess, const char *OutputFileName)
+{
+    std::map<std::string, std::vector<std::vector<Double_t> > > Sums;
+    std::map<std::string, std::vector<Int_t> > Counts;
+    for (const auto &[ChannelNumber, Names]: AnodeChannelMap)
+    {
+        const std::string &Channel = Names.first;
+        Sums[Channel].assign(TemplateCells * TemplateCells, std::vector<Double_t>(TemplateLength, 0.0));
+        Counts[Channel].assign(TemplateCells * TemplateCells, 0);
+    }
+
+    for (const auto &[RunNumber, SubRunNumber]: RunsToProcess)
+    {
+        // The analysis file is in the working directory, the raw traces in the input directory
+        TFile *AnalysisFile = TFile::Open(Form("analysis_%03d_%02d.root", RunNumber, SubRunNumber));
+        if (!AnalysisFile || AnalysisFile->IsZombie())
+        {
+            std::cerr << "Could not open the analysis file of run " << RunNumber << "_" << SubRunNumber << std::endl;
+            delete AnalysisFile;
+            continue;
+        }
+
+        TFile *TraceFile = nullptr;
+        try
+        {
+            TraceFile = OpenRootFile(TString::Format("pixie_bigrips_traces_%03d_%02d.root", RunNumber, SubRunNumber));
+        }
+        catch (const std::exception &Error)
+        {
+            std::cerr << "Could not open the trace file of run " << RunNumber << "_" << SubRunNumber << ": "
+                    << Error.what() << std::endl;
+            AnalysisFile->Close();
+            delete AnalysisFile;
+            continue;
+        }
+
+        const auto AnalysisTree = dynamic_cast<TTree *>(AnalysisFile->Get("analysis"));
+        const auto TraceTree = dynamic_cast<TTree *>(TraceFile->Get("pspmt"));
+        if (!AnalysisTree || !TraceTree)
+        {
+            std::cerr << "Missing trees for run " << RunNumber << "_" << SubRunNumber << std::endl;
+            AnalysisFile->Close();
+            delete AnalysisFile;
+            CloseRootFile(TraceFile);
+            continue;
+        }
+
+        Long64_t EventNumber;
+        Double_t PosX, PosY;
+        std::map<std::string, AnalysisResults::ChannelFit> Fits;
+        AnalysisTree->SetBranchAddress("event_number", &EventNumber);
+        AnalysisTree->SetBranchAddress("pos_x", &PosX);
+        AnalysisTree->SetBranchAddress("pos_y", &PosY);
+        for (const auto &[ChannelNumber, Names]: AnodeChannelMap)
+        {
+            const std::string &Channel = Names.first;
+            AnalysisTree->SetBranchAddress(Form("%s_amplitude", Channel.c_str()), &Fits[Channel].Amplitude);
+            AnalysisTree->SetBranchAddress(Form("%s_peak_position", Channel.c_str()), &Fits[Channel].PeakPosition);
+            AnalysisTree->SetBranchAddress(Form("%s_baseline", Channel.c_str()), &Fits[Channel].Baseline);
+
+            // Files written before fit outcomes were stored count as converged
+            Fits[Channel].FitStatus = static_cast<Int_t>(FitOutcome::Converged);
+            if (AnalysisTree->GetBranch(Form("%s_fit_status", Channel.c_str())))
+            {
+                AnalysisTree->SetBranchAddress(Form("%s_fit_status", Channel.c_str()), &Fits[Channel].FitStatus);
+            }
+        }
+
+        std::vector<processor_struct::ROOTDEV> RootDevVector;
+
+        for (Long64_t Entry = 0; Entry < AnalysisTree->GetEntries(); Entry++)
+        {
+            AnalysisTree->GetEntry(Entry);
+
+            const Int_t Cell = TemplateCell(PosX, PosY);
+            if (Cell < 0)
+            {
+                continue;
+            }
+
+            if (!ReadRootDevices(TraceTree, EventNumber, RootDevVector))
+            {
+                continue;
+            }
+            for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.size(); DeviceIndex++)
+            {
+                const auto &Device = RootDevVector[DeviceIndex];
+                const auto ChannelIter = AnodeChannelMap.find(Device.chanNum);
+                if (Device.subtype != "anode_high" || ChannelIter == AnodeChannelMap.end())
+                {
+                    continue;
+                }
+                const std::string &Channel = ChannelIter->second.first;
+
+                const auto &Fit = Fits[Channel];
+                if (Fit.FitStatus != static_cast<Int_t>(FitOutcome::Converged) || Fit.Amplitude <= 0)
+                {
+                    continue;
+                }
+
+                const Double_t Start = Fit.PeakPosition - TemplatePreSamples;
+                if (Start < 0 || Start + TemplateLength + 1 >= static_cast<Double_t>(Device.trace.size()))
+                {
+                    continue;
+                }
+
+                const auto First = static_cast<Int_t>(Start);
+                const Double_t Fraction = Start - First;
+                auto &Sum = Sums[Channel][Cell];
+                for (Int_t k = 0; k < TemplateLength; k++)
+                {
+                    const Double_t Y = (1 - Fraction) * Device.trace[First + k] + Fraction * Device.trace[First + k + 1];
+                    Sum[k] += (Y - Fit.Baseline) / Fit.Amplitude;
+                }
+                Counts[Channel][Cell]++;
+            }
+        }
+
+        AnalysisFile->Close();
+        delete AnalysisFile;
+        CloseRootFile(TraceFile);
+    }
+
+    TFile OutputFile(OutputFileName, "RECREATE");
+    for (const auto &[ChannelNumber, Names]: AnodeChannelMap)
+    {
+        const std::string &Channel = Names.first;
+        TH2D CountMap(Form("%s_template_counts", Channel.c_str()),
+                      Form("%s template events;X Position;Y Position", Channel.c_str()),
+                      TemplateCells, TemplateMinPos, TemplateMaxPos, TemplateCells, TemplateMinPos, TemplateMaxPos);
+
+        for (Int_t Cell = 0; Cell < TemplateCells * TemplateCells; Cell++)
+        {
+            const Int_t Events = Counts[Channel][Cell];
+            CountMap.SetBinContent(Cell / TemplateCells + 1, Cell % TemplateCells + 1, Events);
+            if (Events < MinTemplateEvents)
+            {
+                continue;
+            }
+
+            TH1D Template(Form("%s_template_%d_%d", Channel.c_str(), Cell / TemplateCells, Cell % TemplateCells),
+                          Form("%s template;Sample from onset;Normalized amplitude", Channel.c_str()),
+                          TemplateLength, -TemplatePreSamples, TemplateLength - TemplatePreSamples);
+            for (Int_t k = 0; k < TemplateLength; k++)
+            {
+                Template.SetBinContent(k + 1, Sums[Channel][Cell][k] / Events);
+            }
+            Template.Write();
+        }
+
+        CountMap.Write();
+    }
+    OutputFile.Close();
+
+    std::cout << "Pulse templates saved to " << OutputFileName << std::endl;
+}
+
+class PulseTemplateManager
+{
+private:
+    std::map<std::string, std::vector<std::vector<Double_t> > > Templates;
+    std::once_flag Initialized;
+
+    void Load()
+    {
+        TFile *TemplateFile = TFile::Open("pulse_templates.root", "READ");
+        if (!TemplateFile || TemplateFile->IsZombie())
+        {
+            std::cerr << "Failed to open pulse templates file" << std::endl;
+            return;
+        }
+
+        for (const std::string Channel: {"xa", "xb", "ya", "yb"})
+        {
+            auto &ChannelTemplates = Templates[Channel];
+            ChannelTemplates.resize(TemplateCells * TemplateCells);
+            for (Int_t Cell = 0; Cell < TemplateCells * TemplateCells; Cell++)
+            {
+                const auto *Histogram = dynamic_cast<TH1D *>(TemplateFile->Get(
+                    Form("%s_template_%d_%d", Channel.c_str(), Cell / TemplateCells, Cell % TemplateCells)));
+                if (!Histogram)
+                {
+                    continue;
+                }
+                for (Int_t k = 1; k <= Histogram->GetNbinsX(); k++)
+                {
+                    ChannelTemplates[Cell].push_back(Histogram->GetBinContent(k));
+                }
+            }
+        }
+
+        TemplateFile->Close();
+        delete TemplateFile;
+    }
+
+public:
+    // Loads once, also when the first lookups come from several fit workers at the same time
+    void Initialize()
+    {
+        std::call_once(Initialized, [this] { Load(); });
+    }
+
+    const std::vector<Double_t> *GetTemplate(const std::string &Channel, const Double_t X, const Double_t Y)
+    {
+        Initialize();
+
+        const Int_t Cell = TemplateCell(X, Y);
+        const auto ChannelIter = Templates.find(Channel);
+        if (Cell < 0 || ChannelIter == Templates.end() || ChannelIter->second[Cell].empty())
+        {
+            return nullptr;
+        }
+        return &ChannelIter->second[Cell];
+    }
+};
+
+// Create a global instance
+PulseTemplateManager PulseTemplates;
+
+const std::vector<Double_t> *GetPulseTemplate(const std::string &Channel, const Double_t PosX, const Double_t PosY)
+{
+    return PulseTemplates.GetTemplate(Channel, PosX, PosY);
+}
+
+/**
+ * Amplitude, onset and baseline by template least squares. The template is slid over a few
+ * integer shifts around the peak-aligned position; at each, y = Baseline + Amplitude * Template
+ * has a closed-form solution from four dot products. The onset of the best shift is refined
+ * by a parabola through the neighbouring residuals
+ * @param Samples Trace samples
+ * @param SampleCount Number of samples
+ * @param Statistics Seed statistics of the trace
+ * @param Template Template for the channel and position, from BuildPulseTemplates
+ * @return Amplitude, PeakPosition (onset) and Baseline, nullopt if the template does not fit in the trace
+ */
+std::optional<AnalysisResults::ChannelFit> MatchPulseTemplate(const Double_t *Samples, const Int_t SampleCount,
+                                                              const TraceStatistics &Statistics,
+                                                              const std::vector<Double_t> &Template)
+{
+    const auto Length = static_cast<Int_t>(Template.size());
+    if (Statistics.MaxIndex < 0 || Length == 0)
+    {
+        return std::nullopt;
+    }
+
+    Double_t SumT = 0;
+    Double_t SumTT = 0;
+    for (const Double_t T: Template)
+    {
+        SumT += T;
+        SumTT += T * T;
+    }
+    const Double_t Determinant = Length * SumTT - SumT * SumT;
+    if (Determinant <= 0)
+    {
+        return std::nullopt;
+    }
+
+    const auto TemplatePeak = static_cast<Int_t>(std::max_element(Template.begin(), Template.end()) - Template.begin());
+    const Int_t CentralShift = Statistics.MaxIndex - TemplatePeak;
+
+    constexpr Int_t Shifts = 2 * TemplateSearchShifts + 1;
+    Double_t Residuals[Shifts];
+    Double_t Amplitudes[Shifts];
+    Double_t Baselines[Shifts];
+    Int_t Best = -1;
+
+    for (Int_t s = 0; s < Shifts; s++)
+    {
+        const Int_t Shift = CentralShift - TemplateSearchShifts + s;
+        Residuals[s] = -1;
+        if (Shift < 0 || Shift + Length > SampleCount)
+        {
+            continue;
+        }
+
+        Double_t SumY = 0;
+        Double_t SumYY = 0;
+        Double_t SumYT = 0;
+        const Double_t *Window = Samples + Shift;
+        for (Int_t k = 0; k < Length; k++)
+        {
+            SumY += Window[k];
+            SumYY += Window[k] * Window[k];
+            SumYT += Window[k] * Template[k];
+        }
+
+        Amplitudes[s] = (Length * SumYT - SumT * SumY) / Determinant;
+        Baselines[s] = (SumY - Amplitudes[s] * SumT) / Length;
+        Residuals[s] = SumYY - Amplitudes[s] * SumYT - Baselines[s] * SumY;
+
+        if (Best < 0 || Residuals[s] < Residuals[Best])
+        {
+            Best = s;
+        }
+    }
+
+    if (Best < 0)
+    {
+        return std::nullopt;
+    }
+
+    Double_t Offset = 0;
+    if (Best > 0 && Best < Shifts - 1 && Residuals[Best - 1] >= 0 && Residuals[Best + 1] >= 0)
+    {
+        const Double_t Curvature = Residuals[Best - 1] - 2 * Residuals[Best] + Residuals[Best + 1];
+        if (Curvature > 0)
+        {
+            Offset = TMath::Max(-0.5, TMath::Min(0.5, 0.5 * (Residuals[Best - 1] - Residuals[Best + 1]) / Curvature));
+        }
+    }
+
+    AnalysisResults::ChannelFit Fit;
+    Fit.Amplitude = Amplitudes[Best];
+    Fit.PeakPosition = CentralShift - TemplateSearchShifts + Best + Offset + TemplatePreSamples;
+    Fit.Baseline = Baselines[Best];
+    Fit.Telemetry.Chi2 = Statistics.BaselineRMS > 0
+                             ? Residuals[Best] / (Statistics.BaselineRMS * Statistics.BaselineRMS)
+                             : -1;
+    Fit.Telemetry.Ndf = Length - 3;
+    return Fit;
+}
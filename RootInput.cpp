@@ -1,10 +1,26 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
 #include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <regex>
 
 #include <TFile.h>
+#include <TMD5.h>
+#include <TTreeCache.h>
+#include <TTreePerfStats.h>
 #include <TTreeReader.h>
+#include <TTreeReaderArray.h>
+#include <TTreeReaderValue.h>
 #include <TSystem.h>
 
+#include "PaassRootStruct.hpp"
+
 #include "main.h"
 
 /**
@@ -30,17 +46,289 @@ void LoadRequiredLibraries()
     }
 }
 
+// Raw trace files on the network mount
+constexpr const char *InputDirectory = "/mnt/Scratch1/ribf168rootfiles/pixie_bigrips_merged/";
+
 /**
- * Opens a ROOT file and returns the file pointer
- * @param FileName Path to the ROOT file
+ * Local copies of the input files under a byte budget. A file is copied on its first open,
+ * with its MD5 computed while streaming and checked against a re-read of the copy, and stored with
+ * the checksum next to it. Later opens use the copy while its size still matches the source.
+ * Least recently used copies are evicted to make room, the modification time of a copy is its last use.
+ * Opens from the subrun prefetch threads stage ahead of the event loop
+ */
+class InputStagingCache
+{
+private:
+    StagingCachePolicy Policy;
+    std::mutex Mutex;
+    Long64_t ReservedBytes = 0; // Copies in progress
+    Long64_t Hits = 0;
+    Long64_t Misses = 0;
+    Long64_t Failures = 0;
+    Long64_t BytesSaved = 0;
+    Long64_t BytesStaged = 0;
+    Long64_t Evictions = 0;
+
+    static constexpr size_t CopyChunkBytes = 8 << 20;
+
+    struct StagedFile
+    {
+        std::string Path;
+        Long64_t Size = 0;
+        Long_t LastUse = 0;
+    };
+
+    static std::string FileChecksum(const std::string &Path)
+    {
+        std::ifstream Input(Path, std::ios::binary);
+        if (!Input)
+        {
+            return "";
+        }
+        TMD5 Checksum;
+        std::vector<char> Buffer(CopyChunkBytes);
+        while (Input.read(Buffer.data(), static_cast<std::streamsize>(Buffer.size())) || Input.gcount() > 0)
+        {
+            Checksum.Update(reinterpret_cast<const UChar_t *>(Buffer.data()), static_cast<UInt_t>(Input.gcount()));
+        }
+        Checksum.Final();
+        return Checksum.AsString();
+    }
+
+    static std::string StoredChecksum(const std::string &LocalPath)
+    {
+        std::ifstream Input(LocalPath + ".md5");
+        std::string Checksum;
+        Input >> Checksum;
+        return Checksum;
+    }
+
+    std::vector<StagedFile> ListStagedFiles() const
+    {
+        std::vector<StagedFile> Files;
+        void *Directory = gSystem->OpenDirectory(Policy.Directory.c_str());
+        if (!Directory)
+        {
+            return Files;
+        }
+        while (const char *Entry = gSystem->GetDirEntry(Directory))
+        {
+            const std::string Name = Entry;
+            if (Name.size() < 5 || Name.compare(Name.size() - 5, 5, ".root") != 0)
+            {
+                continue;
+            }
+            StagedFile File;
+            File.Path = Policy.Directory + "/" + Name;
+            FileStat_t Status;
+            if (gSystem->GetPathInfo(File.Path.c_str(), Status) == 0)
+            {
+                File.Size = Status.fSize;
+                File.LastUse = Status.fMtime;
+                Files.push_back(File);
+            }
+        }
+        gSystem->FreeDirectory(Directory);
+        return Files;
+    }
+
+    // Called with Mutex held, false if Bytes cannot fit even with every other copy evicted
+    Bool_t MakeRoom(const Long64_t Bytes, const std::string &Keep)
+    {
+        auto Files = ListStagedFiles();
+        Long64_t Used = ReservedBytes;
+        for (const auto &File: Files)
+        {
+            Used += File.Size;
+        }
+
+        std::sort(Files.begin(), Files.end(), [](const StagedFile &A, const StagedFile &B)
+        {
+            return A.LastUse < B.LastUse;
+        });
+        for (const auto &File: Files)
+        {
+            if (Used + Bytes <= Policy.ByteBudget)
+            {
+                break;
+            }
+            if (File.Path == Keep)
+            {
+                continue;
+            }
+            // Still readable by a process that has it open, the space is freed when it closes
+            gSystem->Unlink(File.Path.c_str());
+            gSystem->Unlink((File.Path + ".md5").c_str());
+            Used -= File.Size;
+            Evictions++;
+        }
+        return Used + Bytes <= Policy.ByteBudget;
+    }
+
+    Bool_t Copy(const std::string &SourcePath, const std::string &LocalPath, const Long64_t Size)
+    {
+        // Per process, workers of a process pool may stage the same file at once
+        const std::string TemporaryPath = LocalPath + "." + std::to_string(gSystem->GetPid()) + ".part";
+        std::ifstream Input(SourcePath, std::ios::binary);
+        std::ofstream Output(TemporaryPath, std::ios::binary | std::ios::trunc);
+        if (!Input || !Output)
+        {
+            return false;
+        }
+
+        TMD5 Checksum;
+        std::vector<char> Buffer(CopyChunkBytes);
+        Long64_t Copied = 0;
+        while (Input.read(Buffer.data(), static_cast<std::streamsize>(Buffer.size())) || Input.gcount() > 0)
+        {
+            Checksum.Update(reinterpret_cast<const UChar_t *>(Buffer.data()), static_cast<UInt_t>(Input.gcount()));
+            Output.write(Buffer.data(), Input.gcount());
+            Copied += Input.gcount();
+        }
+        Checksum.Final();
+        Output.close();
+
+        const std::string SourceChecksum = Checksum.AsString();
+        if (!Output || Copied != Size || FileChecksum(TemporaryPath) != SourceChecksum)
+        {
+            gSystem->Unlink(TemporaryPath.c_str());
+            return false;
+        }
+
+        const std::string TemporaryChecksumPath = TemporaryPath + ".md5";
+        std::ofstream(TemporaryChecksumPath) << SourceChecksum << std::endl;
+        if (gSystem->Rename(TemporaryChecksumPath.c_str(), (LocalPath + ".md5").c_str()) != 0)
+        {
+            gSystem->Unlink(TemporaryChecksumPath.c_str());
+            gSystem->Unlink(TemporaryPath.c_str());
+            return false;
+        }
+        return gSystem->Rename(TemporaryPath.c_str(), LocalPath.c_str()) == 0;
+    }
+
+public:
+    void SetPolicy(const StagingCachePolicy &NewPolicy)
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Policy = NewPolicy;
+        if (Policy.Enabled && gSystem->mkdir(Policy.Directory.c_str(), kTRUE) != 0 &&
+            gSystem->AccessPathName(Policy.Directory.c_str()))
+        {
+            throw std::runtime_error("Failed to create staging directory: " + Policy.Directory);
+        }
+    }
+
+    std::string Resolve(const std::string &SourcePath, const std::string &FileName)
+    {
+        std::unique_lock<std::mutex> Lock(Mutex);
+        if (!Policy.Enabled)
+        {
+            return SourcePath;
+        }
+
+        FileStat_t Source;
+        if (gSystem->GetPathInfo(SourcePath.c_str(), Source) != 0)
+        {
+            return SourcePath;
+        }
+
+        const std::string LocalPath = Policy.Directory + "/" + FileName;
+        FileStat_t Local;
+        if (gSystem->GetPathInfo(LocalPath.c_str(), Local) == 0 && Local.fSize == Source.fSize &&
+            Local.fMtime >= Source.fMtime &&
+            (!Policy.VerifyOnHit || FileChecksum(LocalPath) == StoredChecksum(LocalPath)))
+        {
+            const auto Now = static_cast<Long_t>(std::time(nullptr));
+            gSystem->Utime(LocalPath.c_str(), Now, Now);
+            Hits++;
+            BytesSaved += Source.fSize;
+            return LocalPath;
+        }
+
+        Misses++;
+        if (!MakeRoom(Source.fSize, LocalPath))
+        {
+            std::cerr << "[Staging] " << FileName << " does not fit the " << Policy.ByteBudget
+                    << " byte budget, reading it from the mount" << std::endl;
+            return SourcePath;
+        }
+
+        // Copy without the lock, other threads may stage or open their own files meanwhile
+        ReservedBytes += Source.fSize;
+        Lock.unlock();
+        const Bool_t Copied = Copy(SourcePath, LocalPath, Source.fSize);
+        Lock.lock();
+        ReservedBytes -= Source.fSize;
+
+        if (!Copied)
+        {
+            Failures++;
+            std::cerr << "[Staging] Copy or checksum of " << FileName << " failed, reading it from the mount"
+                    << std::endl;
+            return SourcePath;
+        }
+        BytesStaged += Source.fSize;
+        return LocalPath;
+    }
+
+    void PrintSummary(const char *Batch)
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        if (!Policy.Enabled)
+        {
+            return;
+        }
+
+        const Long64_t Opens = Hits + Misses;
+        std::cout << "[Staging] " << Batch << ": " << Hits << " hits, " << Misses << " misses"
+                << " (hit rate " << std::fixed << std::setprecision(1)
+                << (Opens > 0 ? 100.0 * static_cast<Double_t>(Hits) / static_cast<Double_t>(Opens) : 0.0)
+                << "%), " << std::setprecision(2) << static_cast<Double_t>(BytesSaved) / 1e9 << " GB saved, "
+                << static_cast<Double_t>(BytesStaged) / 1e9 << " GB staged, " << Evictions << " evicted, "
+                << Failures << " failed" << std::defaultfloat << std::endl;
+
+        Hits = 0;
+        Misses = 0;
+        Failures = 0;
+        BytesSaved = 0;
+        BytesStaged = 0;
+        Evictions = 0;
+    }
+};
+
+// Create a global instance
+InputStagingCache StagingCache;
+
+/**
+ * Enables or reconfigures the local staging of input files used by OpenRootFile
+ * @param Policy Staging directory and byte budget
+ * @throws runtime_error if the staging directory cannot be created
+ */
+void SetStagingCachePolicy(const StagingCachePolicy &Policy)
+{
+    StagingCache.SetPolicy(Policy);
+}
+
+/**
+ * Prints and resets the staging hit rate and bytes saved since the last summary
+ * @param Batch Label of the batch, e.g. the run list
+ */
+void PrintStagingCacheSummary(const char *Batch)
+{
+    StagingCache.PrintSummary(Batch);
+}
+
+/**
+ * Opens a raw trace file, from its local staged copy when staging is enabled
+ * @param FileName Name of the ROOT file in the input directory
  * @return Pointer to the opened TFile
  * @throws runtime_error if file cannot be opened
  */
 TFile* OpenRootFile(const char* FileName)
 {
     // /home/aaugustyn/data/FileName
-    auto* path = "/mnt/Scratch1/ribf168rootfiles/pixie_bigrips_merged/";
-    TFile* InputFile = TFile::Open((std::string(path) + FileName).c_str());
+    const std::string Path = StagingCache.Resolve(std::string(InputDirectory) + FileName, FileName);
+    TFile* InputFile = TFile::Open(Path.c_str());
 
     if (!InputFile || InputFile->IsZombie())
     {
@@ -50,8 +338,29 @@ TFile* OpenRootFile(const char* FileName)
     return InputFile;
 }
 
+// TTreeCache configuration GetTree applies, set before any subrun is opened
+TreeCachePolicy CachePolicy;
+
+/**
+ * Sets the TTreeCache configuration of trees opened through GetTree and whether read stages are reported
+ * @param Policy Cache size, learning entries and branches added up front
+ */
+void SetTreeCachePolicy(const TreeCachePolicy &Policy)
+{
+    CachePolicy = Policy;
+}
+
+/**
+ * TTreeCache configuration of trees opened through GetTree
+ */
+const TreeCachePolicy &GetTreeCachePolicy()
+{
+    return CachePolicy;
+}
+
 /**
- * Retrieves a tree from an open ROOT file
+ * Retrieves a tree from an open ROOT file and configures its TTreeCache from the cache policy.
+ * Policy branches the tree does not have are skipped
  * @param InputFile Pointer to the open ROOT file
  * @param TreeName Name of the tree to retrieve
  * @return Pointer to the retrieved TTree
@@ -71,9 +380,115 @@ TTree* GetTree(TFile* InputFile, const char* TreeName)
         throw std::runtime_error("Failed to retrieve tree: " + std::string(TreeName));
     }
 
+    if (CachePolicy.CacheBytes >= 0)
+    {
+        Tree->SetCacheSize(CachePolicy.CacheBytes);
+    }
+    if (CachePolicy.CacheBytes != 0)
+    {
+        Tree->SetCacheLearnEntries(CachePolicy.LearnEntries);
+        for (const auto& Branch : CachePolicy.Branches)
+        {
+            if (Tree->GetBranch(Branch.c_str()))
+            {
+                Tree->AddBranchToCache(Branch.c_str(), true);
+            }
+        }
+    }
+
     return Tree;
 }
 
+/**
+ * Starts measuring the reads of one stage against a tree, a no-op unless the cache policy reports reads.
+ * Attaches a TTreePerfStats for the decompression time, only one stage per tree may be open
+ * @param Tree Tree the stage reads
+ * @return Counters at the start of the stage, pass to EndTreeReads
+ */
+TreeReadStage BeginTreeReads(TTree* Tree)
+{
+    TreeReadStage Stage;
+    if (!CachePolicy.ReportReads || !Tree || !Tree->GetCurrentFile())
+    {
+        return Stage;
+    }
+
+    TFile* File = Tree->GetCurrentFile();
+    Stage.PerfStats = new TTreePerfStats("stage_reads", Tree);
+    Stage.BytesRead = File->GetBytesRead();
+    Stage.ReadCalls = File->GetReadCalls();
+    if (const TFileCacheRead* Cache = File->GetCacheRead(Tree))
+    {
+        Stage.CachedBytes = Cache->GetBytesRead();
+        Stage.UncachedBytes = Cache->GetNoCacheBytesRead();
+    }
+    Stage.Start = std::chrono::steady_clock::now();
+    return Stage;
+}
+
+/**
+ * Ends a read stage started with BeginTreeReads and detaches its TTreePerfStats
+ * @param Tree Tree the stage read
+ * @param Stage Counters from BeginTreeReads
+ * @return Reads of the stage, all zero if it was not measured
+ */
+TreeReadStats EndTreeReads(TTree* Tree, TreeReadStage& Stage)
+{
+    TreeReadStats Stats;
+    if (!Stage.PerfStats)
+    {
+        return Stats;
+    }
+
+    TFile* File = Tree->GetCurrentFile();
+    Stats.BytesRead = File->GetBytesRead() - Stage.BytesRead;
+    Stats.ReadCalls = File->GetReadCalls() - Stage.ReadCalls;
+    // The cache may only have been created by the first read of the stage
+    if (const TFileCacheRead* Cache = File->GetCacheRead(Tree))
+    {
+        Stats.CachedBytes = Cache->GetBytesRead() - Stage.CachedBytes;
+        Stats.UncachedBytes = Cache->GetNoCacheBytesRead() - Stage.UncachedBytes;
+    }
+    Stats.UnzipSeconds = Stage.PerfStats->GetUnzipTime();
+    Stats.WallSeconds = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - Stage.Start).count();
+
+    Tree->SetPerfStats(nullptr);
+    delete Stage.PerfStats;
+    Stage.PerfStats = nullptr;
+    return Stats;
+}
+
+/**
+ * Prints the reads of each stage of a subrun, a no-op unless the cache policy reports reads
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ * @param Stages Stage names with their reads, in processing order
+ */
+void PrintTreeReadSummary(const Int_t RunNumber, const Int_t SubRunNumber,
+                          const std::vector<std::pair<std::string, TreeReadStats> >& Stages)
+{
+    if (!CachePolicy.ReportReads)
+    {
+        return;
+    }
+
+    std::cout << "[TreeReads] Run " << std::setfill('0') << std::setw(3) << RunNumber
+            << "_" << std::setfill('0') << std::setw(2) << SubRunNumber << ":" << std::endl;
+    std::cout << std::setfill(' ') << std::fixed;
+    for (const auto& [Name, Stats] : Stages)
+    {
+        const Long64_t CacheReads = Stats.CachedBytes + Stats.UncachedBytes;
+        std::cout << "  " << std::left << std::setw(12) << Name << std::right
+                << std::setprecision(1) << std::setw(10) << static_cast<Double_t>(Stats.BytesRead) / 1e6 << " MB"
+                << std::setw(9) << Stats.ReadCalls << " calls"
+                << "  cache hits " << std::setw(5)
+                << (CacheReads > 0 ? 100.0 * static_cast<Double_t>(Stats.CachedBytes) / static_cast<Double_t>(CacheReads) : 0.0)
+                << "%  unzip " << std::setprecision(2) << std::setw(7) << Stats.UnzipSeconds << " s"
+                << "  wall " << std::setw(7) << Stats.WallSeconds << " s" << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
 /**
  * Extracts run numbers from a ROOT file name
  * Expected format: pixie_bigrips_traces_XXX_YY.root
@@ -143,4 +558,259 @@ std::string CreateTraceDirectory(const std::pair<Int_t, Int_t>& RunNumbers)
     }
 
     return DirectoryName.str();
-}
\ No newline at end of file
+}
+/**
+ * Tag telling tree objects apart for the per-thread reader caches. A tree later created at the
+ * address of a deleted one is untagged, so a cache keyed by address and tag never reuses the
+ * readers of a deleted tree
+ * @param Tree Tree, tagged on the first call
+ * @return Non-zero tag of the tree
+ */
+UInt_t GetTreeTag(TTree *Tree)
+{
+    static std::atomic<UInt_t> NextTag{1};
+    if (Tree->GetUniqueID() == 0)
+    {
+        Tree->SetUniqueID(NextTag++);
+    }
+    return Tree->GetUniqueID();
+}
+
+// Reader of the rootdev_vec_ branches of one tree, kept across entries so only SetEntry runs per entry.
+// Arrays read their branch only when accessed, so entries read without traces never load the traces
+struct RootDevReader
+{
+    TTree *Tree = nullptr;
+    UInt_t Tag = 0;
+    TTreeReader Reader;
+    std::optional<TTreeReaderArray<processor_struct::ROOTDEV> > Objects; // Trees without split rootdev_vec_
+    std::optional<TTreeReaderArray<std::string> > Subtypes;
+    std::optional<TTreeReaderArray<Int_t> > ChannelNumbers;
+    std::optional<TTreeReaderArray<Bool_t> > ValidTiming;
+    std::optional<TTreeReaderArray<Bool_t> > ValidWaveform;
+    std::optional<TTreeReaderArray<std::vector<UInt_t> > > Traces;
+
+    explicit RootDevReader(TTree *TreeInput)
+        : Tree(TreeInput), Tag(GetTreeTag(TreeInput))
+    {
+        Reader.SetTree(TreeInput);
+        if (!TreeInput->GetBranch("rootdev_vec_.chanNum"))
+        {
+            Objects.emplace(Reader, "rootdev_vec_");
+            return;
+        }
+
+        Subtypes.emplace(Reader, "rootdev_vec_.subtype");
+        ChannelNumbers.emplace(Reader, "rootdev_vec_.chanNum");
+        ValidTiming.emplace(Reader, "rootdev_vec_.hasValidTimingAnalysis");
+        ValidWaveform.emplace(Reader, "rootdev_vec_.hasValidWaveformAnalysis");
+        Traces.emplace(Reader, "rootdev_vec_.trace");
+    }
+};
+
+// Reader of the high gain position of one tree, kept across the entries ReadPositions reads
+struct PositionReader
+{
+    TTree *Tree = nullptr;
+    UInt_t Tag = 0;
+    TTreeReader Reader;
+    std::optional<TTreeReaderValue<Double_t> > PosX;
+    std::optional<TTreeReaderValue<Double_t> > PosY;
+
+    explicit PositionReader(TTree *TreeInput)
+        : Tree(TreeInput), Tag(GetTreeTag(TreeInput))
+    {
+        const auto [PosXBranch, PosYBranch] = GetPositionBranches(TreeInput);
+        Reader.SetTree(TreeInput);
+        PosX.emplace(Reader, PosXBranch);
+        PosY.emplace(Reader, PosYBranch);
+    }
+};
+
+// Readers of the last tree read on each thread, they must go before that tree is deleted
+thread_local std::unique_ptr<RootDevReader> CachedRootDevReader;
+thread_local std::unique_ptr<PositionReader> CachedPositionReader;
+
+/**
+ * Drops the readers ReadRootDevices and ReadPositions keep on the calling thread. A reader
+ * unlinks itself from its tree when destroyed, so this must run before the tree is deleted,
+ * see CloseRootFile
+ */
+void ReleaseTreeReaders()
+{
+    CachedRootDevReader.reset();
+    CachedPositionReader.reset();
+}
+
+/**
+ * Closes and deletes an input file after releasing the tree readers of the calling thread
+ * @param InputFile File from OpenRootFile or OpenSkimFile, may be null
+ */
+void CloseRootFile(TFile *InputFile)
+{
+    ReleaseTreeReaders();
+    if (!InputFile)
+    {
+        return;
+    }
+    InputFile->Close();
+    delete InputFile;
+}
+
+/**
+ * Reads the high gain position of one entry, pos_x/pos_y for a skim. The reader is kept per
+ * thread for the last tree read, like the one of ReadRootDevices
+ * @param TreeInput Raw pspmt tree or skim
+ * @param Entry Entry number
+ * @param PosX Receives the x position
+ * @param PosY Receives the y position
+ * @return False if the entry could not be read
+ */
+Bool_t ReadPositions(TTree *TreeInput, const Long64_t Entry, Double_t &PosX, Double_t &PosY)
+{
+    auto &Cached = CachedPositionReader;
+    if (!Cached || Cached->Tree != TreeInput || Cached->Tag != TreeInput->GetUniqueID())
+    {
+        Cached.reset();
+        Cached = std::make_unique<PositionReader>(TreeInput);
+    }
+    if (Cached->Reader.SetEntry(Entry) != TTreeReader::kEntryValid)
+    {
+        return false;
+    }
+    PosX = **Cached->PosX;
+    PosY = **Cached->PosY;
+    return true;
+}
+
+/**
+ * Reads the devices of one entry from the split sub-branches of rootdev_vec_. Only trace, subtype,
+ * chanNum and the two validity flags are read, every other ROOTDEV member keeps its default value.
+ * Devices is resized rather than rebuilt, so its strings and traces keep their capacity across entries.
+ * Trees written without splitting rootdev_vec_ fall back to reading the whole objects, skims are
+ * decoded by ReadSkimDevices. The branch readers are kept per thread for the last tree read,
+ * release them with ReleaseTreeReaders or CloseRootFile before the tree is deleted
+ * @param TreeInput pspmt tree
+ * @param Entry Entry number
+ * @param Devices Decoded devices, reused across calls
+ * @param WithTraces Whether to read the traces, otherwise they are left empty
+ * @return False if the entry could not be read
+ */
+Bool_t ReadRootDevices(TTree *TreeInput, const Long64_t Entry, std::vector<processor_struct::ROOTDEV> &Devices,
+                       const Bool_t WithTraces)
+{
+    if (IsSkimTree(TreeInput))
+    {
+        return ReadSkimDevices(TreeInput, Entry, Devices, WithTraces);
+    }
+
+    // One cached reader per thread, rebuilt when the thread moves to another tree
+    auto &Cached = CachedRootDevReader;
+    if (!Cached || Cached->Tree != TreeInput || Cached->Tag != TreeInput->GetUniqueID())
+    {
+        Cached.reset();
+        Cached = std::make_unique<RootDevReader>(TreeInput);
+    }
+    RootDevReader &Reader = *Cached;
+
+    if (Reader.Reader.SetEntry(Entry) != TTreeReader::kEntryValid)
+    {
+        return false;
+    }
+
+    if (Reader.Objects)
+    {
+        Devices.resize(Reader.Objects->GetSize());
+        for (UInt_t DeviceIndex = 0; DeviceIndex < Reader.Objects->GetSize(); DeviceIndex++)
+        {
+            Devices[DeviceIndex] = Reader.Objects->At(DeviceIndex);
+        }
+        return true;
+    }
+
+    auto &Subtypes = *Reader.Subtypes;
+    auto &ChannelNumbers = *Reader.ChannelNumbers;
+    auto &ValidTiming = *Reader.ValidTiming;
+    auto &ValidWaveform = *Reader.ValidWaveform;
+    Devices.resize(ChannelNumbers.GetSize());
+    for (UInt_t DeviceIndex = 0; DeviceIndex < ChannelNumbers.GetSize(); DeviceIndex++)
+    {
+        auto &Device = Devices[DeviceIndex];
+        Device.subtype = Subtypes.At(DeviceIndex);
+        Device.chanNum = ChannelNumbers.At(DeviceIndex);
+        Device.hasValidTimingAnalysis = ValidTiming.At(DeviceIndex);
+        Device.hasValidWaveformAnalysis = ValidWaveform.At(DeviceIndex);
+        if (WithTraces)
+        {
+            const auto &Trace = Reader.Traces->At(DeviceIndex);
+            Device.trace.assign(Trace.begin(), Trace.end());
+        }
+        else
+        {
+            Device.trace.clear();
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads the first entries of a subrun once as whole ROOTDEV objects and once through ReadRootDevices,
+ * each pass on a freshly opened file, and prints the bytes read from the file and the time of each pass
+ * @param InputFileName Subrun trace file
+ * @param MaxEntries Number of entries to read
+ */
+void CompareRootDevReads(const char *InputFileName, const Long64_t MaxEntries)
+{
+    const auto Measure = [&](const Bool_t Partial)
+    {
+        TFile *InputFile = OpenRootFile(InputFileName);
+        TTree *Tree = GetTree(InputFile, "pspmt");
+        const Long64_t Entries = std::min(MaxEntries, Tree->GetEntries());
+        const Long64_t BytesBefore = InputFile->GetBytesRead();
+        const auto Start = std::chrono::steady_clock::now();
+
+        size_t Samples = 0;
+        if (Partial)
+        {
+            std::vector<processor_struct::ROOTDEV> Devices;
+            for (Long64_t Entry = 0; Entry < Entries; Entry++)
+            {
+                ReadRootDevices(Tree, Entry, Devices);
+                for (const auto &Device: Devices)
+                {
+                    Samples += Device.trace.size();
+                }
+            }
+        }
+        else
+        {
+            TTreeReader Reader(Tree);
+            TTreeReaderArray<processor_struct::ROOTDEV> RootDevVector(Reader, "rootdev_vec_");
+            for (Long64_t Entry = 0; Entry < Entries && Reader.Next(); Entry++)
+            {
+                for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.GetSize(); DeviceIndex++)
+                {
+                    Samples += RootDevVector.At(DeviceIndex).trace.size();
+                }
+            }
+        }
+
+        const Double_t Seconds = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - Start).count();
+        const Long64_t Bytes = InputFile->GetBytesRead() - BytesBefore;
+        CloseRootFile(InputFile);
+
+        std::cout << (Partial ? "Split members: " : "Whole objects: ") << Bytes / 1024 << " kB read, "
+                << std::fixed << std::setprecision(2) << Seconds << " s, " << Samples << " samples over "
+                << Entries << " entries" << std::defaultfloat << std::endl;
+        return Bytes;
+    };
+
+    const Long64_t WholeBytes = Measure(false);
+    const Long64_t PartialBytes = Measure(true);
+    if (WholeBytes > 0)
+    {
+        std::cout << "Split member reads use " << std::fixed << std::setprecision(1)
+                << 100.0 * static_cast<Double_t>(PartialBytes) / static_cast<Double_t>(WholeBytes)
+                << "% of the bytes" << std::defaultfloat << std::endl;
+    }
+}
@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <TEntryList.h>
+#include <TFile.h>
+#include <TString.h>
+#include <TSystem.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderArray.h>
+#include <TTreeReaderValue.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+// Elementary bins, a range query is the OR of the bins it covers, so windows are half-open
+// and only exact for bounds on bin edges
+constexpr Double_t BitmapQdcMin = 0;
+constexpr Double_t BitmapQdcMax = 100000;
+constexpr Int_t BitmapQdcBins = 100;
+constexpr Double_t BitmapPosMin = 0;
+constexpr Double_t BitmapPosMax = 1;
+constexpr Int_t BitmapPosBins = 100;
+
+// Run and literal limits of a marker word, see CompressBitmap
+constexpr ULong64_t MaxFillRun = (1ULL << 32) - 1;
+constexpr ULong64_t MaxLiteralRun = (1ULL << 31) - 1;
+
+/**
+ * Run-length compresses a bitmap of 64-bit words. The output is a sequence of marker words,
+ * each followed by its literal words: bit 0 is the fill value, bits 1-32 the number of all-zero
+ * or all-one words, bits 33-63 the number of literal words that follow the marker
+ * @param Words Uncompressed bitmap, bit i of word w is entry 64 * w + i
+ * @return Compressed words
+ */
+std::vector<ULong64_t> CompressBitmap(const std::vector<ULong64_t> &Words)
+{
+    std::vector<ULong64_t> Compressed;
+    size_t i = 0;
+    while (i < Words.size())
+    {
+        ULong64_t FillValue = 0;
+        ULong64_t FillRun = 0;
+        if (Words[i] == 0 || Words[i] == ~0ULL)
+        {
+            const ULong64_t FillWord = Words[i];
+            FillValue = FillWord ? 1 : 0;
+            while (i < Words.size() && Words[i] == FillWord && FillRun < MaxFillRun)
+            {
+                FillRun++;
+                i++;
+            }
+        }
+
+        const size_t LiteralStart = i;
+        while (i < Words.size() && Words[i] != 0 && Words[i] != ~0ULL && i - LiteralStart < MaxLiteralRun)
+        {
+            i++;
+        }
+
+        const ULong64_t LiteralRun = i - LiteralStart;
+        Compressed.push_back(FillValue | FillRun << 1 | LiteralRun << 33);
+        Compressed.insert(Compressed.end(), Words.begin() + static_cast<std::ptrdiff_t>(LiteralStart),
+                          Words.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+    return Compressed;
+}
+
+/**
+ * Expands a bitmap written by CompressBitmap
+ * @param Compressed Compressed words
+ * @param WordCount Number of words of the uncompressed bitmap
+ * @return Uncompressed bitmap, empty if the compressed stream does not match WordCount
+ */
+std::vector<ULong64_t> DecompressBitmap(const std::vector<ULong64_t> &Compressed, const size_t WordCount)
+{
+    std::vector<ULong64_t> Words;
+    Words.reserve(WordCount);
+    size_t i = 0;
+    while (i < Compressed.size())
+    {
+        const ULong64_t Marker = Compressed[i++];
+        const ULong64_t FillRun = Marker >> 1 & MaxFillRun;
+        const ULong64_t LiteralRun = Marker >> 33;
+        if (Words.size() + FillRun + LiteralRun > WordCount || i + LiteralRun > Compressed.size())
+        {
+            return {};
+        }
+
+        Words.insert(Words.end(), FillRun, Marker & 1 ? ~0ULL : 0ULL);
+        Words.insert(Words.end(), Compressed.begin() + static_cast<std::ptrdiff_t>(i),
+                     Compressed.begin() + static_cast<std::ptrdiff_t>(i + LiteralRun));
+        i += LiteralRun;
+    }
+    return Words.size() == WordCount ? Words : std::vector<ULong64_t>();
+}
+
+/**
+ * Bin of a value on a uniform axis, tolerant to rounding of values on a bin edge
+ * @return Bin index, -1 outside the axis
+ */
+Int_t BitmapBin(const Double_t Value, const Double_t Min, const Double_t Max, const Int_t Bins)
+{
+    const Double_t Position = (Value - Min) / (Max - Min) * Bins;
+    if (!(Position >= -1e-9) || Position >= Bins - 1e-9)
+    {
+        return -1;
+    }
+    return std::max(0, static_cast<Int_t>(std::floor(Position + 1e-9)));
+}
+
+/**
+ * Scans every entry of a subrun once and writes one compressed bitmap per elementary cut:
+ * high_gain_valid, low_gain_invalid, channel_<xa|xb|ya|yb|dynode> for channels with a valid
+ * trace, qdc_NNN, pos_x_NNN and pos_y_NNN bins. Combinations are then evaluated by
+ * SelectFromBitmaps without reading the trace file. Written under a per-process temporary name
+ * and renamed, so readers never see a partial file
+ * @param TreeInput pspmt tree of the subrun
+ * @param FileName Output file, holding the selection_bitmaps tree
+ */
+void BuildSelectionBitmaps(TTree *TreeInput, const char *FileName)
+{
+    if (!TreeInput)
+    {
+        throw std::runtime_error("Invalid tree pointer");
+    }
+
+    const Long64_t Entries = TreeInput->GetEntries();
+    const size_t WordCount = static_cast<size_t>((Entries + 63) / 64);
+
+    std::vector<std::string> Names = {
+        "high_gain_valid", "low_gain_invalid",
+        "channel_xa", "channel_xb", "channel_ya", "channel_yb", "channel_dynode"
+    };
+    const auto QdcFirst = static_cast<Int_t>(Names.size());
+    for (Int_t Bin = 0; Bin < BitmapQdcBins; Bin++)
+    {
+        Names.emplace_back(TString::Format("qdc_%03d", Bin).Data());
+    }
+    const auto PosXFirst = static_cast<Int_t>(Names.size());
+    for (Int_t Bin = 0; Bin < BitmapPosBins; Bin++)
+    {
+        Names.emplace_back(TString::Format("pos_x_%03d", Bin).Data());
+    }
+    const auto PosYFirst = static_cast<Int_t>(Names.size());
+    for (Int_t Bin = 0; Bin < BitmapPosBins; Bin++)
+    {
+        Names.emplace_back(TString::Format("pos_y_%03d", Bin).Data());
+    }
+
+    std::vector<std::vector<ULong64_t> > Bitmaps(Names.size(), std::vector<ULong64_t>(WordCount, 0));
+
+    // Bitmap of each anode channel number, named after its channel in AnodeChannelMap
+    std::map<Int_t, Int_t> AnodeBitmaps;
+    for (const auto &[ChannelNumber, Channel]: AnodeChannelMap)
+    {
+        const auto NameIter = std::find(Names.begin(), Names.end(), "channel_" + Channel.first);
+        AnodeBitmaps[ChannelNumber] = static_cast<Int_t>(NameIter - Names.begin());
+    }
+
+    TTreeReader Reader(TreeInput);
+    TTreeReaderValue<Int_t> HighGainValid(Reader, "high_gain_.valid_");
+    TTreeReaderValue<Int_t> LowGainValid(Reader, "low_gain_.valid_");
+    TTreeReaderValue<Double_t> HighGainQdc(Reader, "high_gain_.qdc_");
+    TTreeReaderValue<Double_t> PosX(Reader, "high_gain_.pos_x_");
+    TTreeReaderValue<Double_t> PosY(Reader, "high_gain_.pos_y_");
+    TTreeReaderArray<processor_struct::ROOTDEV> RootDevVector(Reader, "rootdev_vec_");
+
+    std::cout << "Building selection bitmaps over " << Entries << " events..." << std::endl;
+
+    for (Long64_t Entry = 0; Reader.Next(); Entry++)
+    {
+        const size_t Word = static_cast<size_t>(Entry / 64);
+        const ULong64_t Bit = 1ULL << (Entry % 64);
+        const auto Set = [&](const Int_t Index)
+        {
+            Bitmaps[Index][Word] |= Bit;
+        };
+
+        if (*HighGainValid == 1)
+        {
+            Set(0);
+        }
+        if (*LowGainValid == 0)
+        {
+            Set(1);
+        }
+
+        for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.GetSize(); DeviceIndex++)
+        {
+            const auto &Device = RootDevVector.At(DeviceIndex);
+            if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
+            {
+                continue;
+            }
+
+            if (Device.subtype == "dynode_high")
+            {
+                Set(6);
+            }
+            else if (const auto BitmapIter = AnodeBitmaps.find(Device.chanNum);
+                     Device.subtype == "anode_high" && BitmapIter != AnodeBitmaps.end())
+            {
+                Set(BitmapIter->second);
+            }
+        }
+
+        if (const Int_t Bin = BitmapBin(*HighGainQdc, BitmapQdcMin, BitmapQdcMax, BitmapQdcBins); Bin >= 0)
+        {
+            Set(QdcFirst + Bin);
+        }
+        if (const Int_t Bin = BitmapBin(*PosX, BitmapPosMin, BitmapPosMax, BitmapPosBins); Bin >= 0)
+        {
+            Set(PosXFirst + Bin);
+        }
+        if (const Int_t Bin = BitmapBin(*PosY, BitmapPosMin, BitmapPosMax, BitmapPosBins); Bin >= 0)
+        {
+            Set(PosYFirst + Bin);
+        }
+    }
+
+    const TString TemporaryName = TString::Format("%s.%d.tmp", FileName, gSystem->GetPid());
+    TFile OutputFile(TemporaryName.Data(), "RECREATE");
+    if (OutputFile.IsZombie())
+    {
+        throw std::runtime_error("Failed to create bitmap file: " + std::string(TemporaryName.Data()));
+    }
+
+    TTree BitmapTree("selection_bitmaps", "Compressed Per-Cut Selection Bitmaps");
+    std::string Name;
+    Long64_t EntryCount = Entries;
+    std::vector<ULong64_t> Compressed;
+    BitmapTree.Branch("name", &Name);
+    BitmapTree.Branch("entries", &EntryCount);
+    BitmapTree.Branch("words", &Compressed);
+
+    size_t CompressedWords = 0;
+    for (size_t i = 0; i < Names.size(); i++)
+    {
+        Name = Names[i];
+        Compressed = CompressBitmap(Bitmaps[i]);
+        CompressedWords += Compressed.size();
+        BitmapTree.Fill();
+    }
+    BitmapTree.Write();
+    OutputFile.Close();
+    if (gSystem->Rename(TemporaryName.Data(), FileName) != 0)
+    {
+        gSystem->Unlink(TemporaryName.Data());
+        throw std::runtime_error("Failed to write bitmap file: " + std::string(FileName));
+    }
+
+    std::cout << "Saved " << Names.size() << " bitmaps to " << FileName << " ("
+            << CompressedWords * sizeof(ULong64_t) / 1024 << " kB compressed, "
+            << Names.size() * WordCount * sizeof(ULong64_t) / 1024 << " kB raw)" << std::endl;
+}
+
+/**
+ * Names of the elementary bitmaps covering [Lower, Upper) of a binned variable.
+ * Bounds off a bin edge are widened to the enclosing edges, with a warning
+ * @param Variable qdc, pos_x or pos_y
+ * @param Lower Lower bound
+ * @param Upper Upper bound
+ * @return Bitmap names, OR them within one query clause
+ * @throws std::runtime_error for an unknown variable or a range leaving the binned axis
+ */
+std::vector<std::string> SelectionBitmapRange(const std::string &Variable, const Double_t Lower, const Double_t Upper)
+{
+    const Bool_t Qdc = Variable == "qdc";
+    if (!Qdc && Variable != "pos_x" && Variable != "pos_y")
+    {
+        throw std::runtime_error("No bitmaps for variable " + Variable);
+    }
+
+    const Double_t Min = Qdc ? BitmapQdcMin : BitmapPosMin;
+    const Double_t Max = Qdc ? BitmapQdcMax : BitmapPosMax;
+    const Int_t Bins = Qdc ? BitmapQdcBins : BitmapPosBins;
+    const Double_t Width = (Max - Min) / Bins;
+    if (Lower < Min || Upper > Max)
+    {
+        // Values off the axis have no bin, the query would drop them
+        throw std::runtime_error(TString::Format("Bitmap range %s [%g, %g) leaves the binned axis [%g, %g]",
+                                                 Variable.c_str(), Lower, Upper, Min, Max).Data());
+    }
+
+    const Double_t First = (Lower - Min) / Width;
+    const Double_t Last = (Upper - Min) / Width;
+    if (std::abs(First - std::round(First)) > 1e-6 || std::abs(Last - std::round(Last)) > 1e-6)
+    {
+        std::cerr << "Bitmap range " << Variable << " [" << Lower << ", " << Upper
+                << ") is not on bin edges, widened to multiples of " << Width << std::endl;
+    }
+
+    std::vector<std::string> Names;
+    for (Int_t Bin = std::max(0, static_cast<Int_t>(std::floor(First + 1e-6)));
+         Bin < std::min(Bins, static_cast<Int_t>(std::ceil(Last - 1e-6))); Bin++)
+    {
+        Names.emplace_back(TString::Format("%s_%03d", Variable.c_str(), Bin).Data());
+    }
+    return Names;
+}
+
+/**
+ * Evaluates a query on the bitmaps of a subrun, the trace file is not read
+ * @param FileName Bitmap file written by BuildSelectionBitmaps
+ * @param Query Clauses that are ANDed, each the OR of its bitmaps
+ * @param TreeInput Tree the entry list refers to, must have the entry count of the bitmaps
+ * @return Entry list of the selected events, owned by the caller
+ */
+TEntryList *SelectFromBitmaps(const char *FileName, const BitmapQuery &Query, TTree *TreeInput)
+{
+    // Written next to the analysis output, not with the raw traces
+    TFile *BitmapFile = TFile::Open(FileName, "READ");
+    if (!BitmapFile || BitmapFile->IsZombie())
+    {
+        throw std::runtime_error("Failed to open bitmap file: " + std::string(FileName));
+    }
+    TTree *BitmapTree = GetTree(BitmapFile, "selection_bitmaps");
+
+    std::set<std::string> Needed;
+    for (const auto &Clause: Query)
+    {
+        Needed.insert(Clause.begin(), Clause.end());
+    }
+
+    std::string *Name = nullptr;
+    Long64_t Entries = 0;
+    std::vector<ULong64_t> *Compressed = nullptr;
+    BitmapTree->SetBranchAddress("name", &Name);
+    BitmapTree->SetBranchAddress("entries", &Entries);
+    BitmapTree->SetBranchAddress("words", &Compressed);
+
+    std::map<std::string, std::vector<ULong64_t> > Bitmaps;
+    size_t WordCount = 0;
+    for (Long64_t i = 0; i < BitmapTree->GetEntries(); i++)
+    {
+        BitmapTree->GetEntry(i);
+        WordCount = static_cast<size_t>((Entries + 63) / 64);
+        if (Needed.count(*Name))
+        {
+            Bitmaps[*Name] = DecompressBitmap(*Compressed, WordCount);
+        }
+    }
+
+    // ROOT allocated the name and words on the first entry, the tree must not keep writing to the locals
+    BitmapTree->ResetBranchAddresses();
+    delete Name;
+    delete Compressed;
+    BitmapFile->Close();
+    delete BitmapFile;
+
+    if (TreeInput && TreeInput->GetEntries() != Entries)
+    {
+        throw std::runtime_error(std::string("Bitmaps in ") + FileName + " do not match the tree, rebuild them");
+    }
+
+    // All ones up to the last entry
+    std::vector<ULong64_t> Selected(WordCount, ~0ULL);
+    if (Entries % 64 != 0)
+    {
+        Selected.back() = (1ULL << (Entries % 64)) - 1;
+    }
+
+    std::vector<ULong64_t> Any(WordCount);
+    for (const auto &Clause: Query)
+    {
+        std::fill(Any.begin(), Any.end(), 0);
+        for (const auto &BitmapName: Clause)
+        {
+            const auto BitmapIter = Bitmaps.find(BitmapName);
+            if (BitmapIter == Bitmaps.end() || BitmapIter->second.size() != WordCount)
+            {
+                throw std::runtime_error("Missing or corrupt bitmap " + BitmapName + " in " + FileName);
+            }
+            for (size_t Word = 0; Word < WordCount; Word++)
+            {
+                Any[Word] |= BitmapIter->second[Word];
+            }
+        }
+        for (size_t Word = 0; Word < WordCount; Word++)
+        {
+            Selected[Word] &= Any[Word];
+        }
+    }
+
+    auto *EntryList = new TEntryList("bitmap_selection", "Events Selected from Bitmaps", TreeInput);
+    for (size_t Word = 0; Word < WordCount; Word++)
+    {
+        if (!Selected[Word])
+        {
+            continue;
+        }
+        for (Int_t Bit = 0; Bit < 64; Bit++)
+        {
+            if (Selected[Word] >> Bit & 1)
+            {
+                EntryList->Enter(static_cast<Long64_t>(Word) * 64 + Bit);
+            }
+        }
+    }
+    return EntryList;
+}
+
+/**
+ * Qualifying events of a subrun from its selection bitmaps, building them on first use
+ * @param TreeInput pspmt tree of the subrun
+ * @param FileName Bitmap file of the subrun
+ * @param Query Cut combination, see SelectFromBitmaps
+ * @return Selected entry numbers in increasing order
+ */
+std::vector<Long64_t> GetBitmapQualifyingEvents(TTree *TreeInput, const char *FileName, const BitmapQuery &Query)
+{
+    if (gSystem->AccessPathName(FileName))
+    {
+        BuildSelectionBitmaps(TreeInput, FileName);
+    }
+
+    TEntryList *EntryList = SelectFromBitmaps(FileName, Query, TreeInput);
+    std::vector<Long64_t> QualifyingEvents;
+    QualifyingEvents.reserve(static_cast<size_t>(EntryList->GetN()));
+    for (Long64_t i = 0; i < EntryList->GetN(); i++)
+    {
+        QualifyingEvents.push_back(EntryList->GetEntry(i));
+    }
+    delete EntryList;
+
+    std::cout << "Selected " << QualifyingEvents.size() << " events from " << FileName << std::endl;
+    return QualifyingEvents;
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <TFile.h>
+#include <TNamed.h>
+#include <TSystem.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderArray.h>
+#include <TTreeReaderValue.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+/**
+ * Skim slot of a device, -1 for devices the analysis does not use
+ * @param Device Decoded device
+ * @return Index into SkimSlotNames
+ */
+Int_t SkimSlot(const processor_struct::ROOTDEV &Device)
+{
+    if (Device.subtype == "dynode_high")
+    {
+        return SkimDynodeSlot;
+    }
+    const auto ChannelIter = AnodeChannelMap.find(Device.chanNum);
+    if (Device.subtype != "anode_high" || ChannelIter == AnodeChannelMap.end())
+    {
+        return -1;
+    }
+
+    // Anodes take the slot named after their channel, the slot order is part of the skim format
+    for (Int_t Slot = 0; Slot < SkimDynodeSlot; Slot++)
+    {
+        if (ChannelIter->second.first == SkimSlotNames[Slot])
+        {
+            return Slot;
+        }
+    }
+    return -1;
+}
+
+// Readable events GetTraceSlotWidth takes the slot width from
+constexpr Int_t TraceSlotWidthEvents = 1000;
+
+/**
+ * Slot width of a fixed-width skim or trace cache, the longest analysed trace among the first
+ * TraceSlotWidthEvents readable events. Longer traces further on are truncated by FillTraceSlots
+ * @param TreeInput Raw pspmt tree or skim
+ * @param QualifyingEvents Entries to be stored
+ * @return Samples per slot, 0 if no event could be read
+ */
+Int_t GetTraceSlotWidth(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents)
+{
+    std::vector<processor_struct::ROOTDEV> Devices;
+    Int_t TraceLength = 0;
+    Int_t ReadEvents = 0;
+    for (const Long64_t Entry: QualifyingEvents)
+    {
+        if (ReadEvents >= TraceSlotWidthEvents)
+        {
+            break;
+        }
+        if (!ReadRootDevices(TreeInput, Entry, Devices))
+        {
+            continue;
+        }
+
+        ReadEvents++;
+        for (const auto &Device: Devices)
+        {
+            if (SkimSlot(Device) >= 0)
+            {
+                TraceLength = std::max(TraceLength, static_cast<Int_t>(Device.trace.size()));
+            }
+        }
+    }
+    return TraceLength;
+}
+
+/**
+ * Fills the fixed-width slots of one event from its valid analysed devices. Traces longer than
+ * TraceLength are truncated and samples above the UShort_t range clipped, both counted in Losses
+ * @param Devices Devices of the event
+ * @param TraceLength Samples per slot
+ * @param Channels SkimSlots channel numbers, -1 for empty slots
+ * @param SampleCounts SkimSlots stored sample counts
+ * @param Samples SkimSlots x TraceLength samples, zero past each stored trace
+ * @param Losses Counts of truncated traces and clipped samples, accumulated
+ */
+void FillTraceSlots(const std::vector<processor_struct::ROOTDEV> &Devices, const Int_t TraceLength, Int_t *Channels,
+                    Int_t *SampleCounts, UShort_t *Samples, TraceSlotLosses &Losses)
+{
+    constexpr UInt_t MaxSample = std::numeric_limits<UShort_t>::max();
+
+    std::fill(Channels, Channels + SkimSlots, -1);
+    std::fill(SampleCounts, SampleCounts + SkimSlots, 0);
+    std::fill(Samples, Samples + static_cast<size_t>(SkimSlots) * TraceLength, 0);
+    for (const auto &Device: Devices)
+    {
+        const Int_t Slot = SkimSlot(Device);
+        if (Slot < 0 || !Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
+        {
+            continue;
+        }
+
+        const auto SampleCount = std::min(static_cast<Int_t>(Device.trace.size()), TraceLength);
+        Losses.TruncatedTraces += SampleCount < static_cast<Int_t>(Device.trace.size()) ? 1 : 0;
+        Channels[Slot] = Device.chanNum;
+        SampleCounts[Slot] = SampleCount;
+        UShort_t *SlotSamples = Samples + static_cast<size_t>(Slot) * TraceLength;
+        for (Int_t Sample = 0; Sample < SampleCount; Sample++)
+        {
+            const UInt_t Value = Device.trace[Sample];
+            Losses.ClippedSamples += Value > MaxSample ? 1 : 0;
+            SlotSamples[Sample] = static_cast<UShort_t>(std::min(Value, MaxSample));
+        }
+    }
+}
+
+/**
+ * Warns about trace data FillTraceSlots could not store
+ * @param Losses Counts over the written file
+ * @param TraceLength Samples per slot
+ * @param FileName Written file
+ */
+void PrintTraceSlotLosses(const TraceSlotLosses &Losses, const Int_t TraceLength, const char *FileName)
+{
+    if (Losses.TruncatedTraces > 0)
+    {
+        std::cerr << FileName << ": " << Losses.TruncatedTraces << " traces longer than " << TraceLength
+                << " samples were truncated" << std::endl;
+    }
+    if (Losses.ClippedSamples > 0)
+    {
+        std::cerr << FileName << ": " << Losses.ClippedSamples << " samples above "
+                << std::numeric_limits<UShort_t>::max() << " were clipped" << std::endl;
+    }
+}
+
+/**
+ * Whether a tree is a skim written by WriteSkim rather than a raw pspmt tree
+ * @param Tree Input tree
+ */
+Bool_t IsSkimTree(TTree *Tree)
+{
+    return Tree && (Tree->GetBranch("traces") || Tree->GetBranch("packed_traces")) && Tree->GetBranch("event_number");
+}
+
+/**
+ * Branches holding the high-gain position, pos_x/pos_y in a skim, high_gain_.pos_x_/pos_y_ otherwise
+ * @param Tree Input tree
+ * @return X and Y branch names
+ */
+std::pair<const char *, const char *> GetPositionBranches(TTree *Tree)
+{
+    return IsSkimTree(Tree)
+               ? std::make_pair("pos_x", "pos_y")
+               : std::make_pair("high_gain_.pos_x_", "high_gain_.pos_y_");
+}
+
+/**
+ * Entry number in the raw trace file, for a skim the stored event number
+ * @param Tree Input tree
+ * @param Entry Entry number in Tree
+ * @return Raw entry number, Entry for raw trees or unreadable skim entries
+ */
+Long64_t GetSourceEntry(TTree *Tree, const Long64_t Entry)
+{
+    if (!IsSkimTree(Tree))
+    {
+        return Entry;
+    }
+
+    TTreeReader Reader;
+    Reader.SetTree(Tree);
+    TTreeReaderValue<Long64_t> EventNumber(Reader, "event_number");
+    return Reader.SetEntry(Entry) == TTreeReader::kEntryValid ? *EventNumber : Entry;
+}
+
+/**
+ * Fills the next device of a skim entry from its slot, growing Devices as needed
+ * @param Devices Decoded devices, reused across calls
+ * @param DeviceCount Devices filled so far, incremented
+ * @param Slot Skim slot
+ * @param Channel Channel number stored for the slot
+ * @return The device, its trace is left for the caller
+ */
+processor_struct::ROOTDEV &NextSkimDevice(std::vector<processor_struct::ROOTDEV> &Devices, size_t &DeviceCount,
+                                          const Int_t Slot, const Int_t Channel)
+{
+    if (Devices.size() <= DeviceCount)
+    {
+        Devices.resize(DeviceCount + 1);
+    }
+    auto &Device = Devices[DeviceCount++];
+    Device.subtype = Slot == SkimDynodeSlot ? "dynode_high" : "anode_high";
+    Device.chanNum = Channel;
+    Device.hasValidTimingAnalysis = true;
+    Device.hasValidWaveformAnalysis = true;
+    return Device;
+}
+
+/**
+ * ReadSkimDevices for skims written with PackTraces, the non-empty slots are stored back to back
+ * in packed_traces in slot order and decoded straight into the device traces
+ */
+Bool_t ReadPackedSkimDevices(TTree *TreeInput, const Long64_t Entry,
+                             std::vector<processor_struct::ROOTDEV> &Devices, const Bool_t WithTraces)
+{
+    TTreeReader Reader;
+    Reader.SetTree(TreeInput);
+    TTreeReaderArray<Int_t> Channels(Reader, "channel");
+    TTreeReaderArray<Int_t> SampleCounts(Reader, "samples");
+    TTreeReaderValue<std::vector<UInt_t> > PackedTraces(Reader, "packed_traces");
+    if (Reader.SetEntry(Entry) != TTreeReader::kEntryValid || Channels.GetSize() != SkimSlots)
+    {
+        return false;
+    }
+
+    const UInt_t *Input = PackedTraces->data();
+    const UInt_t *InputEnd = Input + PackedTraces->size();
+    size_t DeviceCount = 0;
+    for (Int_t Slot = 0; Slot < SkimSlots; Slot++)
+    {
+        if (SampleCounts.At(Slot) == 0)
+        {
+            continue;
+        }
+
+        auto &Device = NextSkimDevice(Devices, DeviceCount, Slot, Channels.At(Slot));
+        if (WithTraces)
+        {
+            Input = DecodeTrace(Input, InputEnd, Device.trace);
+            if (!Input)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            Device.trace.clear();
+        }
+    }
+    Devices.resize(DeviceCount);
+    return true;
+}
+
+/**
+ * Decodes the trace slots of one skim entry into devices, the counterpart of the split
+ * member reads in ReadRootDevices. Only slots with samples produce a device, flagged valid
+ * @param TreeInput Skim tree
+ * @param Entry Entry number
+ * @param Devices Decoded devices, reused across calls
+ * @param WithTraces Whether to copy the samples
+ * @return False if the entry could not be read
+ */
+Bool_t ReadSkimDevices(TTree *TreeInput, const Long64_t Entry, std::vector<processor_struct::ROOTDEV> &Devices,
+                       const Bool_t WithTraces)
+{
+    if (TreeInput->GetBranch("packed_traces"))
+    {
+        return ReadPackedSkimDevices(TreeInput, Entry, Devices, WithTraces);
+    }
+
+    TTreeReader Reader;
+    Reader.SetTree(TreeInput);
+    TTreeReaderArray<Int_t> Channels(Reader, "channel");
+    TTreeReaderArray<Int_t> SampleCounts(Reader, "samples");
+    TTreeReaderArray<UShort_t> Traces(Reader, "traces");
+    if (Reader.SetEntry(Entry) != TTreeReader::kEntryValid || Channels.GetSize() != SkimSlots)
+    {
+        return false;
+    }
+
+    const size_t TraceLength = Traces.GetSize() / SkimSlots;
+    size_t DeviceCount = 0;
+    for (Int_t Slot = 0; Slot < SkimSlots; Slot++)
+    {
+        const auto SampleCount = static_cast<size_t>(SampleCounts.At(Slot));
+        if (SampleCount == 0)
+        {
+            continue;
+        }
+
+        auto &Device = NextSkimDevice(Devices, DeviceCount, Slot, Channels.At(Slot));
+        Device.trace.resize(WithTraces ? SampleCount : 0);
+        for (size_t Sample = 0; Sample < Device.trace.size(); Sample++)
+        {
+            Device.trace[Sample] = Traces.At(Slot * TraceLength + Sample);
+        }
+    }
+    Devices.resize(DeviceCount);
+    return true;
+}
+
+/**
+ * What a skim depends on besides its raw trace file: the compiled selection and the trace packing.
+ * Stored as the title of skim_fingerprint, OpenSkimFile rewrites skims whose fingerprint differs
+ * @param PackTraces Whether the traces are bit-packed
+ * @return Fingerprint text
+ */
+std::string SkimFingerprint(const Bool_t PackTraces)
+{
+    return GetSelectionFingerprint() + "packed_traces " + (PackTraces ? "1" : "0") + "\n";
+}
+
+/**
+ * Writes the qualifying events of a subrun into a compact skim: event number, position and the
+ * five analysed traces as fixed-size arrays, each slot tagged with its channel number.
+ * The array width and the UShort_t samples follow GetTraceSlotWidth and FillTraceSlots, which
+ * count the truncated traces and clipped samples.
+ * With PackTraces the traces are instead EncodeTrace'd at full length into one packed_traces vector
+ * per entry and the file is left uncompressed, the packed words barely compress and reading them
+ * back then costs only the decode. The skim is written under a temporary name and renamed, so a
+ * reader never opens a partial skim, and records its SkimFingerprint
+ * @param TreeInput Raw pspmt tree of the subrun
+ * @param QualifyingEvents Entries to keep
+ * @param FileName Skim file to write
+ * @param PackTraces Whether to bit-pack the traces
+ */
+void WriteSkim(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents, const char *FileName,
+               const Bool_t PackTraces)
+{
+    const auto [PosXBranch, PosYBranch] = GetPositionBranches(TreeInput);
+    TTreeReader Reader;
+    Reader.SetTree(TreeInput);
+    TTreeReaderValue<Double_t> HighGainPosX(Reader, PosXBranch);
+    TTreeReaderValue<Double_t> HighGainPosY(Reader, PosYBranch);
+
+    std::vector<processor_struct::ROOTDEV> Devices;
+    const Int_t TraceLength = PackTraces ? 0 : GetTraceSlotWidth(TreeInput, QualifyingEvents);
+
+    // Unique per process, subruns may be skimmed by several workers at once
+    const TString TemporaryName = TString::Format("%s.%d.tmp", FileName, gSystem->GetPid());
+    TFile OutputFile(TemporaryName.Data(), "RECREATE");
+    if (OutputFile.IsZombie())
+    {
+        throw std::runtime_error("Failed to create skim file: " + std::string(TemporaryName.Data()));
+    }
+    if (PackTraces)
+    {
+        OutputFile.SetCompressionLevel(0);
+    }
+
+    TTree SkimTree("skim", "Qualifying Events With Their Analysed Traces");
+    Long64_t EventNumber = 0;
+    Double_t PosX = 0;
+    Double_t PosY = 0;
+    Int_t Channels[SkimSlots] = {};
+    Int_t SampleCounts[SkimSlots] = {};
+    std::vector<UShort_t> Traces(static_cast<size_t>(SkimSlots * std::max(TraceLength, 1)));
+    SkimTree.Branch("event_number", &EventNumber, "event_number/L");
+    SkimTree.Branch("pos_x", &PosX, "pos_x/D");
+    SkimTree.Branch("pos_y", &PosY, "pos_y/D");
+    SkimTree.Branch("channel", Channels, TString::Format("channel[%d]/I", SkimSlots));
+    SkimTree.Branch("samples", SampleCounts, TString::Format("samples[%d]/I", SkimSlots));
+    std::vector<UInt_t> PackedTraces;
+    if (PackTraces)
+    {
+        SkimTree.Branch("packed_traces", &PackedTraces);
+    }
+    else
+    {
+        SkimTree.Branch("traces", Traces.data(),
+                        TString::Format("traces[%d][%d]/s", SkimSlots, std::max(TraceLength, 1)));
+    }
+
+    TraceSlotLosses Losses;
+    for (const Long64_t Entry: QualifyingEvents)
+    {
+        if (Reader.SetEntry(Entry) != TTreeReader::kEntryValid || !ReadRootDevices(TreeInput, Entry, Devices))
+        {
+            continue;
+        }
+
+        EventNumber = Entry;
+        PosX = *HighGainPosX;
+        PosY = *HighGainPosY;
+        if (!PackTraces)
+        {
+            FillTraceSlots(Devices, TraceLength, Channels, SampleCounts, Traces.data(), Losses);
+            SkimTree.Fill();
+            continue;
+        }
+
+        std::fill(std::begin(Channels), std::end(Channels), -1);
+        std::fill(std::begin(SampleCounts), std::end(SampleCounts), 0);
+        PackedTraces.clear();
+
+        const processor_struct::ROOTDEV *SlotDevices[SkimSlots] = {};
+        for (const auto &Device: Devices)
+        {
+            const Int_t Slot = SkimSlot(Device);
+            if (Slot < 0 || !Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
+            {
+                continue;
+            }
+            Channels[Slot] = Device.chanNum;
+            SampleCounts[Slot] = static_cast<Int_t>(Device.trace.size());
+            SlotDevices[Slot] = &Device;
+        }
+
+        // Slot order, so the reader can walk the packed words without an index
+        for (const auto *Device: SlotDevices)
+        {
+            if (Device && !Device->trace.empty())
+            {
+                EncodeTrace(Device->trace.data(), static_cast<Int_t>(Device->trace.size()), PackedTraces);
+            }
+        }
+        SkimTree.Fill();
+    }
+    SkimTree.Write();
+    TNamed("skim_fingerprint", SkimFingerprint(PackTraces).c_str()).Write();
+    OutputFile.Close();
+    if (gSystem->Rename(TemporaryName.Data(), FileName) != 0)
+    {
+        gSystem->Unlink(TemporaryName.Data());
+        throw std::runtime_error("Failed to write skim file: " + std::string(FileName));
+    }
+
+    if (PackTraces)
+    {
+        std::cout << "Saved " << QualifyingEvents.size() << " events with packed traces to " << FileName << std::endl;
+        return;
+    }
+    std::cout << "Saved " << QualifyingEvents.size() << " events with " << TraceLength
+            << "-sample traces to " << FileName << std::endl;
+    PrintTraceSlotLosses(Losses, TraceLength, FileName);
+}
+
+/**
+ * Fingerprint a skim file was written with
+ * @param FileName Skim file
+ * @return Stored SkimFingerprint, empty if the file cannot be read or predates the fingerprints
+ */
+std::string ReadSkimFingerprint(const char *FileName)
+{
+    std::unique_ptr<TFile> SkimFile(TFile::Open(FileName, "READ"));
+    if (!SkimFile || SkimFile->IsZombie())
+    {
+        return "";
+    }
+    std::unique_ptr<TNamed> Fingerprint(dynamic_cast<TNamed *>(SkimFile->Get("skim_fingerprint")));
+    return Fingerprint ? Fingerprint->GetTitle() : "";
+}
+
+/**
+ * Opens the skim of a subrun, writing it from the raw trace file on first use and rewriting it
+ * when it was written with another selection or trace packing
+ * @param InputFileName Raw trace file of the subrun
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ * @param PackTraces Whether a newly written skim bit-packs its traces, see WriteSkim
+ * @return Open skim file, its tree is "skim"
+ * @throws std::runtime_error if the raw file or the skim cannot be opened
+ */
+TFile *OpenSkimFile(const char *InputFileName, const Int_t RunNumber, const Int_t SubRunNumber,
+                    const Bool_t PackTraces)
+{
+    const TString SkimFileName = TString::Format("skim_%03d_%02d.root", RunNumber, SubRunNumber);
+    Bool_t Write = gSystem->AccessPathName(SkimFileName.Data());
+    if (!Write && ReadSkimFingerprint(SkimFileName.Data()) != SkimFingerprint(PackTraces))
+    {
+        std::cout << SkimFileName << " was written with another selection or trace packing, rewriting it"
+                << std::endl;
+        Write = true;
+    }
+    if (Write)
+    {
+        TFile *InputFile = OpenRootFile(InputFileName);
+        TTree *Tree = GetTree(InputFile, "pspmt");
+        WriteSkim(Tree, GetAllQualifyingEvents(Tree), SkimFileName.Data(), PackTraces);
+        CloseRootFile(InputFile);
+    }
+
+    TFile *SkimFile = TFile::Open(SkimFileName.Data(), "READ");
+    if (!SkimFile || SkimFile->IsZombie())
+    {
+        throw std::runtime_error("Failed to open skim file: " + std::string(SkimFileName.Data()));
+    }
+    return SkimFile;
+}
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <iostream>
+
+#include <TFile.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+// Qualifying events read ahead to pull the first clusters of the fitted branches into the cache
+constexpr size_t PrefetchWarmEvents = 100;
+
+/**
+ * Loads the subruns of a run list ahead of the event loop. Each subrun is opened, selected and its
+ * TTreeCache warmed on a background thread, up to Lookahead subruns in advance, so the handover
+ * to the next subrun only waits if its load is still running.
+ * The selection scan runs on a fork of the global pipeline, adopted at handover with its cut flow
+ */
+class SubRunPrefetcher
+{
+private:
+    SubRunLoader Loader;
+    std::vector<std::pair<Int_t, Int_t> > SubRuns;
+    size_t NextSubRun = 0;
+    Int_t Lookahead = 0;
+    std::deque<std::future<SubRunInput> > Pending;
+
+    static void WarmCache(SubRunInput &Input)
+    {
+        // Sized by GetTree from the cache policy
+        if (!Input.Tree || Input.QualifyingEvents.empty() || GetTreeCachePolicy().CacheBytes == 0)
+        {
+            return;
+        }
+
+        // Only the branches the fits read, the selection scan taught the cache the scalar cut branches
+        TreeReadStage Stage = BeginTreeReads(Input.Tree);
+        if (IsSkimTree(Input.Tree))
+        {
+            Input.Tree->AddBranchToCache("*", true);
+        }
+        else
+        {
+            const auto [PosXBranch, PosYBranch] = GetPositionBranches(Input.Tree);
+            Input.Tree->AddBranchToCache("rootdev_vec_", true);
+            Input.Tree->AddBranchToCache(PosXBranch, true);
+            Input.Tree->AddBranchToCache(PosYBranch, true);
+        }
+        Input.Tree->StopCacheLearningPhase();
+
+        static thread_local std::vector<processor_struct::ROOTDEV> RootDevVector;
+        const size_t WarmEvents = std::min(Input.QualifyingEvents.size(), PrefetchWarmEvents);
+        for (size_t i = 0; i < WarmEvents; i++)
+        {
+            ReadRootDevices(Input.Tree, Input.QualifyingEvents[i], RootDevVector);
+        }
+        Input.ReadStages.emplace_back("cache warm", EndTreeReads(Input.Tree, Stage));
+    }
+
+    static SubRunInput Load(const SubRunLoader &Loader, const Int_t RunNumber, const Int_t SubRunNumber,
+                            const std::shared_ptr<SelectionPipeline> &Pipeline)
+    {
+        SubRunInput Input;
+        Input.RunNumber = RunNumber;
+        Input.SubRunNumber = SubRunNumber;
+        Input.Selection = Pipeline;
+
+        UseThreadSelection(Pipeline);
+        try
+        {
+            BeginSelectionSubRun();
+            Loader(Input);
+            WarmCache(Input);
+        }
+        catch (...)
+        {
+            UseThreadSelection(nullptr);
+            CloseRootFile(Input.File);
+            throw;
+        }
+        UseThreadSelection(nullptr);
+        // The tree is handed over and deleted elsewhere, the readers of this thread go now
+        ReleaseTreeReaders();
+        return Input;
+    }
+
+    void Launch()
+    {
+        const auto [RunNumber, SubRunNumber] = SubRuns[NextSubRun++];
+        // Forked on this thread, the global pipeline is only touched by the event loop
+        Pending.push_back(std::async(std::launch::async, Load, Loader, RunNumber, SubRunNumber, ForkSelection()));
+    }
+
+public:
+    ~SubRunPrefetcher()
+    {
+        Stop();
+    }
+
+    void Start(const std::vector<std::pair<Int_t, Int_t> > &RunList, const Int_t Depth, SubRunLoader SubRunLoad)
+    {
+        Stop();
+        Loader = std::move(SubRunLoad);
+        SubRuns = RunList;
+        NextSubRun = 0;
+        Lookahead = std::max(Depth, 0);
+
+        if (Lookahead > 0)
+        {
+            ROOT::EnableThreadSafety();
+        }
+    }
+
+    Bool_t Next(SubRunInput &Input)
+    {
+        if (Pending.empty())
+        {
+            if (NextSubRun >= SubRuns.size())
+            {
+                return false;
+            }
+            if (Lookahead == 0)
+            {
+                const auto [RunNumber, SubRunNumber] = SubRuns[NextSubRun++];
+                Input = Load(Loader, RunNumber, SubRunNumber, ForkSelection());
+                AdoptSelection(Input.Selection);
+                return true;
+            }
+            Launch();
+        }
+
+        auto Loading = std::move(Pending.front());
+        Pending.pop_front();
+
+        // Refill before waiting, the following subruns load while this one is handed over and fitted
+        while (static_cast<Int_t>(Pending.size()) < Lookahead && NextSubRun < SubRuns.size())
+        {
+            Launch();
+        }
+
+        Input = Loading.get();
+        AdoptSelection(Input.Selection);
+        return true;
+    }
+
+    void Stop()
+    {
+        // Subruns loaded but never handed over, e.g. after MaxFilesToProcess
+        for (auto &Loading: Pending)
+        {
+            try
+            {
+                const SubRunInput Input = Loading.get();
+                CloseRootFile(Input.File);
+            }
+            catch (const std::exception &Error)
+            {
+                std::cerr << "Discarded prefetched subrun failed: " << Error.what() << std::endl;
+            }
+        }
+        Pending.clear();
+        SubRuns.clear();
+        NextSubRun = 0;
+    }
+};
+
+// Create a global instance
+SubRunPrefetcher Prefetcher;
+
+/**
+ * Starts loading a run list for the event loop, see NextPrefetchedSubRun
+ * @param SubRuns Run and sub-run numbers in processing order
+ * @param Lookahead Subruns loaded in the background ahead of the one being processed, 0 loads each on demand
+ * @param Loader Opens the subrun into Input.File and Input.Tree and selects its events, runs on a background
+ *               thread when Lookahead > 0. An empty File with an Error skips the subrun, exceptions reach
+ *               the caller of NextPrefetchedSubRun
+ */
+void StartSubRunPrefetch(const std::vector<std::pair<Int_t, Int_t> > &SubRuns, const Int_t Lookahead,
+                         SubRunLoader Loader)
+{
+    Prefetcher.Start(SubRuns, Lookahead, std::move(Loader));
+}
+
+/**
+ * Hands over the next subrun of the run list, waiting only if it is still loading.
+ * The global selection takes over the pipeline and cut flow of the subrun's scan
+ * @param Input Receives the subrun, the caller owns Input.File
+ * @return False once every subrun was handed over
+ */
+Bool_t NextPrefetchedSubRun(SubRunInput &Input)
+{
+    return Prefetcher.Next(Input);
+}
+
+/**
+ * Waits for the subruns still loading and closes their files
+ */
+void StopSubRunPrefetch()
+{
+    Prefetcher.Stop();
+}
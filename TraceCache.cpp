@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <TF1.h>
+#include <TFile.h>
+#include <TGraph.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+constexpr char TraceCacheMagic[8] = {'T', 'R', 'C', 'A', 'C', 'H', 'E', '1'};
+
+// Header and record stride alignment, one cache line
+constexpr size_t TraceCacheAlignment = 64;
+
+// First bytes of a cache file, the records start at DataOffset
+struct TraceCacheHeader
+{
+    char Magic[8];
+    UInt_t Slots;
+    UInt_t TraceLength; // Samples per slot
+    ULong64_t RecordSize; // Stride between records, multiple of TraceCacheAlignment
+    Long64_t Events;
+    ULong64_t DataOffset;
+};
+
+static_assert(sizeof(TraceCacheHeader) <= TraceCacheAlignment, "Trace cache header exceeds its alignment");
+static_assert(sizeof(TraceCacheRecord) % alignof(UShort_t) == 0, "Trace cache samples would be misaligned");
+
+/**
+ * Read-only mapping of a flat trace cache. The file is mapped shared, so every process sweeping
+ * the same cache reads the same page cache pages and nothing is copied or decoded on access
+ */
+class TraceCacheMapping
+{
+private:
+    const char *Data = nullptr;
+    size_t Size = 0;
+    TraceCacheHeader Header{};
+
+public:
+    ~TraceCacheMapping()
+    {
+        Close();
+    }
+
+    void Open(const char *FileName)
+    {
+        Close();
+
+        const int Descriptor = open(FileName, O_RDONLY);
+        if (Descriptor < 0)
+        {
+            throw std::runtime_error("Failed to open trace cache: " + std::string(FileName));
+        }
+
+        struct stat Status{};
+        if (fstat(Descriptor, &Status) != 0 || static_cast<size_t>(Status.st_size) < TraceCacheAlignment)
+        {
+            close(Descriptor);
+            throw std::runtime_error("Trace cache too short: " + std::string(FileName));
+        }
+
+        void *Mapped = mmap(nullptr, static_cast<size_t>(Status.st_size), PROT_READ, MAP_SHARED, Descriptor, 0);
+        close(Descriptor);
+        if (Mapped == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to map trace cache: " + std::string(FileName));
+        }
+        Data = static_cast<const char *>(Mapped);
+        Size = static_cast<size_t>(Status.st_size);
+
+        std::memcpy(&Header, Data, sizeof(Header));
+        if (std::memcmp(Header.Magic, TraceCacheMagic, sizeof(TraceCacheMagic)) != 0 || Header.Slots != SkimSlots ||
+            Header.DataOffset + static_cast<ULong64_t>(Header.Events) * Header.RecordSize > Size)
+        {
+            Close();
+            throw std::runtime_error("Not a valid trace cache: " + std::string(FileName));
+        }
+
+        // Records are read in order by the fit sweeps
+        madvise(const_cast<char *>(Data), Size, MADV_SEQUENTIAL);
+    }
+
+    void Close()
+    {
+        if (Data)
+        {
+            munmap(const_cast<char *>(Data), Size);
+        }
+        Data = nullptr;
+        Size = 0;
+        Header = {};
+    }
+
+    [[nodiscard]] Long64_t GetEvents() const
+    {
+        return Data ? Header.Events : 0;
+    }
+
+    [[nodiscard]] Int_t GetTraceLength() const
+    {
+        return static_cast<Int_t>(Header.TraceLength);
+    }
+
+    [[nodiscard]] const TraceCacheRecord *GetRecord(const Long64_t Event) const
+    {
+        if (!Data || Event < 0 || Event >= Header.Events)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const TraceCacheRecord *>(Data + Header.DataOffset +
+                                                          static_cast<ULong64_t>(Event) * Header.RecordSize);
+    }
+
+    [[nodiscard]] const UShort_t *GetSamples(const Long64_t Event, const Int_t Slot) const
+    {
+        const TraceCacheRecord *Record = GetRecord(Event);
+        if (!Record || Slot < 0 || Slot >= SkimSlots)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const UShort_t *>(reinterpret_cast<const char *>(Record) + sizeof(TraceCacheRecord)) +
+               static_cast<size_t>(Slot) * Header.TraceLength;
+    }
+};
+
+// Create a global instance
+TraceCacheMapping TraceCache;
+
+/**
+ * Writes a flat trace cache: a header padded to TraceCacheAlignment, then one fixed-stride
+ * record per event, a TraceCacheRecord followed by SkimSlots x TraceLength samples, padded to
+ * the alignment. Width and samples follow GetTraceSlotWidth and FillTraceSlots, as in a skim.
+ * The cache is written under a temporary name and renamed, so readers never map a partial file
+ * @param TreeInput Raw pspmt tree or skim
+ * @param QualifyingEvents Entries to store
+ * @param FileName Cache file to write
+ */
+void WriteTraceCache(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents, const char *FileName)
+{
+    const auto [PosXBranch, PosYBranch] = GetPositionBranches(TreeInput);
+    TTreeReader Reader;
+    Reader.SetTree(TreeInput);
+    TTreeReaderValue<Double_t> HighGainPosX(Reader, PosXBranch);
+    TTreeReaderValue<Double_t> HighGainPosY(Reader, PosYBranch);
+
+    std::vector<processor_struct::ROOTDEV> Devices;
+    const Int_t TraceLength = GetTraceSlotWidth(TreeInput, QualifyingEvents);
+
+    TraceCacheHeader Header{};
+    std::memcpy(Header.Magic, TraceCacheMagic, sizeof(TraceCacheMagic));
+    Header.Slots = SkimSlots;
+    Header.TraceLength = static_cast<UInt_t>(TraceLength);
+    const size_t Unpadded = sizeof(TraceCacheRecord) + SkimSlots * TraceLength * sizeof(UShort_t);
+    Header.RecordSize = (Unpadded + TraceCacheAlignment - 1) / TraceCacheAlignment * TraceCacheAlignment;
+    Header.DataOffset = TraceCacheAlignment;
+
+    const std::string TemporaryName = std::string(FileName) + ".tmp";
+    std::ofstream Output(TemporaryName, std::ios::binary | std::ios::trunc);
+    if (!Output)
+    {
+        throw std::runtime_error("Failed to create trace cache: " + TemporaryName);
+    }
+
+    // Header first with a zero event count, rewritten once the records are in
+    std::vector<char> Buffer(TraceCacheAlignment, 0);
+    std::memcpy(Buffer.data(), &Header, sizeof(Header));
+    Output.write(Buffer.data(), static_cast<std::streamsize>(Buffer.size()));
+
+    Buffer.assign(Header.RecordSize, 0);
+    TraceSlotLosses Losses;
+    for (const Long64_t Entry: QualifyingEvents)
+    {
+        if (Reader.SetEntry(Entry) != TTreeReader::kEntryValid || !ReadRootDevices(TreeInput, Entry, Devices))
+        {
+            continue;
+        }
+
+        std::fill(Buffer.begin(), Buffer.end(), 0);
+        TraceCacheRecord Record{};
+        Record.EventNumber = GetSourceEntry(TreeInput, Entry);
+        Record.PosX = *HighGainPosX;
+        Record.PosY = *HighGainPosY;
+        auto *Samples = reinterpret_cast<UShort_t *>(Buffer.data() + sizeof(TraceCacheRecord));
+        FillTraceSlots(Devices, TraceLength, Record.Channels, Record.SampleCounts, Samples, Losses);
+
+        std::memcpy(Buffer.data(), &Record, sizeof(Record));
+        Output.write(Buffer.data(), static_cast<std::streamsize>(Buffer.size()));
+        Header.Events++;
+    }
+
+    Output.seekp(0);
+    Output.write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+    Output.close();
+    if (!Output || std::rename(TemporaryName.c_str(), FileName) != 0)
+    {
+        std::remove(TemporaryName.c_str());
+        throw std::runtime_error("Failed to write trace cache: " + std::string(FileName));
+    }
+
+    std::cout << "Saved " << Header.Events << " events with " << TraceLength << "-sample traces to " << FileName
+            << " (" << Header.RecordSize << " bytes per event)" << std::endl;
+    PrintTraceSlotLosses(Losses, TraceLength, FileName);
+}
+
+/**
+ * Builds the trace cache of one subrun from its qualifying events
+ * @param InputFileName Raw trace file of the subrun
+ * @param CacheFileName Cache file to write
+ */
+void BuildTraceCache(const char *InputFileName, const char *CacheFileName)
+{
+    TFile *InputFile = OpenRootFile(InputFileName);
+    TTree *Tree = GetTree(InputFile, "pspmt");
+    WriteTraceCache(Tree, GetAllQualifyingEvents(Tree), CacheFileName);
+    CloseRootFile(InputFile);
+}
+
+/**
+ * Maps a trace cache read-only, replacing the previously mapped one
+ * @param FileName Cache file written by WriteTraceCache
+ * @throws std::runtime_error if the file is missing or not a trace cache
+ */
+void OpenTraceCache(const char *FileName)
+{
+    TraceCache.Open(FileName);
+}
+
+/**
+ * Unmaps the current trace cache, records and samples obtained from it become invalid
+ */
+void CloseTraceCache()
+{
+    TraceCache.Close();
+}
+
+/**
+ * Number of events in the mapped trace cache, 0 if none is mapped
+ */
+Long64_t GetTraceCacheEvents()
+{
+    return TraceCache.GetEvents();
+}
+
+/**
+ * Event number, position and slot layout of one cached event, pointing into the mapping
+ * @param Event Record index
+ * @return Record, nullptr if out of range
+ */
+const TraceCacheRecord *GetTraceCacheRecord(const Long64_t Event)
+{
+    return TraceCache.GetRecord(Event);
+}
+
+/**
+ * Samples of one slot of a cached event, pointing into the mapping, see SampleCounts for the length
+ * @param Event Record index
+ * @param Slot Slot index, in SkimSlotNames order
+ * @return Samples, nullptr if out of range
+ */
+const UShort_t *GetTraceCacheSamples(const Long64_t Event, const Int_t Slot)
+{
+    return TraceCache.GetSamples(Event, Slot);
+}
+
+/**
+ * Runs FitPeakToTrace and FitDynodePeak over every trace of a cache straight from the mapping,
+ * the fit development loop without any ROOT I/O. Statistics are computed on the mapped samples,
+ * one graph per slot is refilled for every event
+ * @param CacheFileName Cache file
+ * @param MaxEvents Maximum number of events to fit
+ */
+void FitTraceCache(const char *CacheFileName, const Long64_t MaxEvents)
+{
+    OpenTraceCache(CacheFileName);
+    const Long64_t Events = std::min(MaxEvents, GetTraceCacheEvents());
+
+    std::vector<TGraph> Graphs(SkimSlots);
+    Long64_t Fits = 0;
+    Long64_t Converged = 0;
+    const auto Start = std::chrono::steady_clock::now();
+
+    for (Long64_t Event = 0; Event < Events; Event++)
+    {
+        const TraceCacheRecord *Record = GetTraceCacheRecord(Event);
+        for (Int_t Slot = 0; Slot < SkimSlots; Slot++)
+        {
+            const Int_t SampleCount = Record->SampleCounts[Slot];
+            if (SampleCount == 0)
+            {
+                continue;
+            }
+
+            const UShort_t *Samples = GetTraceCacheSamples(Event, Slot);
+            const TraceStatistics Statistics = ComputeTraceStatistics(Samples, SampleCount);
+
+            TGraph &Graph = Graphs[Slot];
+            Graph.Set(SampleCount);
+            for (Int_t Sample = 0; Sample < SampleCount; Sample++)
+            {
+                Graph.SetPoint(Sample, Sample, Samples[Sample]);
+            }
+
+            FitReport Report;
+            TF1 *FitResult = Slot == SkimDynodeSlot
+                                 ? FitDynodePeak(&Graph, 0, SampleCount, &Report, &Statistics)
+                                 : FitPeakToTrace(&Graph, 0, SampleCount, SkimSlotNames[Slot],
+                                                  Record->PosX, Record->PosY, &Report, &Statistics);
+            Fits++;
+            Converged += Report.Outcome == FitOutcome::Converged ? 1 : 0;
+            delete FitResult;
+        }
+    }
+
+    const Double_t Seconds = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - Start).count();
+    std::cout << "[FitTraceCache] " << Events << " events, " << Fits << " fits, " << Converged << " converged, "
+            << (Seconds > 0 ? Events / Seconds : 0) << " events/s" << std::endl;
+
+    CloseTraceCache();
+}
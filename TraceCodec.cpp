@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <Compression.h>
+#include <RZip.h>
+#include <TFile.h>
+#include <TTree.h>
+
+#include "PaassRootStruct.hpp"
+
+#include "main.h"
+
+// Samples per bit-packed block, 4 interleaved lanes of 32
+constexpr Int_t CodecBlockSize = 128;
+constexpr Int_t CodecLanes = 4;
+constexpr Int_t CodecLaneLength = CodecBlockSize / CodecLanes;
+
+/**
+ * Packs one block of 128 zigzagged deltas at Width bits each in the vertical layout of SIMD-BP128:
+ * value i goes to lane i % 4 and every output word holds bits of 4 lanes side by side, so each
+ * step is the same shift/or on 4 adjacent words and the loops vectorize to 128-bit operations
+ * @param Values 128 values below 2^Width
+ * @param Width Bits per value, 1 to 32
+ * @param Output Receives 4 * Width words
+ */
+void PackBlock(const UInt_t *Values, const Int_t Width, UInt_t *Output)
+{
+    UInt_t Accumulator[CodecLanes] = {};
+    Int_t Shift = 0;
+    for (Int_t Index = 0; Index < CodecLaneLength; Index++)
+    {
+        const UInt_t *Row = Values + Index * CodecLanes;
+        for (Int_t Lane = 0; Lane < CodecLanes; Lane++)
+        {
+            Accumulator[Lane] |= Row[Lane] << Shift;
+        }
+
+        Shift += Width;
+        if (Shift >= 32)
+        {
+            Shift -= 32;
+            for (Int_t Lane = 0; Lane < CodecLanes; Lane++)
+            {
+                Output[Lane] = Accumulator[Lane];
+                Accumulator[Lane] = Shift > 0 ? Row[Lane] >> (Width - Shift) : 0;
+            }
+            Output += CodecLanes;
+        }
+    }
+}
+
+/**
+ * Inverse of PackBlock
+ * @param Input 4 * Width packed words
+ * @param Width Bits per value
+ * @param Values Receives the 128 values
+ */
+void UnpackBlock(const UInt_t *Input, const Int_t Width, UInt_t *Values)
+{
+    const UInt_t Mask = Width == 32 ? ~0u : (1u << Width) - 1;
+    Int_t Shift = 0;
+    for (Int_t Index = 0; Index < CodecLaneLength; Index++)
+    {
+        UInt_t *Row = Values + Index * CodecLanes;
+        for (Int_t Lane = 0; Lane < CodecLanes; Lane++)
+        {
+            Row[Lane] = Input[Lane] >> Shift;
+        }
+
+        Shift += Width;
+        if (Shift >= 32)
+        {
+            Shift -= 32;
+            Input += CodecLanes;
+            if (Shift > 0)
+            {
+                for (Int_t Lane = 0; Lane < CodecLanes; Lane++)
+                {
+                    Row[Lane] |= Input[Lane] << (Width - Shift);
+                }
+            }
+        }
+
+        for (Int_t Lane = 0; Lane < CodecLanes; Lane++)
+        {
+            Row[Lane] &= Mask;
+        }
+    }
+}
+
+/**
+ * Appends one trace in the packed trace format: the sample count, the first 4 samples, then per
+ * block of 128 samples a bit width word and the bit-packed zigzag deltas. Deltas are taken 4
+ * samples apart, x[i] - x[i - 4], which keeps the lanes independent so decoding is a 4-wide prefix
+ * sum, and on a smooth trace are as small as the noise and the slope of the pulse
+ * @param Samples Trace samples
+ * @param SampleCount Number of samples
+ * @param Output Words to append to
+ */
+void EncodeTrace(const UInt_t *Samples, const Int_t SampleCount, std::vector<UInt_t> &Output)
+{
+    Output.push_back(static_cast<UInt_t>(SampleCount));
+    for (Int_t Lane = 0; Lane < CodecLanes; Lane++)
+    {
+        Output.push_back(Lane < SampleCount ? Samples[Lane] : 0);
+    }
+
+    UInt_t Block[CodecBlockSize];
+    for (Int_t First = 0; First < SampleCount; First += CodecBlockSize)
+    {
+        UInt_t Combined = 0;
+        for (Int_t i = 0; i < CodecBlockSize; i++)
+        {
+            const Int_t Sample = First + i;
+            const auto Delta = Sample >= CodecLanes && Sample < SampleCount
+                                   ? static_cast<Int_t>(Samples[Sample] - Samples[Sample - CodecLanes])
+                                   : 0;
+            Block[i] = static_cast<UInt_t>(Delta) << 1 ^ static_cast<UInt_t>(Delta >> 31);
+            Combined |= Block[i];
+        }
+
+        Int_t Width = 0;
+        while (Width < 32 && Combined >> Width)
+        {
+            Width++;
+        }
+
+        Output.push_back(static_cast<UInt_t>(Width));
+        if (Width > 0)
+        {
+            const size_t Start = Output.size();
+            Output.resize(Start + static_cast<size_t>(CodecLanes * Width));
+            PackBlock(Block, Width, Output.data() + Start);
+        }
+    }
+}
+
+/**
+ * Decodes one trace written by EncodeTrace
+ * @param Input Packed words, positioned at the start of the trace
+ * @param InputEnd End of the packed words
+ * @param Samples Receives the samples, resized to the stored count
+ * @return Position after the trace, nullptr if the input is truncated or corrupt
+ */
+const UInt_t *DecodeTrace(const UInt_t *Input, const UInt_t *InputEnd, std::vector<UInt_t> &Samples)
+{
+    if (InputEnd - Input < 1 + CodecLanes)
+    {
+        return nullptr;
+    }
+
+    const auto SampleCount = static_cast<Int_t>(*Input++);
+    if (SampleCount < 0)
+    {
+        return nullptr;
+    }
+    const Int_t Blocks = (SampleCount + CodecBlockSize - 1) / CodecBlockSize;
+    Samples.resize(static_cast<size_t>(Blocks * CodecBlockSize));
+
+    UInt_t Previous[CodecLanes];
+    for (auto &Value: Previous)
+    {
+        Value = *Input++;
+    }
+
+    for (Int_t Block = 0; Block < Blocks; Block++)
+    {
+        if (Input >= InputEnd)
+        {
+            return nullptr;
+        }
+        const auto Width = static_cast<Int_t>(*Input++);
+        if (Width > 32 || InputEnd - Input < CodecLanes * Width)
+        {
+            return nullptr;
+        }
+
+        UInt_t *Values = Samples.data() + Block * CodecBlockSize;
+        if (Width > 0)
+        {
+            UnpackBlock(Input, Width, Values);
+            Input += CodecLanes * Width;
+        }
+        else
+        {
+            std::fill(Values, Values + CodecBlockSize, 0);
+        }
+
+        // Zigzag back to signed deltas and add them lane by lane
+        for (Int_t Index = 0; Index < CodecLaneLength; Index++)
+        {
+            UInt_t *Row = Values + Index * CodecLanes;
+            for (Int_t Lane = 0; Lane < CodecLanes; Lane++)
+            {
+                const UInt_t Delta = Row[Lane] >> 1 ^ (0u - (Row[Lane] & 1));
+                Row[Lane] = Previous[Lane] + Delta;
+                Previous[Lane] = Row[Lane];
+            }
+        }
+    }
+
+    // The first 4 samples have zero deltas and come out as the stored start values
+    Samples.resize(static_cast<size_t>(SampleCount));
+    return Input;
+}
+
+/**
+ * Round trip and throughput of the trace codec on the traces of one subrun, against ROOT's
+ * compression algorithms on the same samples as stored in ROOTDEV::trace (32-bit words, compressed
+ * in basket-sized buffers). Every decoded trace is compared with the original
+ * @param InputFileName Subrun trace file
+ * @param MaxEvents Number of entries to read
+ * @return Number of traces that did not decode to the original samples
+ */
+Long64_t BenchmarkTraceCodec(const char *InputFileName, const Long64_t MaxEvents)
+{
+    TFile *InputFile = OpenRootFile(InputFileName);
+    TTree *Tree = GetTree(InputFile, "pspmt");
+
+    std::vector<processor_struct::ROOTDEV> Devices;
+    std::vector<std::vector<UInt_t> > Traces;
+    for (Long64_t Entry = 0; Entry < std::min(MaxEvents, Tree->GetEntries()); Entry++)
+    {
+        if (!ReadRootDevices(Tree, Entry, Devices))
+        {
+            continue;
+        }
+        for (const auto &Device: Devices)
+        {
+            if (SkimSlot(Device) >= 0 && !Device.trace.empty())
+            {
+                Traces.push_back(Device.trace);
+            }
+        }
+    }
+    CloseRootFile(InputFile);
+
+    size_t RawBytes = 0;
+    for (const auto &Trace: Traces)
+    {
+        RawBytes += Trace.size() * sizeof(UInt_t);
+    }
+    if (RawBytes == 0)
+    {
+        std::cerr << "[BenchmarkTraceCodec] No traces in " << InputFileName << std::endl;
+        return 0;
+    }
+
+    const auto Seconds = [](const std::chrono::steady_clock::time_point Start)
+    {
+        return std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - Start).count();
+    };
+    const auto Report = [RawBytes](const std::string &Name, const size_t Bytes, const Double_t EncodeSeconds,
+                                   const Double_t DecodeSeconds)
+    {
+        const Double_t MegaBytes = static_cast<Double_t>(RawBytes) / 1e6;
+        std::cout << "  " << std::left << std::setw(12) << Name << std::right << std::fixed << std::setprecision(3)
+                << std::setw(8) << static_cast<Double_t>(Bytes) / static_cast<Double_t>(RawBytes) << " of raw, "
+                << std::setprecision(0) << std::setw(8) << MegaBytes / EncodeSeconds << " MB/s encode, "
+                << std::setw(8) << MegaBytes / DecodeSeconds << " MB/s decode" << std::defaultfloat << std::endl;
+    };
+
+    std::cout << "[BenchmarkTraceCodec] " << Traces.size() << " traces, " << RawBytes / 1024 << " kB as 32-bit samples"
+            << std::endl;
+
+    // Packed trace codec, every trace checked after decoding
+    std::vector<UInt_t> Packed;
+    Packed.reserve(RawBytes / sizeof(UInt_t));
+    auto Start = std::chrono::steady_clock::now();
+    for (const auto &Trace: Traces)
+    {
+        EncodeTrace(Trace.data(), static_cast<Int_t>(Trace.size()), Packed);
+    }
+    const Double_t EncodeSeconds = Seconds(Start);
+
+    std::vector<UInt_t> Decoded;
+    Long64_t Mismatches = 0;
+    Start = std::chrono::steady_clock::now();
+    const UInt_t *Position = Packed.data();
+    const UInt_t *End = Packed.data() + Packed.size();
+    for (const auto &Trace: Traces)
+    {
+        Position = Position ? DecodeTrace(Position, End, Decoded) : nullptr;
+        Mismatches += !Position || Decoded != Trace ? 1 : 0;
+    }
+    Report("packed", Packed.size() * sizeof(UInt_t), EncodeSeconds, Seconds(Start));
+
+    // ROOT algorithms on basket-sized buffers of the raw samples
+    constexpr Int_t BufferSize = 32000;
+    std::vector<char> Raw;
+    Raw.reserve(RawBytes);
+    for (const auto &Trace: Traces)
+    {
+        const auto *Bytes = reinterpret_cast<const char *>(Trace.data());
+        Raw.insert(Raw.end(), Bytes, Bytes + Trace.size() * sizeof(UInt_t));
+    }
+
+    const std::vector<std::pair<std::string, ROOT::RCompressionSetting::EAlgorithm::EValues> > Algorithms = {
+        {"zlib", ROOT::RCompressionSetting::EAlgorithm::kZLIB},
+        {"lz4", ROOT::RCompressionSetting::EAlgorithm::kLZ4},
+        {"zstd", ROOT::RCompressionSetting::EAlgorithm::kZSTD},
+        {"lzma", ROOT::RCompressionSetting::EAlgorithm::kLZMA}
+    };
+    for (const auto &[Name, Algorithm]: Algorithms)
+    {
+        std::vector<std::vector<unsigned char> > Compressed;
+        size_t CompressedBytes = 0;
+        Start = std::chrono::steady_clock::now();
+        for (size_t Offset = 0; Offset < Raw.size(); Offset += BufferSize)
+        {
+            Int_t SourceSize = static_cast<Int_t>(std::min(Raw.size() - Offset, static_cast<size_t>(BufferSize)));
+            Int_t TargetSize = SourceSize + 512;
+            Int_t Written = 0;
+            std::vector<unsigned char> Target(static_cast<size_t>(TargetSize));
+            R__zipMultipleAlgorithm(4, &SourceSize, Raw.data() + Offset, &TargetSize,
+                                    reinterpret_cast<char *>(Target.data()), &Written, Algorithm);
+            Target.resize(static_cast<size_t>(Written));
+            CompressedBytes += Written > 0 ? static_cast<size_t>(Written) : static_cast<size_t>(SourceSize);
+            Compressed.push_back(std::move(Target));
+        }
+        const Double_t CompressSeconds = Seconds(Start);
+
+        std::vector<unsigned char> Output(BufferSize);
+        Start = std::chrono::steady_clock::now();
+        for (auto &Buffer: Compressed)
+        {
+            Int_t SourceSize = static_cast<Int_t>(Buffer.size());
+            Int_t TargetSize = BufferSize;
+            Int_t Read = 0;
+            if (SourceSize > 0)
+            {
+                R__unzip(&SourceSize, Buffer.data(), &TargetSize, Output.data(), &Read);
+            }
+        }
+        Report(Name, CompressedBytes, CompressSeconds, Seconds(Start));
+    }
+
+    if (Mismatches > 0)
+    {
+        std::cerr << "[BenchmarkTraceCodec] " << Mismatches << " traces did not round trip" << std::endl;
+    }
+    else
+    {
+        std::cout << "  All " << Traces.size() << " traces round trip exactly" << std::endl;
+    }
+    return Mismatches;
+}
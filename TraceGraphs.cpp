@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <chrono>
 #include <iomanip>
 #include <vector>
 #include <map>
@@ -7,7 +9,6 @@
 #include <TFile.h>
 #include <TTreeReader.h>
 #include <TTreeReaderValue.h>
-#include <TTreeReaderArray.h>
 #include <TGraph.h>
 #include <TCanvas.h>
 #include <TSystem.h>
@@ -16,6 +17,7 @@
 #include <TStyle.h>
 #include <TLegend.h>
 #include <TText.h>
+#include <TH1D.h>
 
 #include "PaassRootStruct.hpp"
 
@@ -36,10 +38,8 @@ void SaveTraceGraphs(TTree *TreeInput, const Long64_t Entry, const char *ImagePa
         {5, {"yb", "Y Anode B Signal"}}
     };
 
-    TTreeReader Reader;
-    Reader.SetTree(TreeInput);
-    TTreeReaderArray<processor_struct::ROOTDEV> RootDevVector = {Reader, "rootdev_vec_"};
-    Reader.SetEntry(Entry);
+    std::vector<processor_struct::ROOTDEV> RootDevVector;
+    ReadRootDevices(TreeInput, Entry, RootDevVector);
 
     // Store graphs for each channel type
     std::map<std::string, TGraph *> TraceGraphs;
@@ -50,11 +50,11 @@ void SaveTraceGraphs(TTree *TreeInput, const Long64_t Entry, const char *ImagePa
     gStyle->SetTitleSize(2.5); // Increase title size
     //gStyle-> SetTitleFontSize(18); // Increase title font size
 
-    if (RootDevVector.GetSize() > 0)
+    if (!RootDevVector.empty())
     {
-        for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.GetSize(); DeviceIndex++)
+        for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.size(); DeviceIndex++)
         {
-            const auto &Device = RootDevVector.At(DeviceIndex);
+            const auto &Device = RootDevVector[DeviceIndex];
 
             if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
             {
@@ -104,7 +104,7 @@ void SaveTraceGraphs(TTree *TreeInput, const Long64_t Entry, const char *ImagePa
 
         // Save combined view
         char CombinedPngName[100];
-        sprintf(CombinedPngName, "%s/event_%lld_traces.png", ImagePath, Entry);
+        sprintf(CombinedPngName, "%s/event_%lld_traces.png", ImagePath, GetSourceEntry(TreeInput, Entry));
         CombinedCanvas->SaveAs(CombinedPngName);
 
         // Cleanup
@@ -170,13 +170,16 @@ void SaveTraceGraphsWithFit(TTree *TreeInput, const Long64_t Entry, const char *
         {5, {"yb", "Y Anode B Signal"}}
     };
 
+    const auto [PosXBranch, PosYBranch] = GetPositionBranches(TreeInput);
     TTreeReader Reader;
     Reader.SetTree(TreeInput);
-    TTreeReaderValue<Double_t> HighGainPosX(Reader, "high_gain_.pos_x_");
-    TTreeReaderValue<Double_t> HighGainPosY(Reader, "high_gain_.pos_y_");
-    TTreeReaderArray<processor_struct::ROOTDEV> RootDevVector(Reader, "rootdev_vec_");
+    TTreeReaderValue<Double_t> HighGainPosX(Reader, PosXBranch);
+    TTreeReaderValue<Double_t> HighGainPosY(Reader, PosYBranch);
     Reader.SetEntry(Entry);
 
+    std::vector<processor_struct::ROOTDEV> RootDevVector;
+    ReadRootDevices(TreeInput, Entry, RootDevVector);
+
     std::map<std::string, TGraph*> TraceGraphs;
     std::vector<TF1*> FitFunctions;
 
@@ -198,11 +201,11 @@ void SaveTraceGraphsWithFit(TTree *TreeInput, const Long64_t Entry, const char *
     gStyle->SetOptFit(1);
     gStyle->SetFuncWidth(4);
 
-    if (RootDevVector.GetSize() > 0)
+    if (!RootDevVector.empty())
     {
-        for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.GetSize(); DeviceIndex++)
+        for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.size(); DeviceIndex++)
         {
-            const auto& Device = RootDevVector.At(DeviceIndex);
+            const auto& Device = RootDevVector[DeviceIndex];
 
             if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
             {
@@ -215,17 +218,16 @@ void SaveTraceGraphsWithFit(TTree *TreeInput, const Long64_t Entry, const char *
                                                        static_cast<Int_t>(DeviceIndex));
                 TraceGraphs["dynode"] = TraceGraph;
 
-                try
+                if (TF1* DynodeFitResult = FitDynodePeak(TraceGraph, 0, TraceGraph->GetN()))
                 {
-                    TF1* DynodeFitResult = FitDynodePeak(TraceGraph, 0, TraceGraph->GetN());
                     DynodeFitResult->SetLineColor(kRed);
                     DynodeFitResult->SetLineWidth(3);
                     DynodeFitResult->SetNpx(2000);
                     FitFunctions.push_back(DynodeFitResult);
                 }
-                catch (const std::exception& Error)
+                else
                 {
-                    std::cerr << "Dynode fitting error: " << Error.what() << std::endl;
+                    std::cerr << "Dynode fitting error: invalid trace" << std::endl;
                 }
             }
             else if (Device.subtype == "anode_high")
@@ -238,20 +240,19 @@ void SaveTraceGraphsWithFit(TTree *TreeInput, const Long64_t Entry, const char *
                                                            static_cast<Int_t>(DeviceIndex));
                     TraceGraphs[ChannelIter->second.first] = TraceGraph;
 
-                    try
+                    // Always use X position for rise power calculation
+                    if (TF1* FitResult = FitPeakToTrace(TraceGraph, 0, TraceGraph->GetN(),
+                                                        ChannelIter->second.first, PositionX, PositionY))
                     {
-                        // Always use X position for rise power calculation
-                        TF1* FitResult = FitPeakToTrace(TraceGraph, 0, TraceGraph->GetN(),
-                                                      ChannelIter->second.first, PositionX, PositionY);
                         FitResult->SetLineColor(kRed);
                         FitResult->SetLineWidth(5);
                         FitResult->SetNpx(2000);
                         FitFunctions.push_back(FitResult);
                     }
-                    catch (const std::exception& Error)
+                    else
                     {
                         std::cerr << "Fitting error for " << ChannelIter->second.first
-                                 << ": " << Error.what() << std::endl;
+                                 << ": invalid trace or position " << PositionX << std::endl;
                     }
                 }
             }
@@ -309,7 +310,7 @@ void SaveTraceGraphsWithFit(TTree *TreeInput, const Long64_t Entry, const char *
         }
 
         char CombinedPngName[100];
-        sprintf(CombinedPngName, "%s/Event_%lld_Traces_Fit.png", ImagePath, Entry);
+        sprintf(CombinedPngName, "%s/Event_%lld_Traces_Fit.png", ImagePath, GetSourceEntry(TreeInput, Entry));
         CombinedCanvas->SaveAs(CombinedPngName);
 
         delete CombinedCanvas;
@@ -378,6 +379,38 @@ std::optional<AnalysisResults::ChannelFit> ExtractAnodeFitParameters(const TF1*
     return Params;
 }
 
+/**
+ * Reads one channel back from a FitAnodesJointly result
+ * @param FitFunc Joint fit function
+ * @param Channel Anode name (xa, xb, ya, yb)
+ * @return Channel parameters with the shared onset plus the channel offset as peak position
+ */
+std::optional<AnalysisResults::ChannelFit> ExtractJointAnodeFitParameters(const TF1* FitFunc, const std::string& Channel)
+{
+    if (!FitFunc)
+    {
+        return std::nullopt;
+    }
+
+    const auto NameIter = std::find(std::begin(JointAnodeChannelNames), std::end(JointAnodeChannelNames), Channel);
+    if (NameIter == std::end(JointAnodeChannelNames))
+    {
+        return std::nullopt;
+    }
+    const auto Index = static_cast<Int_t>(NameIter - std::begin(JointAnodeChannelNames));
+    const Int_t First = 1 + JointAnodeChannels + 5 * Index;
+
+    AnalysisResults::ChannelFit Params;
+    Params.Amplitude = FitFunc->GetParameter(First);
+    Params.PeakPosition = FitFunc->GetParameter(0) + FitFunc->GetParameter(1 + Index);
+    Params.DecayConstant = FitFunc->GetParameter(First + 1);
+    Params.RiseTimeConstant = FitFunc->GetParameter(First + 2);
+    Params.RisePower = FitFunc->GetParameter(First + 3);
+    Params.Baseline = FitFunc->GetParameter(First + 4);
+
+    return Params;
+}
+
 /**
  * Extracts fit parameters from a dynode fit function
  * @param FitFunc Pointer to the fitted function
@@ -404,138 +437,527 @@ std::optional<AnalysisResults::DynodeFit> ExtractDynodeFitParameters(const TF1*
     return Params;
 }
 
+// Anode channel numbers with their result names and graph titles
+const std::map<Int_t, std::pair<std::string, std::string>> AnodeChannelMap = {
+    {4, {"xa", "X Anode A Signal"}},
+    {7, {"xb", "X Anode B Signal"}},
+    {6, {"ya", "Y Anode A Signal"}},
+    {5, {"yb", "Y Anode B Signal"}}
+};
+
 /**
- * Modified version of SaveTraceGraphsWithFit that returns analysis results
+ * Reads what the fits and estimators need of one event: selection check, position and the used
+ * rootdev_vec_ members. The only step of an event that touches the tree
  * @param TreeInput Pointer to the input tree
- * @param Entry Entry number to process
- * @return Optional analysis results containing fit parameters and positions
+ * @param Entry Entry number to read
+ * @param Event Receives the event, its buffers are reused across calls
+ * @param StatusReport Optional report receiving why the event cannot be used
+ * @return False if the event is not selected or cannot be read
  */
-std::optional<AnalysisResults> GetEventFitParameters(TTree* TreeInput, const Long64_t Entry)
+Bool_t DecodeEvent(TTree* TreeInput, const Long64_t Entry, DecodedEvent& Event, EventReport* StatusReport)
 {
+    const auto Reject = [StatusReport](const EventStatus Status, const std::string& Channel = "")
+        -> Bool_t
+    {
+        if (StatusReport)
+        {
+            StatusReport->Status = Status;
+            StatusReport->Channel = Channel;
+        }
+        return false;
+    };
+
+    if (!TreeInput)
+    {
+        return Reject(EventStatus::InvalidInput);
+    }
+
+    // Set before any rejection, the status of every event is recorded under its raw entry
+    Event.Entry = Entry;
+    Event.EventNumber = GetSourceEntry(TreeInput, Entry);
+
     if (!MeetsSelectionCriteria(TreeInput, Entry))
     {
-        return std::nullopt;
+        return Reject(EventStatus::NotSelected);
     }
 
-    const std::map<Int_t, std::pair<std::string, std::string>> ChannelMap = {
-        {4, {"xa", "X Anode A Signal"}},
-        {7, {"xb", "X Anode B Signal"}},
-        {6, {"ya", "Y Anode A Signal"}},
-        {5, {"yb", "Y Anode B Signal"}}
+    Event.Statistics.clear();
+
+    if (!ReadPositions(TreeInput, Entry, Event.PosX, Event.PosY))
+    {
+        return Reject(EventStatus::InvalidInput);
+    }
+
+    // Only the members used by the fits, decoded into buffers reused across events
+    if (!ReadRootDevices(TreeInput, Entry, Event.Devices))
+    {
+        return Reject(EventStatus::InvalidInput);
+    }
+    return true;
+}
+
+/**
+ * Checks the position range and computes the seed statistics of every trace of a decoded event,
+ * screening them when the trace filter is enabled. The screening keeps per-run baseline references,
+ * so events must pass through here in entry order
+ * @param Event Event from DecodeEvent, receives the statistics
+ * @param StatusReport Optional report receiving why the event is not fitted
+ * @return False if the event is rejected before any fit
+ */
+Bool_t PrepareEventFits(DecodedEvent& Event, EventReport* StatusReport)
+{
+    const auto Reject = [StatusReport](const EventStatus Status, const std::string& Channel = "")
+        -> Bool_t
+    {
+        if (StatusReport)
+        {
+            StatusReport->Status = Status;
+            StatusReport->Channel = Channel;
+        }
+        return false;
     };
 
-    AnalysisResults Results;
-    Results.EventNumber = Entry;
+    // Rise powers only exist inside the mapped position range, checked once for all anodes
+    for (const auto& [ChannelNumber, Channel] : AnodeChannelMap)
+    {
+        if (!TryCalculateRisePower(Channel.first, Event.PosX))
+        {
+            return Reject(EventStatus::PositionOutOfRange, Channel.first);
+        }
+    }
 
-    TTreeReader Reader;
-    Reader.SetTree(TreeInput);
-    TTreeReaderValue<Double_t> HighGainPosX(Reader, "high_gain_.pos_x_");
-    TTreeReaderValue<Double_t> HighGainPosY(Reader, "high_gain_.pos_y_");
-    TTreeReaderArray<processor_struct::ROOTDEV> RootDevVector(Reader, "rootdev_vec_");
-    Reader.SetEntry(Entry);
+    // Seed statistics of every trace, screened before the first fit so a single unusable trace
+    // does not cost the fits of the others
+    const auto& RootDevVector = Event.Devices;
+    auto& DeviceStatistics = Event.Statistics;
+    DeviceStatistics.assign(RootDevVector.size(), TraceStatistics());
+    std::string RejectedChannel;
+    for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.size(); DeviceIndex++)
+    {
+        const auto& Device = RootDevVector[DeviceIndex];
+
+        if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
+        {
+            continue;
+        }
+
+        // Fit seeds straight from the raw samples
+        DeviceStatistics[DeviceIndex] = ComputeTraceStatistics(Device.trace.data(),
+                                                               static_cast<Int_t>(Device.trace.size()));
+
+        if (!IsTraceFilterEnabled())
+        {
+            continue;
+        }
+
+        std::string Channel;
+        if (Device.subtype == "dynode_high")
+        {
+            Channel = "dynode";
+        }
+        else if (const auto ChannelIter = AnodeChannelMap.find(Device.chanNum);
+                 Device.subtype == "anode_high" && ChannelIter != AnodeChannelMap.end())
+        {
+            Channel = ChannelIter->second.first;
+        }
+
+        if (!Channel.empty() &&
+            ScreenTrace(Channel, Device.trace.data(), static_cast<Int_t>(Device.trace.size()),
+                        DeviceStatistics[DeviceIndex]) != TraceRejectReason::Accepted &&
+            RejectedChannel.empty())
+        {
+            RejectedChannel = Channel;
+        }
+    }
+
+    if (IsTraceFilterEnabled())
+    {
+        CountScreenedEvent(!RejectedChannel.empty());
+        if (!RejectedChannel.empty())
+        {
+            return Reject(EventStatus::TraceRejected, RejectedChannel);
+        }
+    }
+    return true;
+}
+
+/**
+ * Fits the traces of an event prepared by PrepareEventFits. Touches neither the tree nor
+ * order-dependent state, so the fit workers of the event pipeline run it concurrently
+ * @param Event Decoded event with its trace statistics
+ * @param StatusReport Optional report receiving why the event produced no results
+ * @return Optional analysis results containing fit parameters and positions
+ */
+std::optional<AnalysisResults> FitDecodedEvent(const DecodedEvent& Event, EventReport* StatusReport)
+{
+    const auto Reject = [StatusReport](const EventStatus Status, const std::string& Channel = "")
+        -> std::optional<AnalysisResults>
+    {
+        if (StatusReport)
+        {
+            StatusReport->Status = Status;
+            StatusReport->Channel = Channel;
+        }
+        return std::nullopt;
+    };
 
-    Results.PosX = *HighGainPosX;
-    Results.PosY = *HighGainPosY;
+    const auto& ChannelMap = AnodeChannelMap;
+    const auto& RootDevVector = Event.Devices;
+    const auto& DeviceStatistics = Event.Statistics;
+    const Long64_t EventNumber = Event.EventNumber;
+
+    AnalysisResults Results;
+    Results.EventNumber = Event.EventNumber;
+    Results.PosX = Event.PosX;
+    Results.PosY = Event.PosY;
 
     Bool_t ValidFits = true;
+    std::string FailedChannel;
+
+    // Anode traces kept for the joint fit after the device loop
+    const Bool_t JointAnodes = GetAnodeFitMode() == AnodeFitMode::Joint;
+    std::map<std::string, TGraph*> AnodeGraphs;
+    std::map<std::string, const processor_struct::ROOTDEV*> AnodeDevices;
 
-    if (RootDevVector.GetSize() > 0)
+    // Once a channel fails the event is lost, the remaining channels are not fitted
+    for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.size() && ValidFits; DeviceIndex++)
     {
-        for (UInt_t DeviceIndex = 0; DeviceIndex < RootDevVector.GetSize(); DeviceIndex++)
+        const auto& Device = RootDevVector[DeviceIndex];
+
+        if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
         {
-            const auto& Device = RootDevVector.At(DeviceIndex);
+            continue;
+        }
 
-            if (!Device.hasValidTimingAnalysis || !Device.hasValidWaveformAnalysis)
+        auto* TraceGraph = new TGraph(static_cast<Int_t>(Device.trace.size()));
+        for (size_t i = 0; i < Device.trace.size(); i++)
+        {
+            TraceGraph->SetPoint(static_cast<Int_t>(i),
+                               static_cast<Double_t>(i), Device.trace[i]);
+        }
+
+        const TraceStatistics& Statistics = DeviceStatistics[DeviceIndex];
+
+        if (Device.subtype == "dynode_high")
+        {
+            const PulseModel Model = SelectPulseModel(Statistics, true);
+            FitReport Report;
+            std::optional<AnalysisResults::DynodeFit> DynodeParams;
+            if (Model == PulseModel::Estimator)
             {
-                continue;
+                const auto Start = std::chrono::steady_clock::now();
+                DynodeParams = EstimateDynodeParameters(TraceGraph->GetY(), TraceGraph->GetN(), Statistics);
+                Report.Outcome = FitOutcome::Estimated;
+                Report.Telemetry.WallTime = std::chrono::duration<Double_t, std::micro>(
+                    std::chrono::steady_clock::now() - Start).count();
             }
-
-            auto* TraceGraph = new TGraph(static_cast<Int_t>(Device.trace.size()));
-            for (size_t i = 0; i < Device.trace.size(); i++)
+            else
             {
-                TraceGraph->SetPoint(static_cast<Int_t>(i),
-                                   static_cast<Double_t>(i), Device.trace[i]);
+                TF1* DynodeFitResult = FitDynodePeak(TraceGraph, 0, TraceGraph->GetN(), &Report, &Statistics,
+                                                     Model);
+                DynodeParams = ExtractDynodeFitParameters(DynodeFitResult);
+                delete DynodeFitResult;
             }
 
-            if (Device.subtype == "dynode_high")
+            if (DynodeParams)
+            {
+                Results.DynodeFitParams = *DynodeParams;
+                Results.DynodeFitParams.FitStatus = static_cast<Int_t>(Report.Outcome);
+                Results.DynodeFitParams.Model = static_cast<Int_t>(Model);
+                Results.DynodeFitParams.Telemetry = Report.Telemetry;
+                RecordFitForProfiling(EventNumber, "dynode", Results.PosX, Results.PosY, Report, Device);
+            }
+            else
+            {
+                ValidFits = false;
+                FailedChannel = "dynode";
+            }
+        }
+        else if (Device.subtype == "anode_high" && JointAnodes)
+        {
+            if (auto ChannelIter = ChannelMap.find(Device.chanNum);
+                ChannelIter != ChannelMap.end() && !AnodeGraphs.count(ChannelIter->second.first))
             {
-                try
+                AnodeGraphs[ChannelIter->second.first] = TraceGraph;
+                AnodeDevices[ChannelIter->second.first] = &Device;
+                continue;
+            }
+        }
+        else if (Device.subtype == "anode_high")
+        {
+            if (auto ChannelIter = ChannelMap.find(Device.chanNum);
+                ChannelIter != ChannelMap.end())
+            {
+                // Always use X position for rise power calculation, in range as checked above
+                const PulseModel Model = SelectPulseModel(Statistics, false);
+                FitReport Report;
+                std::optional<AnalysisResults::ChannelFit> AnodeParams;
+                if (Model == PulseModel::Estimator)
                 {
-                    TF1* DynodeFitResult = FitDynodePeak(TraceGraph, 0, TraceGraph->GetN());
-                    auto DynodeParams = ExtractDynodeFitParameters(DynodeFitResult);
-                    if (DynodeParams)
-                    {
-                        Results.DynodeFitParams = *DynodeParams;
-                    }
-                    else
-                    {
-                        ValidFits = false;
-                    }
-                    delete DynodeFitResult;
+                    const auto Start = std::chrono::steady_clock::now();
+                    AnodeParams = EstimateAnodeParameters(
+                        TraceGraph->GetY(), TraceGraph->GetN(), Statistics,
+                        *TryCalculateRisePower(ChannelIter->second.first, Results.PosX));
+                    Report.Outcome = FitOutcome::Estimated;
+                    Report.Telemetry.WallTime = std::chrono::duration<Double_t, std::micro>(
+                        std::chrono::steady_clock::now() - Start).count();
                 }
-                catch (const std::exception& Error)
+                else
+                {
+                    TF1* FitResult = FitPeakToTrace(TraceGraph, 0.0, TraceGraph->GetN(),
+                                                  ChannelIter->second.first, Results.PosX, Results.PosY,
+                                                  &Report, &Statistics, Model);
+                    AnodeParams = ExtractAnodeFitParameters(FitResult);
+                    delete FitResult;
+                }
+
+                if (AnodeParams)
+                {
+                    AnodeParams->FitStatus = static_cast<Int_t>(Report.Outcome);
+                    AnodeParams->Model = static_cast<Int_t>(Model);
+                    AnodeParams->Telemetry = Report.Telemetry;
+                    RecordFitForProfiling(EventNumber, ChannelIter->second.first, Results.PosX, Results.PosY,
+                                          Report, Device);
+                    Results.AnodeFits[ChannelIter->second.first] = *AnodeParams;
+                }
+                else
                 {
-                    std::cerr << "Dynode fitting error for event " << Entry
-                             << ": " << Error.what() << std::endl;
                     ValidFits = false;
+                    FailedChannel = ChannelIter->second.first;
                 }
             }
-            else if (Device.subtype == "anode_high")
+        }
+        delete TraceGraph;
+    }
+
+    if (JointAnodes)
+    {
+        if (ValidFits && AnodeGraphs.size() == JointAnodeChannels)
+        {
+            // Always the full model, the anode ModelSelectionPolicy does not apply to the joint fit
+            FitReport Report;
+            TF1* FitResult = FitAnodesJointly(AnodeGraphs, Results.PosX, Results.PosY, &Report);
+            for (const auto& Channel : JointAnodeChannelNames)
             {
-                if (auto ChannelIter = ChannelMap.find(Device.chanNum);
-                    ChannelIter != ChannelMap.end())
+                auto AnodeParams = ExtractJointAnodeFitParameters(FitResult, Channel);
+                if (!AnodeParams)
                 {
-                    try
-                    {
-                        //std::cout << "Position: " << Results.PosX << std::endl;
-                        // Always use X position for rise power calculation
-                        TF1* FitResult = FitPeakToTrace(TraceGraph, 0.0, TraceGraph->GetN(),
-                                                      ChannelIter->second.first, Results.PosX, Results.PosY);
-                        auto AnodeParams = ExtractAnodeFitParameters(FitResult);
-                        if (AnodeParams)
-                        {
-                            Results.AnodeFits[ChannelIter->second.first] = *AnodeParams;
-                        }
-                        else
-                        {
-                            ValidFits = false;
-                        }
-                        delete FitResult;
-                    }
-                    catch (const std::exception& Error)
-                    {
-                        throw std::runtime_error(Error.what());
-                    }
+                    ValidFits = false;
+                    FailedChannel = "joint_anodes";
+                    break;
                 }
+                AnodeParams->FitStatus = static_cast<Int_t>(Report.Outcome);
+                AnodeParams->Model = static_cast<Int_t>(PulseModel::Full);
+                Results.AnodeFits[Channel] = *AnodeParams;
             }
-            delete TraceGraph;
+            delete FitResult;
+
+            if (ValidFits)
+            {
+                Results.JointAnodeFitParams.FitStatus = static_cast<Int_t>(Report.Outcome);
+                Results.JointAnodeFitParams.Telemetry = Report.Telemetry;
+
+                // One record for the one minimization, its trace the four anodes in fit order
+                processor_struct::ROOTDEV JointDevice;
+                for (const auto& Channel : JointAnodeChannelNames)
+                {
+                    const auto& Trace = AnodeDevices.at(Channel)->trace;
+                    JointDevice.trace.insert(JointDevice.trace.end(), Trace.begin(), Trace.end());
+                }
+                RecordFitForProfiling(EventNumber, "joint_anodes", Results.PosX, Results.PosY, Report, JointDevice);
+            }
+        }
+        else if (ValidFits)
+        {
+            ValidFits = false;
+            FailedChannel = "joint_anodes";
+        }
+
+        for (const auto& [Channel, Graph] : AnodeGraphs)
+        {
+            delete Graph;
         }
     }
 
-    return ValidFits ? std::optional(Results) : std::nullopt;
+    if (!ValidFits)
+    {
+        return Reject(EventStatus::FitFailed, FailedChannel);
+    }
+
+    if (StatusReport)
+    {
+        StatusReport->Status = EventStatus::Accepted;
+    }
+    return Results;
 }
 
-void SaveAnalysisResults(const std::vector<AnalysisResults>& Results, const Int_t RunNumber, const Int_t SubRunNumber)
+/**
+ * Modified version of SaveTraceGraphsWithFit that returns analysis results.
+ * Nothing on this path throws for a bad event, every failure ends up in StatusReport
+ * @param TreeInput Pointer to the input tree
+ * @param Entry Entry number to process
+ * @param StatusReport Optional report receiving why the event produced no results
+ * @return Optional analysis results containing fit parameters and positions
+ */
+std::optional<AnalysisResults> GetEventFitParameters(TTree* TreeInput, const Long64_t Entry,
+                                                     EventReport* StatusReport)
 {
-    std::cout << "\n[SaveAnalysisResults] Run " << std::setfill('0') << std::setw(3) << RunNumber
-              << "_" << std::setfill('0') << std::setw(2) << SubRunNumber
-              << ": Saving " << Results.size() << " events\n" << std::endl;
+    static thread_local DecodedEvent Event;
+    if (!DecodeEvent(TreeInput, Entry, Event, StatusReport) || !PrepareEventFits(Event, StatusReport))
+    {
+        return std::nullopt;
+    }
+    return FitDecodedEvent(Event, StatusReport);
+}
 
-    // Create output filename based on run numbers
+/**
+ * Adds the convergence telemetry branches of one channel to the results tree
+ * @param Tree Results tree
+ * @param Prefix Channel prefix, e.g. "xa_" or "dynode_"
+ * @param Telemetry Telemetry buffer the branches read from
+ */
+void BranchFitTelemetry(TTree& Tree, const std::string& Prefix, FitTelemetry& Telemetry)
+{
+    Tree.Branch((Prefix + "chi2").c_str(), &Telemetry.Chi2);
+    Tree.Branch((Prefix + "ndf").c_str(), &Telemetry.Ndf);
+    Tree.Branch((Prefix + "minimizer_status").c_str(), &Telemetry.MinimizerStatus);
+    Tree.Branch((Prefix + "edm").c_str(), &Telemetry.Edm);
+    Tree.Branch((Prefix + "iterations").c_str(), &Telemetry.Iterations);
+    Tree.Branch((Prefix + "function_calls").c_str(), &Telemetry.FunctionCalls);
+    Tree.Branch((Prefix + "fit_time").c_str(), &Telemetry.WallTime);
+}
+
+/**
+ * Writes per-channel summary histograms of the fit telemetry of a subrun
+ * into the fit_telemetry directory of the output file
+ * @param Results Analysis results of the subrun
+ * @param OutputFile Open output file
+ */
+void WriteFitTelemetryHistograms(const std::vector<AnalysisResults>& Results, TFile& OutputFile)
+{
+    const FitBudget& Budget = GetFitBudget();
+    const Double_t MaxCalls = Budget.MaxFunctionCalls > 0 ? Budget.MaxFunctionCalls : 5000;
+    const Double_t MaxTime = Budget.MaxMicroseconds > 0 ? static_cast<Double_t>(Budget.MaxMicroseconds) : 1e6;
+
+    OutputFile.mkdir("fit_telemetry");
+    OutputFile.cd("fit_telemetry");
+
+    for (const auto& Channel : {"xa", "xb", "ya", "yb", "dynode", "joint_anodes"})
+    {
+        auto* TimeHist = new TH1D(Form("%s_fit_time", Channel),
+                                  Form("%s Fit Wall Time;Time [#mus];Fits", Channel), 500, 0, MaxTime);
+        auto* CallsHist = new TH1D(Form("%s_function_calls", Channel),
+                                   Form("%s Function Calls;Calls;Fits", Channel), 500, 0, MaxCalls);
+        auto* IterationsHist = new TH1D(Form("%s_iterations", Channel),
+                                        Form("%s Minimizer Iterations;Iterations;Fits", Channel), 500, 0, MaxCalls);
+        auto* ReducedChi2Hist = new TH1D(Form("%s_reduced_chi2", Channel),
+                                         Form("%s #chi^{2}/NDF;#chi^{2}/NDF;Fits", Channel), 500, 0, 1000);
+        auto* EdmHist = new TH1D(Form("%s_edm", Channel),
+                                 Form("%s Estimated Distance to Minimum;log_{10}(EDM);Fits", Channel), 200, -12, 2);
+        auto* StatusHist = new TH1D(Form("%s_minimizer_status", Channel),
+                                    Form("%s Minimizer Status;Status;Fits", Channel), 10, -0.5, 9.5);
+
+        for (const auto& Result : Results)
+        {
+            const FitTelemetry* Telemetry = nullptr;
+            if (std::string(Channel) == "dynode")
+            {
+                Telemetry = &Result.DynodeFitParams.Telemetry;
+            }
+            else if (std::string(Channel) == "joint_anodes")
+            {
+                Telemetry = &Result.JointAnodeFitParams.Telemetry;
+            }
+            else if (const auto FitIter = Result.AnodeFits.find(Channel); FitIter != Result.AnodeFits.end())
+            {
+                Telemetry = &FitIter->second.Telemetry;
+            }
+
+            if (!Telemetry || Telemetry->WallTime < 0)
+            {
+                continue;
+            }
+
+            TimeHist->Fill(Telemetry->WallTime);
+            if (Telemetry->FunctionCalls >= 0)
+            {
+                CallsHist->Fill(Telemetry->FunctionCalls);
+                IterationsHist->Fill(Telemetry->Iterations);
+                StatusHist->Fill(Telemetry->MinimizerStatus);
+            }
+            if (Telemetry->Ndf > 0)
+            {
+                ReducedChi2Hist->Fill(Telemetry->Chi2 / Telemetry->Ndf);
+            }
+            if (Telemetry->Edm > 0)
+            {
+                EdmHist->Fill(std::log10(Telemetry->Edm));
+            }
+        }
+
+        for (const TH1D* Hist : {TimeHist, CallsHist, IterationsHist, ReducedChi2Hist, EdmHist, StatusHist})
+        {
+            Hist->Write();
+        }
+    }
+
+    OutputFile.cd();
+}
+
+/**
+ * Name of the results file of a subrun, analysis_RRR_SS.root, or analysis_RRR_SS_partPP.root
+ * for one part of a subrun split across worker processes
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ * @param Part Part number, -1 for the whole subrun
+ * @return File name
+ */
+std::string AnalysisResultsFileName(const Int_t RunNumber, const Int_t SubRunNumber, const Int_t Part)
+{
     std::ostringstream OutputFileName;
     OutputFileName << "analysis_"
                   << std::setfill('0') << std::setw(3) << RunNumber
                   << "_"
-                  << std::setfill('0') << std::setw(2) << SubRunNumber
-                  << ".root";
+                  << std::setfill('0') << std::setw(2) << SubRunNumber;
+    if (Part >= 0)
+    {
+        OutputFileName << "_part" << std::setfill('0') << std::setw(2) << Part;
+    }
+    OutputFileName << ".root";
+    return OutputFileName.str();
+}
+
+/**
+ * Creates the results file of a subrun, see AnalysisResultsFileName, with its branches bound to the
+ * CurrentEvent buffer of the returned object
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ * @param Part Part number when the subrun is split across worker processes, -1 for the whole subrun
+ * @return Open results file, nullptr if it cannot be created
+ */
+std::unique_ptr<AnalysisResultsFile> OpenAnalysisResults(const Int_t RunNumber, const Int_t SubRunNumber,
+                                                         const Int_t Part)
+{
+    const std::string OutputFileName = AnalysisResultsFileName(RunNumber, SubRunNumber, Part);
 
-    TFile OutputFile(OutputFileName.str().c_str(), "RECREATE");
+    auto Output = std::make_unique<AnalysisResultsFile>();
+    Output->RunNumber = RunNumber;
+    Output->SubRunNumber = SubRunNumber;
+    Output->File = new TFile(OutputFileName.c_str(), "RECREATE");
+    if (Output->File->IsZombie())
+    {
+        std::cerr << "Failed to create " << OutputFileName << ", results of this subrun are lost" << std::endl;
+        delete Output->File;
+        return nullptr;
+    }
 
-    // Create a tree to store the results
-    TTree ResultTree("analysis", "Analysis Results");
+    // Create a tree to store the results, owned by the file
+    Output->File->cd();
+    Output->Tree = new TTree("analysis", "Analysis Results");
+    TTree& ResultTree = *Output->Tree;
 
     // Variables for tree branches
-    AnalysisResults CurrentEvent;
+    AnalysisResults& CurrentEvent = Output->CurrentEvent;
 
     // Set up branches
     ResultTree.Branch("event_number", &CurrentEvent.EventNumber);
@@ -552,6 +974,9 @@ void SaveAnalysisResults(const std::vector<AnalysisResults>& Results, const Int_
         ResultTree.Branch((Prefix + "rise_time").c_str(), &CurrentEvent.AnodeFits[Channel].RiseTimeConstant);
         ResultTree.Branch((Prefix + "rise_power").c_str(), &CurrentEvent.AnodeFits[Channel].RisePower);
         ResultTree.Branch((Prefix + "baseline").c_str(), &CurrentEvent.AnodeFits[Channel].Baseline);
+        ResultTree.Branch((Prefix + "fit_status").c_str(), &CurrentEvent.AnodeFits[Channel].FitStatus);
+        ResultTree.Branch((Prefix + "model").c_str(), &CurrentEvent.AnodeFits[Channel].Model);
+        BranchFitTelemetry(ResultTree, Prefix, CurrentEvent.AnodeFits[Channel].Telemetry);
     }
 
     // Branches for dynode fit parameters
@@ -564,14 +989,211 @@ void SaveAnalysisResults(const std::vector<AnalysisResults>& Results, const Int_
     ResultTree.Branch("dynode_undershoot_recovery", &CurrentEvent.DynodeFitParams.UndershootRecovery);
     ResultTree.Branch("dynode_fast_fraction", &CurrentEvent.DynodeFitParams.FastFraction);
     ResultTree.Branch("dynode_baseline", &CurrentEvent.DynodeFitParams.Baseline);
+    ResultTree.Branch("dynode_fit_status", &CurrentEvent.DynodeFitParams.FitStatus);
+    ResultTree.Branch("dynode_model", &CurrentEvent.DynodeFitParams.Model);
+    BranchFitTelemetry(ResultTree, "dynode_", CurrentEvent.DynodeFitParams.Telemetry);
+
+    // Branches for the joint anode fit
+    ResultTree.Branch("joint_anodes_fit_status", &CurrentEvent.JointAnodeFitParams.FitStatus);
+    BranchFitTelemetry(ResultTree, "joint_anodes_", CurrentEvent.JointAnodeFitParams.Telemetry);
+
+    return Output;
+}
+
+/**
+ * Appends one event to the results tree, full baskets are compressed and written as the tree fills
+ * @param Output File from OpenAnalysisResults
+ * @param Result Results of the event
+ */
+void FillAnalysisResults(AnalysisResultsFile& Output, const AnalysisResults& Result)
+{
+    // Copy channel by channel so the branch addresses stay valid
+    AnalysisResults& CurrentEvent = Output.CurrentEvent;
+    CurrentEvent.EventNumber = Result.EventNumber;
+    CurrentEvent.PosX = Result.PosX;
+    CurrentEvent.PosY = Result.PosY;
+    for (const auto& Channel : {"xa", "xb", "ya", "yb"})
+    {
+        const auto FitIter = Result.AnodeFits.find(Channel);
+        CurrentEvent.AnodeFits[Channel] = FitIter != Result.AnodeFits.end()
+                                              ? FitIter->second
+                                              : AnalysisResults::ChannelFit();
+    }
+    CurrentEvent.DynodeFitParams = Result.DynodeFitParams;
+    CurrentEvent.JointAnodeFitParams = Result.JointAnodeFitParams;
+    Output.Tree->Fill();
+}
+
+/**
+ * Writes the results tree and the per-subrun summaries, then closes the file
+ * @param Output File from OpenAnalysisResults, every result already filled
+ * @param Results Analysis results of the subrun, for the telemetry histograms
+ */
+void CloseAnalysisResults(AnalysisResultsFile& Output, const std::vector<AnalysisResults>& Results)
+{
+    std::cout << "\n[SaveAnalysisResults] Run " << std::setfill('0') << std::setw(3) << Output.RunNumber
+              << "_" << std::setfill('0') << std::setw(2) << Output.SubRunNumber
+              << ": Saving " << Output.Tree->GetEntries() << " events\n" << std::endl;
+
+    TFile& OutputFile = *Output.File;
+    OutputFile.cd();
+    Output.Tree->Write();
+
+    WriteFitTelemetryHistograms(Results, OutputFile);
+    WriteSelectionCutFlow(OutputFile);
+    WriteTraceFilterCounters(OutputFile);
+    WriteRejectTree(OutputFile);
+    OutputFile.Close();
+
+    delete Output.File;
+    Output.File = nullptr;
+    Output.Tree = nullptr;
+}
+
+void SaveAnalysisResults(const std::vector<AnalysisResults>& Results, const Int_t RunNumber, const Int_t SubRunNumber)
+{
+    const auto Output = OpenAnalysisResults(RunNumber, SubRunNumber);
+    if (!Output)
+    {
+        return;
+    }
 
-    // Fill tree with results
     for (const auto& Result : Results)
     {
-        CurrentEvent = Result;
-        ResultTree.Fill();
+        FillAnalysisResults(*Output, Result);
     }
+    CloseAnalysisResults(*Output, Results);
+}
+
+/**
+ * Prints how many fits of a subrun were cut off by the per-fit budget
+ * @param Results Analysis results of the subrun
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ */
+void PrintFitBudgetSummary(const std::vector<AnalysisResults>& Results, const Int_t RunNumber, const Int_t SubRunNumber)
+{
+    constexpr auto BudgetExceeded = static_cast<Int_t>(FitOutcome::BudgetExceeded);
+
+    std::map<std::string, Long64_t> BudgetHits = {
+        {"xa", 0}, {"xb", 0}, {"ya", 0}, {"yb", 0}, {"dynode", 0}, {"joint_anodes", 0}
+    };
+
+    for (const auto& Result : Results)
+    {
+        // A joint fit is one minimization, counted once rather than on each anode it filled
+        if (Result.JointAnodeFitParams.FitStatus >= 0)
+        {
+            if (Result.JointAnodeFitParams.FitStatus == BudgetExceeded)
+            {
+                BudgetHits["joint_anodes"]++;
+            }
+        }
+        else
+        {
+            for (const auto& [Channel, Fit] : Result.AnodeFits)
+            {
+                if (Fit.FitStatus == BudgetExceeded)
+                {
+                    BudgetHits[Channel]++;
+                }
+            }
+        }
+
+        if (Result.DynodeFitParams.FitStatus == BudgetExceeded)
+        {
+            BudgetHits["dynode"]++;
+        }
+    }
+
+    const FitBudget& Budget = GetFitBudget();
+
+    std::cout << "[FitBudget] Run " << std::setfill('0') << std::setw(3) << RunNumber
+              << "_" << std::setfill('0') << std::setw(2) << SubRunNumber
+              << " (max " << Budget.MaxFunctionCalls << " calls, " << Budget.MaxMicroseconds << " us):";
+    for (const auto& Channel : {"xa", "xb", "ya", "yb", "dynode", "joint_anodes"})
+    {
+        std::cout << " " << Channel << "=" << BudgetHits[Channel];
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Runs the independent and the joint anode fits on the same events and reports throughput and
+ * timing resolution. Resolution is the RMS of each anode onset relative to the dynode onset,
+ * histogrammed per channel and mode in OutputFileName
+ * @param InputFileName Raw trace file
+ * @param MaxEvents Number of qualifying events to compare
+ * @param OutputFileName Output file for the onset difference histograms
+ */
+void CompareJointAnodeFits(const char *InputFileName, const Long64_t MaxEvents, const char *OutputFileName)
+{
+    TFile *InputFile = OpenRootFile(InputFileName);
+    TTree *Tree = GetTree(InputFile, "pspmt");
+    const std::vector<Long64_t> QualifyingEvents = GetAllQualifyingEvents(Tree);
+    const AnodeFitMode PreviousMode = GetAnodeFitMode();
+
+    TFile OutputFile(OutputFileName, "RECREATE");
+
+    for (const auto& [Mode, ModeName] : {std::make_pair(AnodeFitMode::Independent, std::string("independent")),
+                                         std::make_pair(AnodeFitMode::Joint, std::string("joint"))})
+    {
+        SetAnodeFitMode(Mode);
+
+        std::map<std::string, TH1D*> OnsetDifferences;
+        for (const auto& Channel : JointAnodeChannelNames)
+        {
+            OnsetDifferences[Channel] = new TH1D(Form("%s_onset_vs_dynode_%s", Channel, ModeName.c_str()),
+                                                 Form("%s %s fit;Anode - dynode onset [ns];Events",
+                                                      Channel, ModeName.c_str()),
+                                                 400, -20, 20);
+        }
+
+        Long64_t Fitted = 0;
+        Long64_t Converged = 0;
+        const auto Start = std::chrono::steady_clock::now();
+
+        for (Long64_t i = 0; i < std::min(MaxEvents, static_cast<Long64_t>(QualifyingEvents.size())); i++)
+        {
+            const auto Result = GetEventFitParameters(Tree, QualifyingEvents[i]);
+            if (!Result)
+            {
+                continue;
+            }
+            Fitted++;
+
+            Bool_t AllConverged = Result->DynodeFitParams.FitStatus == static_cast<Int_t>(FitOutcome::Converged);
+            for (const auto& [Channel, Fit] : Result->AnodeFits)
+            {
+                AllConverged = AllConverged && Fit.FitStatus == static_cast<Int_t>(FitOutcome::Converged);
+            }
+            if (!AllConverged)
+            {
+                continue;
+            }
+            Converged++;
+
+            for (const auto& [Channel, Fit] : Result->AnodeFits)
+            {
+                OnsetDifferences[Channel]->Fill(Fit.PeakPosition - Result->DynodeFitParams.PeakPosition);
+            }
+        }
+
+        const Double_t Seconds = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - Start).count();
+
+        std::cout << "\n[CompareJointAnodeFits] " << ModeName << ": " << Fitted << " events, "
+                  << Converged << " fully converged, "
+                  << (Seconds > 0 ? Fitted / Seconds : 0) << " events/s" << std::endl;
+        for (const auto& [Channel, Histogram] : OnsetDifferences)
+        {
+            std::cout << "  " << Channel << " onset - dynode onset: mean " << Histogram->GetMean()
+                      << " ns, RMS " << Histogram->GetRMS() << " ns" << std::endl;
+            Histogram->Write();
+        }
+    }
+
+    SetAnodeFitMode(PreviousMode);
 
-    ResultTree.Write();
     OutputFile.Close();
-}
\ No newline at end of file
+    CloseRootFile(InputFile);
+}
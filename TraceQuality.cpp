@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <TFile.h>
+#include <TH2D.h>
+#include <TMath.h>
+
+#include "main.h"
+
+// Channels screened by the filter, in counter order
+constexpr const char *ScreenedChannels[] = {"xa", "xb", "ya", "yb", "dynode"};
+
+constexpr const char *TraceRejectReasonNames[TraceRejectReasons] = {"accepted", "pile_up", "clipped", "noisy_baseline"};
+
+/**
+ * Counts pulses in a trace from the zero crossings of its gap derivative S[i] - S[i - Gap].
+ * A pulse starts when the derivative rises above Threshold, the next one can only start after
+ * the derivative has crossed zero again, i.e. after a local maximum
+ * @param Samples Trace samples
+ * @param SampleCount Number of samples
+ * @param Gap Sample distance of the derivative, averages out sample-to-sample noise
+ * @param Threshold Minimum derivative of a rising edge, in ADC
+ * @return Number of rising edges
+ */
+template <typename T>
+Int_t CountRisingEdges(const T *Samples, const Int_t SampleCount, const Int_t Gap, const Double_t Threshold)
+{
+    Int_t Edges = 0;
+    Bool_t Armed = true;
+    for (Int_t i = Gap; i < SampleCount; i++)
+    {
+        const Double_t Derivative = static_cast<Double_t>(Samples[i]) - static_cast<Double_t>(Samples[i - Gap]);
+        if (Armed && Derivative > Threshold)
+        {
+            Edges++;
+            Armed = false;
+        }
+        else if (!Armed && Derivative < 0)
+        {
+            Armed = true;
+        }
+    }
+    return Edges;
+}
+
+/**
+ * Pre-fit screening of raw traces with per-subrun reject counters.
+ * The baseline RMS reference is the median over the first MaxBaselineTraces traces of each
+ * channel in a run, the baseline check is skipped until MinBaselineTraces have been seen
+ */
+class TraceFilterManager
+{
+private:
+    static constexpr Int_t MinBaselineTraces = 200;
+    static constexpr Int_t MaxBaselineTraces = 5000;
+    static constexpr Int_t MedianUpdateInterval = 100;
+
+    struct BaselineReference
+    {
+        std::vector<Double_t> RMSValues;
+        Double_t MedianRMS = -1;
+    };
+
+    TraceFilterPolicy Policy;
+    Int_t RunNumber = -1;
+    std::map<std::string, BaselineReference> Baselines;
+    std::map<std::string, std::array<Long64_t, TraceRejectReasons> > Counts;
+    Long64_t ScreenedEvents = 0;
+    Long64_t RejectedEvents = 0;
+
+    void ResetCounters()
+    {
+        for (const auto &Channel: ScreenedChannels)
+        {
+            Counts[Channel].fill(0);
+        }
+        ScreenedEvents = 0;
+        RejectedEvents = 0;
+    }
+
+    Double_t UpdateBaselineReference(const std::string &Channel, const Double_t BaselineRMS)
+    {
+        auto &Reference = Baselines[Channel];
+        const auto Collected = static_cast<Int_t>(Reference.RMSValues.size());
+        if (Collected < MaxBaselineTraces)
+        {
+            Reference.RMSValues.push_back(BaselineRMS);
+            if ((Collected + 1) % MedianUpdateInterval == 0 && Collected + 1 >= MinBaselineTraces)
+            {
+                std::vector<Double_t> Sorted = Reference.RMSValues;
+                auto Middle = Sorted.begin() + static_cast<std::ptrdiff_t>(Sorted.size() / 2);
+                std::nth_element(Sorted.begin(), Middle, Sorted.end());
+                Reference.MedianRMS = *Middle;
+            }
+        }
+        return Reference.MedianRMS;
+    }
+
+public:
+    TraceFilterManager()
+    {
+        ResetCounters();
+    }
+
+    void SetPolicy(const TraceFilterPolicy &NewPolicy)
+    {
+        Policy = NewPolicy;
+    }
+
+    [[nodiscard]] Bool_t IsEnabled() const
+    {
+        return Policy.Enabled;
+    }
+
+    void BeginSubRun(const Int_t Run)
+    {
+        if (Run != RunNumber)
+        {
+            Baselines.clear();
+            RunNumber = Run;
+        }
+        ResetCounters();
+    }
+
+    template <typename T>
+    TraceRejectReason Screen(const std::string &Channel, const T *Samples, const Int_t SampleCount,
+                             const TraceStatistics &Statistics)
+    {
+        TraceRejectReason Reason = TraceRejectReason::Accepted;
+
+        // Clipping, samples at the ADC full scale
+        if (Statistics.MaxValue >= Policy.AdcMaximum)
+        {
+            const auto Clipped = std::count_if(Samples, Samples + SampleCount, [this](const T Sample)
+            {
+                return static_cast<Double_t>(Sample) >= Policy.AdcMaximum;
+            });
+            if (Clipped > Policy.MaxClippedSamples)
+            {
+                Reason = TraceRejectReason::Clipped;
+            }
+        }
+
+        // Baseline window RMS against the run median of the channel
+        const Double_t MedianRMS = UpdateBaselineReference(Channel, Statistics.BaselineRMS);
+        if (Reason == TraceRejectReason::Accepted && MedianRMS > 0 &&
+            Statistics.BaselineRMS > Policy.MaxBaselineRMSRatio * MedianRMS)
+        {
+            Reason = TraceRejectReason::NoisyBaseline;
+        }
+
+        // Pile-up, more than one rising edge above noise and a fraction of the pulse amplitude
+        if (Reason == TraceRejectReason::Accepted)
+        {
+            const Double_t Amplitude = Statistics.MaxValue - Statistics.BaselineMean;
+            const Double_t Threshold = TMath::Max(Policy.EdgeThresholdSigma * TMath::Sqrt2() * Statistics.BaselineRMS,
+                                                  Policy.EdgeThresholdFraction * Amplitude);
+            if (CountRisingEdges(Samples, SampleCount, Policy.DerivativeGap, Threshold) > Policy.MaxPulses)
+            {
+                Reason = TraceRejectReason::PileUp;
+            }
+        }
+
+        Counts[Channel][static_cast<Int_t>(Reason)]++;
+        return Reason;
+    }
+
+    void CountEvent(const Bool_t Rejected)
+    {
+        ScreenedEvents++;
+        RejectedEvents += Rejected ? 1 : 0;
+    }
+
+    void PrintSummary(const Int_t Run, const Int_t SubRun) const
+    {
+        std::cout << "[TraceFilter] Run " << std::setfill('0') << std::setw(3) << Run
+                << "_" << std::setfill('0') << std::setw(2) << SubRun
+                << ": rejected " << RejectedEvents << " of " << ScreenedEvents << " events" << std::endl;
+        for (const auto &Channel: ScreenedChannels)
+        {
+            const auto &ChannelCounts = Counts.at(Channel);
+            std::cout << "  " << Channel << ":";
+            for (Int_t Reason = 1; Reason < TraceRejectReasons; Reason++)
+            {
+                std::cout << " " << TraceRejectReasonNames[Reason] << "=" << ChannelCounts[Reason];
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    void Write(TFile &OutputFile) const
+    {
+        OutputFile.cd();
+
+        constexpr auto ChannelCount = static_cast<Int_t>(std::size(ScreenedChannels));
+        auto *RejectHist = new TH2D("trace_filter", "Pre-Fit Trace Screening;Channel;Reason",
+                                    ChannelCount, 0, ChannelCount, TraceRejectReasons, 0, TraceRejectReasons);
+        for (Int_t ChannelIndex = 0; ChannelIndex < ChannelCount; ChannelIndex++)
+        {
+            RejectHist->GetXaxis()->SetBinLabel(ChannelIndex + 1, ScreenedChannels[ChannelIndex]);
+            const auto &ChannelCounts = Counts.at(ScreenedChannels[ChannelIndex]);
+            for (Int_t Reason = 0; Reason < TraceRejectReasons; Reason++)
+            {
+                RejectHist->SetBinContent(ChannelIndex + 1, Reason + 1, static_cast<Double_t>(ChannelCounts[Reason]));
+            }
+        }
+        for (Int_t Reason = 0; Reason < TraceRejectReasons; Reason++)
+        {
+            RejectHist->GetYaxis()->SetBinLabel(Reason + 1, TraceRejectReasonNames[Reason]);
+        }
+        RejectHist->Write();
+    }
+};
+
+// Create a global instance
+TraceFilterManager TraceFilter;
+
+/**
+ * Sets the pre-fit trace filter, screening is off unless Policy.Enabled is set
+ * @param Policy Pile-up, clipping and baseline limits
+ */
+void SetTraceFilterPolicy(const TraceFilterPolicy &Policy)
+{
+    TraceFilter.SetPolicy(Policy);
+}
+
+/**
+ * Whether GetEventFitParameters screens traces before fitting them
+ */
+Bool_t IsTraceFilterEnabled()
+{
+    return TraceFilter.IsEnabled();
+}
+
+/**
+ * Starts a new subrun, resets the reject counters and, on a new run, the baseline reference
+ * @param RunNumber Main run number of the subrun
+ */
+void BeginTraceFilterSubRun(const Int_t RunNumber)
+{
+    TraceFilter.BeginSubRun(RunNumber);
+}
+
+/**
+ * Classifies one raw trace as usable or not and counts the result for the current subrun.
+ * Checks run cheapest first and the first failing one gives the reason
+ * @param Channel Channel name, "dynode" for the dynode
+ * @param Samples Raw trace samples
+ * @param SampleCount Number of samples
+ * @param Statistics Seed statistics of the same trace
+ * @return Accepted, or the reason the trace should not be fitted
+ */
+TraceRejectReason ScreenTrace(const std::string &Channel, const UInt_t *Samples, const Int_t SampleCount,
+                              const TraceStatistics &Statistics)
+{
+    return TraceFilter.Screen(Channel, Samples, SampleCount, Statistics);
+}
+
+/**
+ * Counts a screened event for the subrun summary
+ * @param Rejected Whether any of its traces was rejected
+ */
+void CountScreenedEvent(const Bool_t Rejected)
+{
+    TraceFilter.CountEvent(Rejected);
+}
+
+/**
+ * Prints the per-channel reject counters of a subrun, no-op unless the filter is enabled
+ * @param RunNumber Main run number
+ * @param SubRunNumber Sub-run number
+ */
+void PrintTraceFilterSummary(const Int_t RunNumber, const Int_t SubRunNumber)
+{
+    if (TraceFilter.IsEnabled())
+    {
+        TraceFilter.PrintSummary(RunNumber, SubRunNumber);
+    }
+}
+
+/**
+ * Writes the reject counters of the current subrun as a channel x reason histogram
+ * @param OutputFile Open output file
+ */
+void WriteTraceFilterCounters(TFile &OutputFile)
+{
+    if (TraceFilter.IsEnabled())
+    {
+        TraceFilter.Write(OutputFile);
+    }
+}
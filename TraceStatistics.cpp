@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <limits>
+
+#include <TMath.h>
+
+#include "main.h"
+
+/**
+ * Seed statistics of a trace in a single pass over the raw samples.
+ *
+ * The baseline comes from the first BaselinePoints samples. The main scan tracks the running
+ * maximum; whenever it moves, the 1/e crossing and the post-peak minimum are restarted, so at the
+ * end they refer to the global maximum. Samples are reduced in fixed blocks of BlockSize with
+ * branch-free min/max loops the compiler vectorizes. A block only takes the scalar path if it can
+ * change the state: a new maximum, a possible 1/e crossing, or the start of the post-peak region.
+ * The threshold crossing always lies in a block with a new maximum, so it needs no block test.
+ *
+ * @param Samples Trace samples
+ * @param SampleCount Number of samples
+ * @param BaselinePoints Leading samples used for the baseline mean and RMS
+ * @param ThresholdSigma Rise threshold above the baseline, in baseline RMS
+ * @param UndershootOffset Distance after the maximum where the post-peak minimum search starts
+ * @return Statistics, MaxIndex is -1 for an empty trace
+ */
+template <typename T>
+TraceStatistics ComputeTraceStatistics(const T *Samples, const Int_t SampleCount, const Int_t BaselinePoints,
+                                       const Double_t ThresholdSigma, const Int_t UndershootOffset)
+{
+    TraceStatistics Statistics;
+    if (!Samples || SampleCount <= 0)
+    {
+        return Statistics;
+    }
+
+    // Baseline
+    const Int_t BaselineSamples = TMath::Max(1, TMath::Min(BaselinePoints, SampleCount));
+    Double_t Sum = 0;
+    Double_t SumSquares = 0;
+    for (Int_t i = 0; i < BaselineSamples; i++)
+    {
+        const auto Y = static_cast<Double_t>(Samples[i]);
+        Sum += Y;
+        SumSquares += Y * Y;
+    }
+    Statistics.BaselineMean = Sum / BaselineSamples;
+    Statistics.BaselineRMS = TMath::Sqrt(TMath::Max(0.0, SumSquares / BaselineSamples -
+                                                         Statistics.BaselineMean * Statistics.BaselineMean));
+
+    const Double_t Threshold = Statistics.BaselineMean + ThresholdSigma * Statistics.BaselineRMS;
+    Double_t DecayLevel = std::numeric_limits<Double_t>::lowest();
+    Int_t MinimumStart = std::numeric_limits<Int_t>::max();
+    Statistics.MaxValue = std::numeric_limits<Double_t>::lowest();
+    Statistics.PostPeakMin = std::numeric_limits<Double_t>::max();
+
+    const auto Step = [&](const Int_t Index)
+    {
+        const auto Y = static_cast<Double_t>(Samples[Index]);
+
+        if (Statistics.ThresholdCrossing < 0 && Y > Threshold)
+        {
+            Statistics.ThresholdCrossing = Index;
+        }
+
+        if (Y > Statistics.MaxValue)
+        {
+            Statistics.MaxValue = Y;
+            Statistics.MaxIndex = Index;
+            DecayLevel = Statistics.BaselineMean + (Y - Statistics.BaselineMean) / M_E;
+            Statistics.DecayCrossing = -1;
+            MinimumStart = Index + UndershootOffset;
+            Statistics.PostPeakMin = std::numeric_limits<Double_t>::max();
+            Statistics.PostPeakMinIndex = -1;
+        }
+
+        if (Statistics.DecayCrossing < 0 && Y <= DecayLevel)
+        {
+            Statistics.DecayCrossing = Index;
+        }
+
+        if (Index >= MinimumStart && Y < Statistics.PostPeakMin)
+        {
+            Statistics.PostPeakMin = Y;
+            Statistics.PostPeakMinIndex = Index;
+        }
+    };
+
+    constexpr Int_t BlockSize = 16;
+    Int_t Start = 0;
+    for (; Start + BlockSize <= SampleCount; Start += BlockSize)
+    {
+        const T *Block = Samples + Start;
+        T BlockMax = Block[0];
+        T BlockMin = Block[0];
+        for (Int_t j = 1; j < BlockSize; j++)
+        {
+            BlockMax = std::max(BlockMax, Block[j]);
+            BlockMin = std::min(BlockMin, Block[j]);
+        }
+
+        const Bool_t NewMaximum = static_cast<Double_t>(BlockMax) > Statistics.MaxValue;
+        const Bool_t DecayCrossing = Statistics.DecayCrossing < 0 && static_cast<Double_t>(BlockMin) <= DecayLevel;
+        const Bool_t MinimumStarts = Start < MinimumStart && Start + BlockSize > MinimumStart;
+
+        if (NewMaximum || DecayCrossing || MinimumStarts)
+        {
+            for (Int_t j = 0; j < BlockSize; j++)
+            {
+                Step(Start + j);
+            }
+        }
+        else if (Start >= MinimumStart && static_cast<Double_t>(BlockMin) < Statistics.PostPeakMin)
+        {
+            Statistics.PostPeakMin = BlockMin;
+            Statistics.PostPeakMinIndex = Start + static_cast<Int_t>(std::find(Block, Block + BlockSize, BlockMin) - Block);
+        }
+    }
+    for (; Start < SampleCount; Start++)
+    {
+        Step(Start);
+    }
+
+    // No sample past the offset, report the baseline
+    if (Statistics.PostPeakMinIndex < 0)
+    {
+        Statistics.PostPeakMin = Statistics.BaselineMean;
+    }
+
+    return Statistics;
+}
+
+template TraceStatistics ComputeTraceStatistics<Short_t>(const Short_t *, Int_t, Int_t, Double_t, Int_t);
+template TraceStatistics ComputeTraceStatistics<UShort_t>(const UShort_t *, Int_t, Int_t, Double_t, Int_t);
+template TraceStatistics ComputeTraceStatistics<Int_t>(const Int_t *, Int_t, Int_t, Double_t, Int_t);
+template TraceStatistics ComputeTraceStatistics<UInt_t>(const UInt_t *, Int_t, Int_t, Double_t, Int_t);
+template TraceStatistics ComputeTraceStatistics<Double_t>(const Double_t *, Int_t, Int_t, Double_t, Int_t);
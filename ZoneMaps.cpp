@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TString.h>
+#include <TSystem.h>
+#include <TTree.h>
+
+#include "main.h"
+
+/**
+ * Records the min and max of scalar leaves per TTree cluster, the unit of basket I/O,
+ * so the selection can skip clusters that cannot contain a passing event. One pass per subrun,
+ * each variable is read through its own branch so the other branches are not decompressed.
+ * Written under a per-process temporary name and renamed, so readers never see a partial file
+ * @param TreeInput pspmt tree of the subrun
+ * @param FileName Zone map file to write
+ * @param Variables Scalar leaf names, usually GetSelectionVariables()
+ */
+void BuildZoneMaps(TTree *TreeInput, const char *FileName, const std::vector<std::string> &Variables)
+{
+    const Long64_t Entries = TreeInput->GetEntries();
+
+    std::vector<TLeaf *> Leaves;
+    for (const auto &Variable: Variables)
+    {
+        TLeaf *Leaf = TreeInput->GetLeaf(Variable.c_str());
+        if (!Leaf || !Leaf->GetBranch())
+        {
+            throw std::runtime_error("Zone map variable " + Variable + " is not a leaf of the tree");
+        }
+        Leaves.push_back(Leaf);
+    }
+
+    const TString TemporaryName = TString::Format("%s.%d.tmp", FileName, gSystem->GetPid());
+    TFile OutputFile(TemporaryName.Data(), "RECREATE");
+    if (OutputFile.IsZombie())
+    {
+        throw std::runtime_error("Failed to create zone map file: " + std::string(TemporaryName.Data()));
+    }
+
+    TTree ZoneTree("zone_maps", "Per-Cluster Ranges of the Selection Variables");
+    std::string Variable;
+    Long64_t FirstEntry = 0;
+    Long64_t EndEntry = 0;
+    Long64_t TreeEntries = Entries;
+    Double_t Min = 0;
+    Double_t Max = 0;
+    ZoneTree.Branch("variable", &Variable);
+    ZoneTree.Branch("first_entry", &FirstEntry);
+    ZoneTree.Branch("end_entry", &EndEntry);
+    ZoneTree.Branch("entries", &TreeEntries);
+    ZoneTree.Branch("min", &Min);
+    ZoneTree.Branch("max", &Max);
+
+    const auto Clusters = GetClusterRanges(TreeInput);
+    for (const auto &[Start, End]: Clusters)
+    {
+        FirstEntry = Start;
+        EndEntry = End;
+
+        for (size_t i = 0; i < Leaves.size(); i++)
+        {
+            Min = std::numeric_limits<Double_t>::max();
+            Max = std::numeric_limits<Double_t>::lowest();
+            for (Long64_t Entry = FirstEntry; Entry < EndEntry; Entry++)
+            {
+                Leaves[i]->GetBranch()->GetEntry(Entry);
+                const Double_t Value = Leaves[i]->GetValue(0);
+                Min = std::min(Min, Value);
+                Max = std::max(Max, Value);
+            }
+            Variable = Variables[i];
+            ZoneTree.Fill();
+        }
+    }
+    ZoneTree.Write();
+    OutputFile.Close();
+    if (gSystem->Rename(TemporaryName.Data(), FileName) != 0)
+    {
+        gSystem->Unlink(TemporaryName.Data());
+        throw std::runtime_error("Failed to write zone map file: " + std::string(FileName));
+    }
+
+    std::cout << "Saved zone maps of " << Variables.size() << " variables over " << Clusters.size()
+            << " clusters to " << FileName << std::endl;
+}
+
+/**
+ * Reads the zone maps of a subrun
+ * @param FileName Zone map file written by BuildZoneMaps
+ * @param TreeInput Tree the zones refer to, must have the entry count of the zone maps
+ * @return Zones in entry order
+ */
+std::vector<ClusterZone> LoadZoneMaps(const char *FileName, TTree *TreeInput)
+{
+    // Written next to the analysis output, not with the raw traces
+    TFile *ZoneFile = TFile::Open(FileName, "READ");
+    if (!ZoneFile || ZoneFile->IsZombie())
+    {
+        throw std::runtime_error("Failed to open zone map file: " + std::string(FileName));
+    }
+    TTree *ZoneTree = GetTree(ZoneFile, "zone_maps");
+
+    std::string *Variable = nullptr;
+    Long64_t FirstEntry = 0;
+    Long64_t EndEntry = 0;
+    Long64_t Entries = 0;
+    Double_t Min = 0;
+    Double_t Max = 0;
+    ZoneTree->SetBranchAddress("variable", &Variable);
+    ZoneTree->SetBranchAddress("first_entry", &FirstEntry);
+    ZoneTree->SetBranchAddress("end_entry", &EndEntry);
+    ZoneTree->SetBranchAddress("entries", &Entries);
+    ZoneTree->SetBranchAddress("min", &Min);
+    ZoneTree->SetBranchAddress("max", &Max);
+
+    std::vector<ClusterZone> Zones;
+    for (Long64_t i = 0; i < ZoneTree->GetEntries(); i++)
+    {
+        ZoneTree->GetEntry(i);
+        if (Zones.empty() || Zones.back().FirstEntry != FirstEntry)
+        {
+            ClusterZone Zone;
+            Zone.FirstEntry = FirstEntry;
+            Zone.EndEntry = EndEntry;
+            Zones.push_back(std::move(Zone));
+        }
+        Zones.back().Ranges[*Variable] = {Min, Max};
+    }
+
+    // ROOT allocated the string on the first entry, the tree must not keep writing to the locals
+    ZoneTree->ResetBranchAddresses();
+    delete Variable;
+    ZoneFile->Close();
+    delete ZoneFile;
+
+    if (TreeInput && TreeInput->GetEntries() != Entries)
+    {
+        throw std::runtime_error(std::string("Zone maps in ") + FileName + " do not match the tree, rebuild them");
+    }
+
+    return Zones;
+}
+
+/**
+ * Zone maps of a subrun for the compiled selection, building them on first use.
+ * Variables added to the selection after the build have no ranges and never skip a cluster
+ * @param TreeInput pspmt tree of the subrun
+ * @param FileName Zone map file of the subrun
+ * @return Zones in entry order
+ */
+std::vector<ClusterZone> GetZoneMaps(TTree *TreeInput, const char *FileName)
+{
+    if (gSystem->AccessPathName(FileName))
+    {
+        BuildZoneMaps(TreeInput, FileName, GetSelectionVariables());
+    }
+    return LoadZoneMaps(FileName, TreeInput);
+}
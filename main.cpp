@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 
 #include <TFile.h>
+#include <TSystem.h>
 #include <TTreeReaderValue.h>
 
 #include "main.h"
@@ -15,6 +17,88 @@ int main()
     {
         LoadRequiredLibraries();
 
+        // Per-fit budget, keeps pathological traces from stalling the event loop
+        FitBudget Budget;
+        Budget.MaxFunctionCalls = 2000;
+        Budget.MaxMicroseconds = 250000;
+        SetFitBudget(Budget);
+
+        // Joint, Staged, StagedWithPolish or Estimate (no minimization)
+        SetDynodeFitMode(DynodeFitMode::Joint);
+
+        // Seed the dynode decays from a Prony estimate and narrow their limits around it,
+        // off until validated against the current fits
+        SetDynodeDecaySeeding(false);
+
+        // Independent or Joint (one fit per event with a shared onset)
+        SetAnodeFitMode(AnodeFitMode::Independent);
+
+        // Model complexity per trace from amplitude, noise and saturation, disabled runs the full models
+        ModelSelectionPolicy AnodePolicy;
+        AnodePolicy.Enabled = false;
+        ModelSelectionPolicy DynodePolicy;
+        DynodePolicy.Enabled = false;
+        DynodePolicy.FullModelAmplitude = 3000;
+        DynodePolicy.ReducedModelAmplitude = 500;
+        SetModelSelectionPolicies(AnodePolicy, DynodePolicy);
+
+        // Event selection cuts, the built-in ones unless selection.conf exists
+        LoadSelection("selection.conf");
+
+        // Take the qualifying events from per-cut bitmaps instead of rescanning each subrun,
+        // the bitmaps are built on first use and any query from SelectionBitmapRange works without the trace file
+        constexpr Bool_t UseSelectionBitmaps = false;
+        SetSelectionFromEntryList(UseSelectionBitmaps);
+        // Throws here if a cut of the loaded selection has no bitmap
+        const BitmapQuery SelectionQuery = UseSelectionBitmaps ? SelectionBitmapQuery() : BitmapQuery();
+
+        // Skip TTree clusters whose per-cluster min/max cannot pass the scalar cuts, the zone maps
+        // are built on first use and only matter for trees sorted or clustered by the cut variables
+        constexpr Bool_t UseZoneMaps = false;
+
+        // Read each subrun from its skim, written from the raw traces on first use. The skim holds the
+        // qualifying events only, with position and the five analysed traces, so later passes skip the raw files
+        constexpr Bool_t UseSkims = false;
+
+        // Bit-pack the traces of newly written skims, smaller than the ROOT-compressed arrays and faster to decode
+        constexpr Bool_t PackSkimTraces = false;
+
+        // TTreeCache of the input trees, and per-stage bytes, read calls, cache hits and unzip time of every subrun
+        TreeCachePolicy CachePolicy;
+        CachePolicy.CacheBytes = 64LL << 20;
+        CachePolicy.LearnEntries = 100;
+        CachePolicy.ReportReads = false;
+        SetTreeCachePolicy(CachePolicy);
+
+        // Copy the raw trace files to local disk on first open and reuse the copies on later passes
+        StagingCachePolicy Staging;
+        Staging.Enabled = false;
+        Staging.Directory = "/tmp/pixie_staging";
+        Staging.ByteBudget = 200LL << 30;
+        SetStagingCachePolicy(Staging);
+
+        // Screen raw traces for pile-up, clipping and noisy baselines before any fit
+        TraceFilterPolicy FilterPolicy;
+        FilterPolicy.Enabled = false;
+        SetTraceFilterPolicy(FilterPolicy);
+
+        // Fit for the full analysis, Estimate for quick-look position maps from the fast estimators,
+        // Template to match the anodes against pulse_templates.root
+        constexpr AnalysisMode Mode = AnalysisMode::Fit;
+
+        // Read, screen, fit and write each subrun on separate threads, 0 fit workers processes events in turn
+        EventPipelineConfig PipelineConfig;
+        PipelineConfig.FitWorkers = 0;
+        PipelineConfig.QueueCapacity = 64;
+        PipelineConfig.MaxInFlight = 256;
+
+        // Keep the K slowest anode and dynode fits of every subrun for replay, 0 disables
+        constexpr Int_t SlowFitsToRecord = 0;
+        if (SlowFitsToRecord > 0)
+        {
+            EnableSlowFitRecorder(SlowFitsToRecord);
+        }
+
         if (0)
         {
             RiseTimeMapExtractor Extractor;
@@ -27,6 +111,50 @@ int main()
             return 0;
         }
 
+        // Measure the fast estimators against the fits on one subrun
+        if (0)
+        {
+            CompareEstimatesWithFits("pixie_bigrips_traces_055_20.root", 2000, "estimator_accuracy.root");
+
+            return 0;
+        }
+
+        // Measure the bytes read for the rootdev_vec_ members the analysis uses against whole ROOTDEV objects
+        if (0)
+        {
+            CompareRootDevReads("pixie_bigrips_traces_055_20.root", 20000);
+
+            return 0;
+        }
+
+        // Sweep the fits over a memory-mapped trace cache of one subrun, built on first use
+        if (0)
+        {
+            if (gSystem->AccessPathName("trace_cache_055_20.bin"))
+            {
+                BuildTraceCache("pixie_bigrips_traces_055_20.root", "trace_cache_055_20.bin");
+            }
+            FitTraceCache("trace_cache_055_20.bin", 2000);
+
+            return 0;
+        }
+
+        // Check the trace codec round trip and compare its size and speed with ROOT's compression algorithms
+        if (0)
+        {
+            BenchmarkTraceCodec("pixie_bigrips_traces_055_20.root", 20000);
+
+            return 0;
+        }
+
+        // Measure throughput and timing resolution of the joint anode fit against the independent fits
+        if (0)
+        {
+            CompareJointAnodeFits("pixie_bigrips_traces_055_20.root", 2000, "joint_anode_fits.root");
+
+            return 0;
+        }
+
         // Analyze only past runs
         if (0)
         {
@@ -112,95 +240,219 @@ int main()
             {116, 39}, {116, 40}
         };
 
-        Int_t ProcessedFiles = 0;
-        constexpr Int_t MaxFilesToProcess = 100;
-
-        for (const auto &[RunNumber, SubRunNumber]: RunsToProcess)
+        // Build position-binned anode templates from fitted runs, used by AnalysisMode::Template
+        if (0)
         {
-            if (ProcessedFiles >= MaxFilesToProcess)
-            {
-                std::cout << "Reached maximum number of files to process ("
-                        << MaxFilesToProcess << ")" << std::endl;
-                break;
-            }
+            BuildPulseTemplates(RunsToProcess, "pulse_templates.root");
+
+            return 0;
+        }
 
+        // Skims are already selected, bitmaps and zone maps only apply to raw trees
+        constexpr Bool_t BitmapSelection = UseSelectionBitmaps && !UseSkims;
+        constexpr Bool_t ZoneMapSelection = UseZoneMaps && !UseSelectionBitmaps && !UseSkims;
+
+        // Open the input file of a subrun into Input.File and Tree, returns false if the subrun is skipped
+        const auto OpenSubRun = [](SubRunInput &Input) -> Bool_t
+        {
             // Construct input filename
             std::ostringstream InputFileName;
             InputFileName << "pixie_bigrips_traces_"
-                    << std::setfill('0') << std::setw(3) << RunNumber
+                    << std::setfill('0') << std::setw(3) << Input.RunNumber
                     << "_"
-                    << std::setfill('0') << std::setw(2) << SubRunNumber
+                    << std::setfill('0') << std::setw(2) << Input.SubRunNumber
                     << ".root";
 
-            std::cout << "\nProcessing file: " << InputFileName.str() << std::endl;
+            // Open input file and get tree, a missing or broken subrun is skipped
+            try
+            {
+                Input.File = UseSkims
+                                 ? OpenSkimFile(InputFileName.str().c_str(), Input.RunNumber, Input.SubRunNumber,
+                                                PackSkimTraces)
+                                 : OpenRootFile(InputFileName.str().c_str());
+                Input.Tree = GetTree(Input.File, UseSkims ? "skim" : "pspmt");
+            }
+            catch (const std::exception &Error)
+            {
+                Input.Error = Error.what();
+                CloseRootFile(Input.File);
+                Input.File = nullptr;
+                return false;
+            }
+            return true;
+        };
+
+        // Open a subrun and get its qualifying events, runs on the prefetch thread when PrefetchLookahead > 0
+        const auto LoadSubRun = [&SelectionQuery, &OpenSubRun](SubRunInput &Input)
+        {
+            if (!OpenSubRun(Input))
+            {
+                return;
+            }
+
+            // Get qualifying events
+            const TString BitmapFileName = TString::Format("selection_bitmaps_%03d_%02d.root",
+                                                           Input.RunNumber, Input.SubRunNumber);
+            const TString ZoneMapFileName = TString::Format("zone_maps_%03d_%02d.root",
+                                                            Input.RunNumber, Input.SubRunNumber);
+            TreeReadStage Stage = BeginTreeReads(Input.Tree);
+            const std::vector<ClusterZone> ZoneMaps =
+                    ZoneMapSelection ? GetZoneMaps(Input.Tree, ZoneMapFileName.Data()) : std::vector<ClusterZone>();
+            Input.QualifyingEvents =
+                    BitmapSelection
+                        ? GetBitmapQualifyingEvents(Input.Tree, BitmapFileName.Data(), SelectionQuery)
+                        : ZoneMapSelection
+                              ? GetAllQualifyingEvents(Input.Tree, &ZoneMaps)
+                              : GetAllQualifyingEvents(Input.Tree);
+            Input.ReadStages.emplace_back("selection", EndTreeReads(Input.Tree, Stage));
+        };
+
+        // Fit the qualifying events of a loaded subrun, or of its Part-th of Parts slices, and write the results,
+        // Part -1 for the whole subrun. Returns the events with results, -1 if the subrun was skipped
+        const auto AnalyseSubRun = [&](SubRunInput &Input, const Int_t Part, const Int_t Parts) -> Long64_t
+        {
+            const Int_t RunNumber = Input.RunNumber;
+            const Int_t SubRunNumber = Input.SubRunNumber;
+            TFile *InputFile = Input.File;
+            TTree *Tree = Input.Tree;
+            std::vector<Long64_t> QualifyingEvents = std::move(Input.QualifyingEvents);
+
+            const TString InputFileName = TString::Format("pixie_bigrips_traces_%03d_%02d.root",
+                                                          RunNumber, SubRunNumber);
+            std::cout << "\nProcessing file: " << InputFileName;
+            if (Part >= 0)
+            {
+                std::cout << ", part " << Part + 1 << " of " << Parts;
+            }
+            std::cout << std::endl;
 
-            // Open input file and get tree
-            TFile *InputFile = OpenRootFile(InputFileName.str().c_str());
-            TTree *Tree = GetTree(InputFile, "pspmt");
+            if (!InputFile)
+            {
+                std::cerr << "Skipping " << InputFileName << ": " << Input.Error << std::endl;
+                return -1;
+            }
+
+            BeginSlowFitSubRun(RunNumber, SubRunNumber);
+            BeginTraceFilterSubRun(RunNumber);
+            BeginEventStatusSubRun();
 
             // Create output directory for trace images
             const auto OutputDirectory = CreateTraceDirectory({RunNumber, SubRunNumber});
 
-            // Get qualifying events
-            const std::vector<Long64_t> QualifyingEvents = GetAllQualifyingEvents(Tree);
+            // The cut flow of a split subrun is carried by its first part
+            if (Part <= 0 && !BitmapSelection && !UseSkims)
+            {
+                PrintSelectionCutFlow(RunNumber, SubRunNumber);
+            }
 
             if (QualifyingEvents.empty())
             {
                 std::cout << "No qualifying events found in "
-                        << InputFileName.str() << std::endl;
-                InputFile->Close();
-                delete InputFile;
-                continue;
+                        << InputFileName << std::endl;
+                CloseRootFile(InputFile);
+                return 0;
             }
 
-            // Store analysis results
-            std::vector<AnalysisResults> Results;
-            Results.reserve(QualifyingEvents.size());
+            // Results are written to the output file as events complete
+            const auto Output = OpenAnalysisResults(RunNumber, SubRunNumber, Part);
 
             // Process all qualifying events
             std::cout << "Processing " << QualifyingEvents.size() << " qualifying events..." << std::endl;
 
-            int EventCounter = 0;
+            TreeReadStage FitReads = BeginTreeReads(Tree);
+            const std::vector<AnalysisResults> Results = RunEventPipeline(Tree, QualifyingEvents, Mode, PipelineConfig,
+                                                                          Output.get());
+            Input.ReadStages.emplace_back(Mode == AnalysisMode::Fit ? "fit" : "estimate", EndTreeReads(Tree, FitReads));
+            std::cout << "\nFinished processing events." << std::endl;
+
+            // Create graphs for a subset of events
+            if (Part <= 0)
+            {
+                constexpr Long64_t EventsToGraph = 100;
+                std::cout << "Graphing first " << EventsToGraph << " qualifying events..." << std::endl;
+                TreeReadStage GraphReads = BeginTreeReads(Tree);
+                GraphFirstNEvents(Tree, QualifyingEvents, EventsToGraph, OutputDirectory.c_str());
+                Input.ReadStages.emplace_back("graphs", EndTreeReads(Tree, GraphReads));
+            }
 
-            for (Long64_t i = 0; i < static_cast<Long64_t>(QualifyingEvents.size()); i++) // static_cast<Long64_t>(QualifyingEvents.size())
+            // Close the output ROOT file with the per-subrun summaries
+            if (Output)
             {
-                EventCounter++;
+                CloseAnalysisResults(*Output, Results);
+            }
+            PrintFitBudgetSummary(Results, RunNumber, SubRunNumber);
+            PrintTraceFilterSummary(RunNumber, SubRunNumber);
+            PrintEventStatusSummary(RunNumber, SubRunNumber);
+            PrintTreeReadSummary(RunNumber, SubRunNumber, Input.ReadStages);
+
+            CloseRootFile(InputFile);
+
+            return static_cast<Long64_t>(Results.size());
+        };
+
+        constexpr Int_t MaxFilesToProcess = 100;
 
-                const Long64_t EventNumber = QualifyingEvents[i];
+        // Fork worker processes over the subruns instead of the threaded loop, each with its own copy of the
+        // ROOT and analysis globals. PartsPerSubRun > 1 also splits every subrun, its parts are merged back
+        ProcessPoolConfig PoolConfig;
+        PoolConfig.Workers = 0;
+        PoolConfig.PartsPerSubRun = 1;
 
-                if (EventCounter % 1000 == 0)
+        if (PoolConfig.Workers > 0)
+        {
+            const std::vector<std::pair<Int_t, Int_t> > SubRuns(
+                RunsToProcess.begin(),
+                RunsToProcess.begin() + std::min<size_t>(RunsToProcess.size(), MaxFilesToProcess));
+
+            // A whole subrun is selected by its worker, a part gets its slice from the selection in this process
+            RunSubRunProcesses(SubRuns, PoolConfig, LoadSubRun, [&](const SubRunTask &Task) -> Long64_t
+            {
+                SubRunInput Input;
+                Input.RunNumber = Task.RunNumber;
+                Input.SubRunNumber = Task.SubRunNumber;
+                if (Task.Part < 0)
                 {
-                    std::cout << "Processing event " << EventCounter << " of "
-                            << QualifyingEvents.size() << "..." << std::endl;
+                    BeginSelectionSubRun();
+                    LoadSubRun(Input);
                 }
-
-                auto EventResults = GetEventFitParameters(Tree, EventNumber);
-                if (EventResults)
+                else if (OpenSubRun(Input))
                 {
-                    Results.push_back(*EventResults);
+                    Input.QualifyingEvents = Task.Events;
                 }
+                return AnalyseSubRun(Input, Task.Part, Task.Parts);
+            });
+        }
+        else
+        {
+            // Open and select the next subruns in the background while the current one is fitted, 0 loads on demand
+            constexpr Int_t PrefetchLookahead = 1;
+            StartSubRunPrefetch(RunsToProcess, PrefetchLookahead, LoadSubRun);
 
-                // Break after processing N events, for testing purposes
-                // if (EventCounter >= 1000)
-                // {
-                //     std::cout << "Finished processing event " << EventCounter << std::endl;
-                //     break;
-                // }
-            }
-            std::cout << "\nFinished processing events." << std::endl;
-
-            // Create graphs for a subset of events
-            constexpr Long64_t EventsToGraph = 100;
-            std::cout << "Graphing first " << EventsToGraph << " qualifying events..." << std::endl;
-            GraphFirstNEvents(Tree, QualifyingEvents, EventsToGraph, OutputDirectory.c_str());
+            Int_t ProcessedFiles = 0;
 
-            // Save results to output ROOT file
-            SaveAnalysisResults(Results, RunNumber, SubRunNumber);
+            SubRunInput Input;
+            while (NextPrefetchedSubRun(Input))
+            {
+                if (ProcessedFiles >= MaxFilesToProcess)
+                {
+                    std::cout << "Reached maximum number of files to process ("
+                            << MaxFilesToProcess << ")" << std::endl;
+                    CloseRootFile(Input.File);
+                    break;
+                }
 
-            InputFile->Close();
-            delete InputFile;
+                if (AnalyseSubRun(Input, -1, 1) >= 0)
+                {
+                    ProcessedFiles++;
+                }
+            }
+            StopSubRunPrefetch();
+            PrintStagingCacheSummary("RunsToProcess");
 
-            ProcessedFiles++;
+            if (SlowFitsToRecord > 0)
+            {
+                SaveSlowFits("slow_fits.root");
+            }
         }
 
         // Perform position analysis on all processed runs
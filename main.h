@@ -1,7 +1,12 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
 #include <optional>
 
+#include <TEntryList.h>
 #include <TGraph.h>
 #include <TFitResult.h>
 #include <TFile.h>
@@ -10,6 +15,288 @@
 
 #include "PaassRootStruct.hpp"
 
+// Outcome of a single trace fit, stored per channel in the results tree
+enum class FitOutcome : Int_t
+{
+    Converged = 0,
+    Failed = 1,
+    BudgetExceeded = 2,
+    Estimated = 3, // Parameters from the non-fit estimators, without minimization
+    TemplateMatched = 4 // Amplitude, onset and baseline from a position-binned pulse template
+};
+
+// Per-fit resource budget, a limit of 0 disables that check
+struct FitBudget
+{
+    Int_t MaxFunctionCalls = 2000;
+    Long64_t MaxMicroseconds = 250000;
+};
+
+// How the event loop extracts pulse parameters
+enum class AnalysisMode
+{
+    Fit, // TF1 fits of every channel
+    Estimate, // Fast non-fit estimators, same results tree
+    Template // Anodes matched against position-binned templates, estimators elsewhere
+};
+
+// How FitDynodePeak minimizes the 9 DynodePeakFunction parameters
+enum class DynodeFitMode
+{
+    Joint, // All parameters at once over the whole trace
+    Staged, // Peak region first, then the undershoot tail with the peak fixed
+    StagedWithPolish, // Staged, followed by a joint fit starting from the staged values
+    Estimate // No minimization, decay parameters from EstimateDynodeDecays
+};
+
+// Model complexity used for one trace, stored with its result
+enum class PulseModel : Int_t
+{
+    Full = 0, // AnodePeakFunction, or the 9-parameter DynodePeakFunction
+    Reduced = 1, // Anode rise shape fixed from the maps; dynode without undershoot and slow component
+    Estimator = 2, // Non-fit estimators
+    Template = 3 // Position-binned template match
+};
+
+// Per-trace model choice from pre-fit features, see SelectPulseModel
+struct ModelSelectionPolicy
+{
+    Bool_t Enabled = false; // Every trace gets the full model when disabled
+    Double_t FullModelAmplitude = 1000; // ADC above baseline
+    Double_t ReducedModelAmplitude = 300; // Below it only the estimators run
+    Double_t MinSignalToNoise = 20; // Amplitude over baseline RMS, below it only the estimators run
+    Double_t SaturationLevel = 16383; // ADC full scale, saturated traces are estimated
+};
+
+// Why a trace was kept out of the fits, see ScreenTrace
+enum class TraceRejectReason : Int_t
+{
+    Accepted = 0,
+    PileUp = 1, // More than MaxPulses rising edges
+    Clipped = 2, // Samples at the ADC full scale
+    NoisyBaseline = 3 // Baseline RMS far above the run median of the channel
+};
+
+constexpr Int_t TraceRejectReasons = 4;
+
+// Pre-fit screening of raw traces, an event with any rejected trace is not fitted
+struct TraceFilterPolicy
+{
+    Bool_t Enabled = false;
+    Int_t MaxPulses = 1;
+    Int_t DerivativeGap = 4; // Samples between the points of the pile-up derivative
+    Double_t EdgeThresholdSigma = 8; // Rising edge threshold in derivative noise
+    Double_t EdgeThresholdFraction = 0.1; // Rising edge threshold as a fraction of the amplitude
+    Double_t AdcMaximum = 16383;
+    Int_t MaxClippedSamples = 0;
+    Double_t MaxBaselineRMSRatio = 3; // Baseline RMS over the run median
+};
+
+// Why an event produced no results, counted per subrun and kept in the rejects tree
+enum class EventStatus : Int_t
+{
+    Accepted = 0,
+    NotSelected = 1, // Fails MeetsSelectionCriteria
+    InvalidInput = 2, // Missing tree or unreadable entry
+    TraceRejected = 3, // Pre-fit screening, see ScreenTrace
+    PositionOutOfRange = 4, // No rise power for the event position
+    FitFailed = 5, // A fit or estimator returned no parameters
+    Exception = 6 // Unexpected exception caught at the event boundary
+};
+
+constexpr Int_t EventStatusCount = 7;
+
+struct EventReport
+{
+    EventStatus Status = EventStatus::Accepted;
+    std::string Channel; // Channel that decided the status, empty for event-level reasons
+    std::string Detail; // Exception message for EventStatus::Exception
+};
+
+// Trace slots of skims and trace caches, a slot with zero samples had no valid trace
+constexpr Int_t SkimSlots = 5;
+constexpr const char *SkimSlotNames[SkimSlots] = {"xa", "xb", "ya", "yb", "dynode"};
+constexpr Int_t SkimDynodeSlot = 4;
+
+// Fixed part of a trace cache record, followed by SkimSlots x TraceLength UShort_t samples, see WriteTraceCache
+struct TraceCacheRecord
+{
+    Long64_t EventNumber; // Entry in the raw trace file
+    Double_t PosX;
+    Double_t PosY;
+    Int_t Channels[SkimSlots]; // Channel number per slot, -1 if empty
+    Int_t SampleCounts[SkimSlots];
+};
+
+// Trace data that did not fit the fixed-width UShort_t slots of a skim or trace cache, see FillTraceSlots
+struct TraceSlotLosses
+{
+    Long64_t TruncatedTraces = 0; // Traces longer than the slot width, cut at the width
+    Long64_t ClippedSamples = 0; // Samples above the UShort_t range, stored as its maximum
+};
+
+// Value ranges of the scalar selection variables within one TTree cluster, see BuildZoneMaps
+struct ClusterZone
+{
+    Long64_t FirstEntry = 0;
+    Long64_t EndEntry = 0; // One past the last entry
+    std::map<std::string, std::pair<Double_t, Double_t> > Ranges; // Variable -> min, max
+};
+
+// Local copies of the raw trace files, see OpenRootFile
+struct StagingCachePolicy
+{
+    Bool_t Enabled = false;
+    std::string Directory = "/tmp/pixie_staging"; // Local disk, created if missing
+    Long64_t ByteBudget = 200LL << 30; // Least recently used copies are evicted above this
+    Bool_t VerifyOnHit = false; // Re-hash the copy against its stored checksum on every open
+};
+
+// TTreeCache configuration of the trees opened through GetTree
+struct TreeCachePolicy
+{
+    Long64_t CacheBytes = -1; // -1 keeps ROOT's default, 0 disables the cache
+    Int_t LearnEntries = 100; // Entries over which the cache learns the branches that are read
+    std::vector<std::string> Branches; // Added up front with their sub-branches, e.g. rootdev_vec_
+    Bool_t ReportReads = false; // Measure and print the reads of each stage, see BeginTreeReads
+};
+
+// Reads of one processing stage against one tree
+struct TreeReadStats
+{
+    Long64_t BytesRead = 0; // From storage, cache fills included
+    Long64_t ReadCalls = 0;
+    Long64_t CachedBytes = 0; // Fetched through the TTreeCache
+    Long64_t UncachedBytes = 0; // Fetched around it, branches or entries the cache missed
+    Double_t UnzipSeconds = 0;
+    Double_t WallSeconds = 0;
+};
+
+class TTreePerfStats;
+
+// Counters at the start of a read stage, see BeginTreeReads
+struct TreeReadStage
+{
+    TTreePerfStats *PerfStats = nullptr; // Null if the stage is not measured
+    Long64_t BytesRead = 0;
+    Long64_t ReadCalls = 0;
+    Long64_t CachedBytes = 0;
+    Long64_t UncachedBytes = 0;
+    std::chrono::steady_clock::time_point Start;
+};
+
+// Compiled selection, private to EventSelection.cpp, forked per subrun prefetch thread
+class SelectionPipeline;
+
+// One subrun opened and selected for the event loop, see StartSubRunPrefetch
+struct SubRunInput
+{
+    Int_t RunNumber = 0;
+    Int_t SubRunNumber = 0;
+    TFile *File = nullptr; // Null if the subrun is skipped
+    TTree *Tree = nullptr;
+    std::string Error; // Why the subrun is skipped
+    std::vector<Long64_t> QualifyingEvents;
+    std::shared_ptr<SelectionPipeline> Selection; // Pipeline that scanned the subrun, with its cut flow
+    std::vector<std::pair<std::string, TreeReadStats> > ReadStages; // Selection and cache warming reads
+};
+
+// Opens a subrun into SubRunInput::File and Tree and fills its QualifyingEvents
+using SubRunLoader = std::function<void(SubRunInput &)>;
+
+// One task of a worker process, a whole subrun or one slice of its qualifying events
+struct SubRunTask
+{
+    Int_t RunNumber = -1;
+    Int_t SubRunNumber = -1;
+    Int_t Part = -1; // -1 for the whole subrun
+    Int_t Parts = 1;
+    std::vector<Long64_t> Events; // Qualifying entries of a part, selected once by the parent process
+    std::shared_ptr<SelectionPipeline> Selection; // Pipeline with the cut flow of the subrun, for a part
+};
+
+// Processes a task in a worker process, returns the events with results or -1 if the subrun was skipped
+using SubRunTaskProcessor = std::function<Long64_t(const SubRunTask &)>;
+
+// Forked worker processes over the run list, see RunSubRunProcesses
+struct ProcessPoolConfig
+{
+    Int_t Workers = 0; // 0 keeps the single-process event loop
+    Int_t PartsPerSubRun = 1; // Slices of each subrun processed as separate tasks, merged back afterwards
+    std::string SlowFitsFileName = "slow_fits.root"; // Merged from the per-task slow fit files
+};
+
+// Cut combination over selection bitmaps, the clauses are ANDed and each is the OR of its bitmaps
+using BitmapQuery = std::vector<std::vector<std::string> >;
+
+// How GetEventFitParameters fits the four anodes
+enum class AnodeFitMode
+{
+    Independent, // One FitPeakToTrace per anode
+    Joint // One FitAnodesJointly per event, onset shared by all anodes, always the full model:
+          // the anode ModelSelectionPolicy does not apply
+};
+
+// Axis layout of the joint anode fit, see JointAnodePeakFunction
+constexpr Int_t JointAnodeChannels = 4;
+constexpr Double_t JointAnodeStride = 100000;
+constexpr const char *JointAnodeChannelNames[JointAnodeChannels] = {"xa", "xb", "ya", "yb"};
+
+// Non-iterative dynode decay estimate, used to seed and bound FitDynodePeak
+struct DynodeDecayEstimate
+{
+    Double_t Amplitude = -1;
+    Double_t FastDecay = -1;
+    Double_t SlowDecay = -1;
+    Double_t FastFraction = -1;
+    Double_t UndershootAmp = 0;
+    Double_t UndershootRecovery = -1; // -1 if no undershoot was found
+};
+
+// Convergence telemetry of a single fit, written next to its parameters
+struct FitTelemetry
+{
+    Double_t Chi2 = -1;
+    Int_t Ndf = -1;
+    Int_t MinimizerStatus = -1;
+    Double_t Edm = -1;
+    Int_t Iterations = -1;
+    Int_t FunctionCalls = -1;
+    Double_t WallTime = -1; // microseconds
+};
+
+struct FitReport
+{
+    FitOutcome Outcome = FitOutcome::Failed;
+    FitTelemetry Telemetry;
+    std::vector<Double_t> InitialParameters;
+    std::vector<Double_t> FinalParameters;
+};
+
+// Fit seeding statistics of one trace, indices are sample numbers, -1 if not found
+struct TraceStatistics
+{
+    Double_t BaselineMean = 0;
+    Double_t BaselineRMS = 0;
+    Int_t MaxIndex = -1;
+    Double_t MaxValue = 0;
+    Int_t ThresholdCrossing = -1; // First sample above the rise threshold
+    Int_t DecayCrossing = -1; // First sample from the maximum on at or below baseline + amplitude / e
+    Int_t PostPeakMinIndex = -1;
+    Double_t PostPeakMin = 0; // Minimum from the undershoot offset after the maximum on
+};
+
+// One event as read from the tree, see DecodeEvent, with the seed statistics from PrepareEventFits
+struct DecodedEvent
+{
+    Long64_t Entry = -1;
+    Long64_t EventNumber = -1;
+    Double_t PosX = 0;
+    Double_t PosY = 0;
+    std::vector<processor_struct::ROOTDEV> Devices;
+    std::vector<TraceStatistics> Statistics; // Per device, empty until PrepareEventFits
+};
+
 struct AnalysisResults
 {
     Long64_t EventNumber = -1;
@@ -25,6 +312,9 @@ struct AnalysisResults
         Double_t RiseTimeConstant = -1;
         Double_t RisePower = -1;
         Double_t Baseline = -1;
+        Int_t FitStatus = -1;
+        Int_t Model = -1; // PulseModel
+        FitTelemetry Telemetry;
     };
 
     std::map<std::string, ChannelFit> AnodeFits; // xa, xb, ya, yb
@@ -40,7 +330,36 @@ struct AnalysisResults
         Double_t UndershootRecovery = -1;
         Double_t FastFraction = -1;
         Double_t Baseline = -1;
+        Int_t FitStatus = -1;
+        Int_t Model = -1; // PulseModel
+        FitTelemetry Telemetry;
     } DynodeFitParams;
+
+    // The single minimization of AnodeFitMode::Joint, FitStatus -1 for independent anode fits.
+    // Its telemetry is kept here once, the anode channels only carry its outcome
+    struct JointAnodeFit
+    {
+        Int_t FitStatus = -1;
+        FitTelemetry Telemetry;
+    } JointAnodeFitParams;
+};
+
+// Results file of a subrun filled event by event, see OpenAnalysisResults
+struct AnalysisResultsFile
+{
+    Int_t RunNumber = -1;
+    Int_t SubRunNumber = -1;
+    TFile *File = nullptr;
+    TTree *Tree = nullptr; // Owned by File
+    AnalysisResults CurrentEvent; // Branch buffer of Tree
+};
+
+// Thread layout of RunEventPipeline, 0 fit workers processes the events on the calling thread
+struct EventPipelineConfig
+{
+    Int_t FitWorkers = 0;
+    Int_t QueueCapacity = 64; // Slots per stage queue, rounded up to a power of two
+    Int_t MaxInFlight = 256; // Events read but not yet written, bounds the decoded traces in memory
 };
 
 struct AnalysisHistograms
@@ -63,22 +382,157 @@ struct ChannelFitData
 // RootInput
 void LoadRequiredLibraries();
 
+void SetStagingCachePolicy(const StagingCachePolicy &Policy);
+
+void PrintStagingCacheSummary(const char *Batch);
+
 TFile *OpenRootFile(const char *FileName);
 
+void CloseRootFile(TFile *InputFile);
+
+void SetTreeCachePolicy(const TreeCachePolicy &Policy);
+
+const TreeCachePolicy &GetTreeCachePolicy();
+
 TTree *GetTree(TFile *InputFile, const char *TreeName);
 
+TreeReadStage BeginTreeReads(TTree *Tree);
+
+TreeReadStats EndTreeReads(TTree *Tree, TreeReadStage &Stage);
+
+void PrintTreeReadSummary(Int_t RunNumber, Int_t SubRunNumber,
+                          const std::vector<std::pair<std::string, TreeReadStats> > &Stages);
+
 std::pair<Int_t, Int_t> ExtractRunNumbers(const std::string &FileName);
 
 std::string CreateTraceDirectory(const std::pair<Int_t, Int_t> &RunNumbers);
 
+UInt_t GetTreeTag(TTree *Tree);
+
+void ReleaseTreeReaders();
+
+Bool_t ReadPositions(TTree *TreeInput, Long64_t Entry, Double_t &PosX, Double_t &PosY);
+
+Bool_t ReadRootDevices(TTree *TreeInput, Long64_t Entry, std::vector<processor_struct::ROOTDEV> &Devices,
+                       Bool_t WithTraces = true);
+
+void CompareRootDevReads(const char *InputFileName, Long64_t MaxEntries);
+
+// Skims
+Bool_t IsSkimTree(TTree *Tree);
+
+std::pair<const char *, const char *> GetPositionBranches(TTree *Tree);
+
+Long64_t GetSourceEntry(TTree *Tree, Long64_t Entry);
+
+Bool_t ReadSkimDevices(TTree *TreeInput, Long64_t Entry, std::vector<processor_struct::ROOTDEV> &Devices,
+                       Bool_t WithTraces);
+
+void WriteSkim(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents, const char *FileName,
+               Bool_t PackTraces = false);
+
+TFile *OpenSkimFile(const char *InputFileName, Int_t RunNumber, Int_t SubRunNumber, Bool_t PackTraces = false);
+
+Int_t SkimSlot(const processor_struct::ROOTDEV &Device);
+
+Int_t GetTraceSlotWidth(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents);
+
+void FillTraceSlots(const std::vector<processor_struct::ROOTDEV> &Devices, Int_t TraceLength, Int_t *Channels,
+                    Int_t *SampleCounts, UShort_t *Samples, TraceSlotLosses &Losses);
+
+void PrintTraceSlotLosses(const TraceSlotLosses &Losses, Int_t TraceLength, const char *FileName);
+
+// TraceCache
+void WriteTraceCache(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents, const char *FileName);
+
+void BuildTraceCache(const char *InputFileName, const char *CacheFileName);
+
+void OpenTraceCache(const char *FileName);
+
+void CloseTraceCache();
+
+Long64_t GetTraceCacheEvents();
+
+const TraceCacheRecord *GetTraceCacheRecord(Long64_t Event);
+
+const UShort_t *GetTraceCacheSamples(Long64_t Event, Int_t Slot);
+
+void FitTraceCache(const char *CacheFileName, Long64_t MaxEvents);
+
+// TraceCodec
+void EncodeTrace(const UInt_t *Samples, Int_t SampleCount, std::vector<UInt_t> &Output);
+
+const UInt_t *DecodeTrace(const UInt_t *Input, const UInt_t *InputEnd, std::vector<UInt_t> &Samples);
+
+Long64_t BenchmarkTraceCodec(const char *InputFileName, Long64_t MaxEvents);
+
 // EventSelection
-std::vector<Long64_t> GetAllQualifyingEvents(TTree *TreeInput);
+std::vector<Long64_t> GetAllQualifyingEvents(TTree *TreeInput, const std::vector<ClusterZone> *Zones = nullptr);
 
 Bool_t MeetsSelectionCriteria(TTree *TreeInput, Long64_t Entry);
 
+std::vector<std::pair<Long64_t, Long64_t> > GetClusterRanges(TTree *Tree);
+
 std::vector<Long64_t> ScanEvents(TTree *Tree, Long64_t MaxEventsToSave);
 
+void LoadSelection(const char *FileName);
+
+void BeginSelectionSubRun();
+
+void PrintSelectionCutFlow(Int_t RunNumber, Int_t SubRunNumber);
+
+void WriteSelectionCutFlow(TFile &OutputFile);
+
+void SetSelectionFromEntryList(Bool_t Enabled);
+
+BitmapQuery SelectionBitmapQuery();
+
+std::string GetSelectionFingerprint();
+
+std::vector<std::string> GetSelectionVariables();
+
+std::shared_ptr<SelectionPipeline> ForkSelection();
+
+void UseThreadSelection(std::shared_ptr<SelectionPipeline> Pipeline);
+
+void AdoptSelection(const std::shared_ptr<SelectionPipeline> &Pipeline);
+
+// SubRunPrefetch
+void StartSubRunPrefetch(const std::vector<std::pair<Int_t, Int_t> > &SubRuns, Int_t Lookahead, SubRunLoader Loader);
+
+Bool_t NextPrefetchedSubRun(SubRunInput &Input);
+
+void StopSubRunPrefetch();
+
+// ProcessPool
+Long64_t RunSubRunProcesses(const std::vector<std::pair<Int_t, Int_t> > &SubRuns, const ProcessPoolConfig &Config,
+                            const SubRunLoader &Selector, const SubRunTaskProcessor &Processor);
+
+// EventPipeline
+std::vector<AnalysisResults> RunEventPipeline(TTree *TreeInput, const std::vector<Long64_t> &QualifyingEvents,
+                                              AnalysisMode Mode, const EventPipelineConfig &Config,
+                                              AnalysisResultsFile *Output = nullptr);
+
+// ZoneMaps
+void BuildZoneMaps(TTree *TreeInput, const char *FileName, const std::vector<std::string> &Variables);
+
+std::vector<ClusterZone> LoadZoneMaps(const char *FileName, TTree *TreeInput);
+
+std::vector<ClusterZone> GetZoneMaps(TTree *TreeInput, const char *FileName);
+
+// SelectionBitmaps
+void BuildSelectionBitmaps(TTree *TreeInput, const char *FileName);
+
+std::vector<std::string> SelectionBitmapRange(const std::string &Variable, Double_t Lower, Double_t Upper);
+
+TEntryList *SelectFromBitmaps(const char *FileName, const BitmapQuery &Query, TTree *TreeInput);
+
+std::vector<Long64_t> GetBitmapQualifyingEvents(TTree *TreeInput, const char *FileName, const BitmapQuery &Query);
+
 // TraceGraphs
+// Anode channel numbers with their result names and graph titles
+extern const std::map<Int_t, std::pair<std::string, std::string>> AnodeChannelMap;
+
 void SaveTraceGraphs(TTree *TreeInput, Long64_t Entry, const char *ImagePath);
 
 TGraph *CreateTraceGraph(const processor_struct::ROOTDEV &Device, const std::string &Title, Int_t DeviceIndex);
@@ -91,22 +545,141 @@ std::optional<AnalysisResults::DynodeFit> ExtractDynodeFitParameters(const TF1 *
 
 std::optional<AnalysisResults::ChannelFit> ExtractAnodeFitParameters(const TF1 *FitFunc);
 
-std::optional<AnalysisResults> GetEventFitParameters(TTree *TreeInput, Long64_t Entry);
+std::optional<AnalysisResults::ChannelFit> ExtractJointAnodeFitParameters(const TF1 *FitFunc, const std::string &Channel);
+
+Bool_t DecodeEvent(TTree *TreeInput, Long64_t Entry, DecodedEvent &Event, EventReport *StatusReport = nullptr);
+
+Bool_t PrepareEventFits(DecodedEvent &Event, EventReport *StatusReport = nullptr);
+
+std::optional<AnalysisResults> FitDecodedEvent(const DecodedEvent &Event, EventReport *StatusReport = nullptr);
+
+std::optional<AnalysisResults> GetEventFitParameters(TTree *TreeInput, Long64_t Entry,
+                                                     EventReport *StatusReport = nullptr);
+
+std::string AnalysisResultsFileName(Int_t RunNumber, Int_t SubRunNumber, Int_t Part = -1);
+
+std::unique_ptr<AnalysisResultsFile> OpenAnalysisResults(Int_t RunNumber, Int_t SubRunNumber, Int_t Part = -1);
+
+void FillAnalysisResults(AnalysisResultsFile &Output, const AnalysisResults &Result);
+
+void CloseAnalysisResults(AnalysisResultsFile &Output, const std::vector<AnalysisResults> &Results);
 
 void SaveAnalysisResults(const std::vector<AnalysisResults> &Results, Int_t RunNumber, Int_t SubRunNumber);
 
+void PrintFitBudgetSummary(const std::vector<AnalysisResults> &Results, Int_t RunNumber, Int_t SubRunNumber);
+
+void CompareJointAnodeFits(const char *InputFileName, Long64_t MaxEvents, const char *OutputFileName);
+
 // FitAnalysis
+void SetFitBudget(const FitBudget &Budget);
+
+const FitBudget &GetFitBudget();
+
+void SetDynodeFitMode(DynodeFitMode Mode);
+
+void SetDynodeDecaySeeding(Bool_t Enabled);
+
+void SetAnodeFitMode(AnodeFitMode Mode);
+
+AnodeFitMode GetAnodeFitMode();
+
+void SetJointAnodeOffsets(const std::map<std::string, Double_t> &Offsets);
+
+void SetModelSelectionPolicies(const ModelSelectionPolicy &AnodePolicy, const ModelSelectionPolicy &DynodePolicy);
+
+PulseModel SelectPulseModel(const TraceStatistics &Statistics, Bool_t Dynode);
+
+std::optional<Double_t> TryCalculateRisePower(const std::string &Channel, Double_t Position);
+
 Double_t CalculateRisePower(const std::string &Channel, Double_t Position);
 
 Double_t AnodePeakFunction(const Double_t *X, const Double_t *Parameters);
 
 TF1 *FitPeakToTrace(TGraph *TraceGraph, Double_t FitRangeStart,
                     Double_t FitRangeEnd, const std::string &Channel,
-                    Double_t PosX, Double_t PosY);
+                    Double_t PosX, Double_t PosY, FitReport *Report = nullptr,
+                    const TraceStatistics *Statistics = nullptr, PulseModel Model = PulseModel::Full);
+
+Double_t JointAnodePeakFunction(const Double_t *X, const Double_t *Parameters);
+
+TF1 *FitAnodesJointly(const std::map<std::string, TGraph *> &TraceGraphs, Double_t PosX, Double_t PosY,
+                      FitReport *Report = nullptr);
 
 Double_t DynodePeakFunction(const Double_t *X, const Double_t *Parameters);
 
-TF1 *FitDynodePeak(TGraph *TraceGraph, Double_t FitRangeStart, Double_t FitRangeEnd);
+TF1 *FitDynodePeak(TGraph *TraceGraph, Double_t FitRangeStart, Double_t FitRangeEnd,
+                   FitReport *Report = nullptr, const TraceStatistics *Statistics = nullptr,
+                   PulseModel Model = PulseModel::Full);
+
+// TraceStatistics
+template <typename T>
+TraceStatistics ComputeTraceStatistics(const T *Samples, Int_t SampleCount, Int_t BaselinePoints = 20,
+                                       Double_t ThresholdSigma = 10, Int_t UndershootOffset = 100);
+
+// TraceQuality
+void SetTraceFilterPolicy(const TraceFilterPolicy &Policy);
+
+Bool_t IsTraceFilterEnabled();
+
+void BeginTraceFilterSubRun(Int_t RunNumber);
+
+TraceRejectReason ScreenTrace(const std::string &Channel, const UInt_t *Samples, Int_t SampleCount,
+                              const TraceStatistics &Statistics);
+
+void CountScreenedEvent(Bool_t Rejected);
+
+void PrintTraceFilterSummary(Int_t RunNumber, Int_t SubRunNumber);
+
+void WriteTraceFilterCounters(TFile &OutputFile);
+
+// EventQuarantine
+void BeginEventStatusSubRun();
+
+void RecordEventStatus(Long64_t Entry, const EventReport &Report);
+
+void PrintEventStatusSummary(Int_t RunNumber, Int_t SubRunNumber);
+
+void WriteRejectTree(TFile &OutputFile);
+
+// DecayEstimation
+std::optional<DynodeDecayEstimate> EstimateDynodeDecays(const Double_t *Samples, Int_t SampleCount,
+                                                        Int_t PeakIndex, Double_t Baseline);
+
+// PulseEstimators
+std::optional<AnalysisResults::ChannelFit> EstimateAnodeParameters(const Double_t *Samples, Int_t SampleCount,
+                                                                   const TraceStatistics &Statistics,
+                                                                   Double_t RisePower);
+
+std::optional<AnalysisResults::DynodeFit> EstimateDynodeParameters(const Double_t *Samples, Int_t SampleCount,
+                                                                   const TraceStatistics &Statistics);
+
+std::optional<AnalysisResults> EstimateDecodedEvent(const DecodedEvent &Event, Bool_t MatchTemplates = false,
+                                                    EventReport *StatusReport = nullptr);
+
+std::optional<AnalysisResults> GetEventEstimatedParameters(TTree *TreeInput, Long64_t Entry,
+                                                           Bool_t MatchTemplates = false,
+                                                           EventReport *StatusReport = nullptr);
+
+void CompareEstimatesWithFits(const char *InputFileName, Long64_t MaxEvents, const char *OutputFileName);
+
+// PulseTemplates
+void BuildPulseTemplates(const std::vector<std::pair<Int_t, Int_t> > &RunsToProcess, const char *OutputFileName);
+
+const std::vector<Double_t> *GetPulseTemplate(const std::string &Channel, Double_t PosX, Double_t PosY);
+
+std::optional<AnalysisResults::ChannelFit> MatchPulseTemplate(const Double_t *Samples, Int_t SampleCount,
+                                                              const TraceStatistics &Statistics,
+                                                              const std::vector<Double_t> &Template);
+
+// FitProfiling
+void EnableSlowFitRecorder(Int_t FitsPerCategory);
+
+void BeginSlowFitSubRun(Int_t RunNumber, Int_t SubRunNumber);
+
+void RecordFitForProfiling(Long64_t Entry, const std::string &Channel, Double_t PosX, Double_t PosY,
+                           const FitReport &Report, const processor_struct::ROOTDEV &Device);
+
+void SaveSlowFits(const char *FileName);
 
 // AnalyseTraces
 TH2D *CreateScatterPlot(const char *Name, const char *Title,